@@ -0,0 +1,577 @@
+/*
+* ais.c
+*
+* NMEA Server Application
+*
+* AIS ingest stage.  Multi-fragment !xxVDM/!xxVDO messages are collected
+* until complete, so that a message can be recognised as a duplicate of
+* one already received through another AIS receiver and either suppressed
+* or passed on, as the original fragments or as a single reassembled
+* sentence.
+*
+* Duplicates are detected with a small open-addressed set of payload
+* hashes.  Each lookup examines a bounded number of entries, and entries
+* older than the deduplication window are simply reused, so the set never
+* needs to be swept.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nmead.h"
+#include "ais.h"
+
+
+extern int verbose;
+
+
+
+
+/*
+* aisclock
+*
+* Returns a monotonic millisecond clock.
+*
+* Parameters:
+*     None.
+*
+* Return Value:
+*     The function returns the clock reading in milliseconds.
+*
+* Remarks:
+*     Only differences between readings are meaningful.
+*
+*/
+static unsigned long aisclock (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+}
+
+
+
+
+/*
+* isaissentence
+*
+* Determines whether a sentence is an AIS VDM or VDO sentence.
+*
+* Parameters:
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*
+* Return Value:
+*     The function returns TRUE for an AIS sentence, FALSE otherwise.
+*
+* Remarks:
+*     TAG blocks in front of the sentence are looked past.
+*
+*/
+int isaissentence (const char * msg, int length)
+{
+    int skip = skiptags (msg, length);
+
+    msg += skip;
+    length -= skip;
+    return (length > 7 && msg[0] == '!' && msg[6] == ','
+            && msg[3] == 'V' && msg[4] == 'D'
+            && (msg[5] == 'M' || msg[5] == 'O'));
+}
+
+
+
+
+/*
+* parseais
+*
+* Splits an AIS sentence into its fields and verifies its checksum.
+*
+* Parameters:
+*     msg    : const char *  : The sentence.
+*     length : int           : Length of the sentence.
+*     f      : aisfields_t * : Receives the fields.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if the sentence is
+*     malformed.
+*
+* Remarks:
+*     A malformed sentence leaves an empty payload with no fill bits.
+*     TAG blocks in front of the sentence are skipped.
+*
+*/
+int parseais (const char * msg, int length, aisfields_t * f)
+{
+    const char * field[7];
+    const char * end = msg + length;
+    const char * p;
+    unsigned char sum = 0;
+    int nfields = 1;
+    int cs, i, d;
+
+    msg += skiptags (msg, length);
+    f->payload = msg;
+    f->payloadlength = 0;
+    f->fill = '0';
+
+    field[0] = msg;
+    for (p = msg + 1; p < end && *p != '*'; p++) {
+        sum ^= (unsigned char) *p;
+        if (*p == ',') {
+            if (nfields == 7)
+                return -1;
+            field[nfields++] = p + 1;
+        }
+    }
+    if (nfields != 7 || p + 2 >= end)
+        return -1;
+    for (cs = 0, i = 1; i <= 2; i++) {
+        d = p[i];
+        if (d >= '0' && d <= '9')
+            cs = cs * 16 + d - '0';
+        else if (d >= 'A' && d <= 'F')
+            cs = cs * 16 + d - 'A' + 10;
+        else if (d >= 'a' && d <= 'f')
+            cs = cs * 16 + d - 'a' + 10;
+        else
+            return -1;
+    }
+    if (cs != sum)
+        return -1;
+
+    f->count = field[1][0] - '0';
+    f->number = field[2][0] - '0';
+    if (f->count < 1 || f->count > AISMAXFRAGMENTS
+      || f->number < 1 || f->number > f->count)
+        return -1;
+    f->seqid = (field[3][0] == ',') ? '\0' : field[3][0];
+    f->channel = (field[4][0] == ',') ? '\0' : field[4][0];
+    f->payload = field[5];
+    f->payloadlength = (int) (field[6] - field[5]) - 1;
+    f->fill = field[6][0];
+
+    return 0;
+}
+
+
+
+
+/*
+* tagsource
+*
+* Extracts the source ID from the TAG blocks in front of a sentence.
+*
+* Parameters:
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*     source : char *       : Receives the source ID, NUL-terminated.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The source is the value of the "s:" parameter.  It is left empty
+*     when there is none, and cut short at AISSOURCELENGTH - 1 characters.
+*
+*/
+static void tagsource (const char * msg, int length, char * source)
+{
+    int end = skiptags (msg, length);
+    int i, n;
+
+    source[0] = '\0';
+    for (i = 0; i + 2 < end; i++) {
+        if (msg[i + 1] != 's' || msg[i + 2] != ':'
+          || (msg[i] != '\\' && msg[i] != ','))
+            continue;
+        i += 3;
+        for (n = 0; i < end && n < AISSOURCELENGTH - 1; i++, n++) {
+            if (msg[i] == ',' || msg[i] == '*' || msg[i] == '\\')
+                break;
+            source[n] = msg[i];
+        }
+        source[n] = '\0';
+        return;
+    }
+
+    return;
+}
+
+
+
+
+/*
+* payloadhash
+*
+* Folds a payload into the duplicate set's hash value.
+*
+* Parameters:
+*     hash    : unsigned int : The hash so far, or zero to start.
+*     payload : const char * : Payload characters.
+*     length  : int          : Number of payload characters.
+*
+* Return Value:
+*     The function returns the updated hash (32-bit FNV-1a).
+*
+* Remarks:
+*
+*/
+static unsigned int payloadhash (unsigned int hash, const char * payload,
+                                 int length)
+{
+    int i;
+
+    if (hash == 0)
+        hash = 2166136261U;
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) payload[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+
+
+/*
+* isduplicate
+*
+* Looks a payload hash up in the duplicate set and records it if absent.
+*
+* Parameters:
+*     ais  : aisfilter_t * : The AIS stage.
+*     hash : unsigned int  : Hash of the complete message payload.
+*     now  : unsigned long : Current clock reading.
+*
+* Return Value:
+*     The function returns TRUE if the payload was seen within the
+*     deduplication window, FALSE otherwise.
+*
+* Remarks:
+*     When every probed entry is still live, the oldest is replaced.
+*
+*/
+static int isduplicate (aisfilter_t * ais, unsigned int hash,
+                        unsigned long now)
+{
+    aisdedup_t * e, * victim = NULL;
+    unsigned int i;
+    unsigned int age, victimage = 0;
+
+    if (ais->window <= 0)
+        return FALSE;
+    if (hash == 0)
+        hash = 1;
+
+    for (i = 0; i < AISDEDUPPROBES; i++) {
+        e = &ais->dedup[(hash + i) & (AISDEDUPSIZE - 1)];
+        age = (unsigned int) now - e->seen;
+        if (e->hash == 0 || age >= (unsigned int) ais->window)
+            age = ~0U;
+        else if (e->hash == hash)
+            return TRUE;
+
+        if (victim == NULL || age > victimage) {
+            victim = e;
+            victimage = age;
+        }
+    }
+
+    victim->hash = hash;
+    victim->seen = (unsigned int) now;
+
+    return FALSE;
+}
+
+
+
+
+/*
+* emitreassembled
+*
+* Passes on a complete multi-fragment message as a single sentence.
+*
+* Parameters:
+*     ais  : aisfilter_t * : The AIS stage.
+*     slot : aisslot_t *   : The completed message.
+*     emit : aisemit_t     : Output callback.
+*     ctx  : void *        : Callback context.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if the message is
+*     too long to be passed on as one sentence.
+*
+* Remarks:
+*
+*/
+static int emitreassembled (aisfilter_t * ais, aisslot_t * slot,
+                            aisemit_t emit, void * ctx)
+{
+    char out[AISPAYLOADLENGTH + 32];
+    aisfields_t f;
+    unsigned char sum = 0;
+    int length, i;
+
+    /* Talker and formatter are taken from the first fragment */
+    memcpy (out, slot->fragment[0]
+                 + skiptags (slot->fragment[0], slot->length[0]), 6);
+    length = 6;
+    length += sprintf (out + length, ",1,1,,%c,",
+                       slot->channel ? slot->channel : 'A');
+
+    f.fill = '0';
+    for (i = 0; i < slot->count; i++) {
+        parseais (slot->fragment[i], slot->length[i], &f);
+        memcpy (out + length, f.payload, f.payloadlength);
+        length += f.payloadlength;
+    }
+    out[length++] = ',';
+    out[length++] = f.fill;
+
+    for (i = 1; i < length; i++)
+        sum ^= (unsigned char) out[i];
+    length += sprintf (out + length, "*%02X\r\n", sum);
+
+    if (length > ais->maxlength)
+        return -1;
+
+    emit (ctx, out, length);
+    return 0;
+}
+
+
+
+
+/*
+* newaisfilter
+*
+* Creates the AIS ingest stage.
+*
+* Parameters:
+*     mode      : int : AIS_FORWARD_FRAGMENTS or AIS_FORWARD_REASSEMBLED.
+*     window    : int : Deduplication window in ms, or zero for none.
+*     maxlength : int : Longest sentence that may be passed on.
+*
+* Return Value:
+*     The function returns a pointer to a new aisfilter_t object, or NULL
+*     if it cannot be allocated.
+*
+* Remarks:
+*
+*/
+aisfilter_t * newaisfilter (int mode, int window, int maxlength)
+{
+    aisfilter_t * ais = (aisfilter_t *) calloc (1, sizeof (aisfilter_t));
+
+    if (ais == NULL) return NULL;
+
+    ais->mode = mode;
+    ais->window = window;
+    ais->maxlength = maxlength;
+
+    return ais;
+}
+
+
+
+
+/*
+* destroyaisfilter
+*
+* Destroys the AIS ingest stage.
+*
+* Parameters:
+*     ais : aisfilter_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroyaisfilter (aisfilter_t * ais)
+{
+    free (ais);
+    return;
+}
+
+
+
+
+/*
+* aisfilter
+*
+* Passes an AIS sentence through the ingest stage.
+*
+* Parameters:
+*     ais    : aisfilter_t * : The AIS stage.
+*     msg    : const char *  : The sentence, as read from the source.
+*     length : int           : Length of the sentence.
+*     emit   : aisemit_t     : Called for each sentence to be passed on.
+*     ctx    : void *        : Context for emit.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Fragments are held back until their message is complete.  Sentences
+*     that cannot be parsed are passed on unchanged, and so are fragments
+*     whose predecessors were lost, unless the same fragment was already
+*     passed on within the deduplication window.  Sentences keep their TAG
+*     blocks, except that a reassembled message is a new sentence without
+*     any.
+*
+*/
+void aisfilter (aisfilter_t * ais, const char * msg, int length,
+                aisemit_t emit, void * ctx)
+{
+    aisfields_t f;
+    aisslot_t * slot = NULL, * s;
+    unsigned long now = aisclock ();
+    const char * talker = msg + skiptags (msg, length) + 1;
+    char source[AISSOURCELENGTH];
+    char number[2];
+    unsigned int hash;
+    int i;
+
+    if (parseais (msg, length, &f) != 0) {
+        emit (ctx, msg, length);
+        return;
+    }
+
+    if (f.count == 1) {
+        hash = payloadhash (0, f.payload, f.payloadlength);
+        hash = payloadhash (hash, &f.fill, 1);
+        if (isduplicate (ais, hash, now))
+            ais->duplicates++;
+        else
+            emit (ctx, msg, length);
+        return;
+    }
+
+    /* Find the message this fragment belongs to, retiring stale ones.
+       A fragment 1 always starts a message of its own, and a later one
+       goes to the oldest message with the same key that expects it. */
+    tagsource (msg, length, source);
+    for (i = 0; i < AISSLOTS; i++) {
+        s = &ais->slot[i];
+        if (s->inuse && now - s->started > AISSLOTTIMEOUT)
+            s->inuse = FALSE;
+        if (f.number == 1) {
+            if (slot == NULL || (slot->inuse && (!s->inuse
+              || s->started < slot->started)))
+                slot = s;
+        } else if (s->inuse && s->received == f.number - 1
+          && s->seqid == f.seqid && s->channel == f.channel
+          && s->count == f.count && memcmp (s->talker, talker, 2) == 0
+          && strcmp (s->source, source) == 0
+          && (slot == NULL || s->started < slot->started))
+            slot = s;
+    }
+
+    if (f.number == 1) {
+        slot->inuse = TRUE;
+        strcpy (slot->source, source);
+        memcpy (slot->talker, talker, 2);
+        slot->seqid = f.seqid;
+        slot->channel = f.channel;
+        slot->count = f.count;
+        slot->received = 0;
+        slot->started = now;
+    }
+
+    /* A fragment that cannot be reassembled is passed on alone, unless
+       the same fragment came through another receiver */
+    if (slot == NULL || length > AISTAGLENGTH + AISFRAGMENTLENGTH) {
+        if (slot != NULL)
+            slot->inuse = FALSE;
+        hash = payloadhash (0, f.payload, f.payloadlength);
+        hash = payloadhash (hash, &f.fill, 1);
+        number[0] = (char) ('0' + f.number);
+        number[1] = (char) ('0' + f.count);
+        hash = payloadhash (hash, number, 2);
+        if (isduplicate (ais, hash, now))
+            ais->duplicates++;
+        else
+            emit (ctx, msg, length);
+        return;
+    }
+
+    memcpy (slot->fragment[slot->received], msg, length);
+    slot->length[slot->received] = length;
+    slot->received++;
+    if (slot->received < slot->count)
+        return;
+
+    /* Message complete */
+    slot->inuse = FALSE;
+    hash = 0;
+    for (i = 0; i < slot->count; i++) {
+        parseais (slot->fragment[i], slot->length[i], &f);
+        hash = payloadhash (hash, f.payload, f.payloadlength);
+    }
+    hash = payloadhash (hash, &f.fill, 1);
+
+    if (isduplicate (ais, hash, now)) {
+        ais->duplicates++;
+        if (verbose >= 100)
+            LOG ("aisfilter: dropped duplicate %ld-fragment message\n",
+                slot->count);
+        return;
+    }
+
+    if (ais->mode == AIS_FORWARD_REASSEMBLED
+      && emitreassembled (ais, slot, emit, ctx) == 0)
+        return;
+
+    for (i = 0; i < slot->count; i++)
+        emit (ctx, slot->fragment[i], slot->length[i]);
+
+    return;
+}
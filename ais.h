@@ -0,0 +1,149 @@
+/*
+* ais.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the AIS ingest stage, which
+* reassembles multi-fragment !xxVDM/!xxVDO messages and suppresses
+* duplicates received through more than one AIS receiver.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef AIS_H
+#define AIS_H
+
+
+#define AISMAXFRAGMENTS     9       /* largest fragment count in a message */
+#define AISFRAGMENTLENGTH   100     /* longest single fragment kept */
+#define AISTAGLENGTH        80      /* TAG blocks kept in front of one */
+#define AISSOURCELENGTH     16      /* longest source ID in a slot key */
+#define AISPAYLOADLENGTH    (AISMAXFRAGMENTS * AISFRAGMENTLENGTH)
+#ifdef NMEAD_SMALL
+#define AISSLOTS            8       /* messages in reassembly at once */
+#define AISDEDUPSIZE        1024    /* entries in the duplicate set (2^n) */
+#else
+#define AISSLOTS            32      /* messages in reassembly at once */
+#define AISDEDUPSIZE        4096    /* entries in the duplicate set (2^n) */
+#endif
+#define AISSLOTTIMEOUT      2000    /* ms before a partial message is dropped */
+#define AISDEDUPPROBES      16      /* entries examined per lookup */
+
+
+/* Forwarding modes */
+#define AIS_FORWARD_FRAGMENTS    0  /* pass on the original sentences */
+#define AIS_FORWARD_REASSEMBLED  1  /* pass on one sentence per message */
+
+
+/* Fields of a parsed !xxVDM sentence */
+typedef struct {
+    int count;
+    int number;
+    char seqid;
+    char channel;
+    const char * payload;
+    int payloadlength;
+    char fill;
+} aisfields_t;
+
+
+/* Called for each sentence the stage passes on */
+typedef void (* aisemit_t) (void * ctx, const char * msg, int length);
+
+
+/* A message being reassembled.  Fragments are keyed by the TAG block
+   source (empty when there is none), talker ID, sequential message ID and
+   channel.  Receivers that share a key still get a slot each, since a
+   fragment 1 never takes over a slot that is already collecting. */
+typedef struct {
+    int inuse;
+    char source[AISSOURCELENGTH];
+    char talker[2];
+    char seqid;
+    char channel;
+    int count;
+    int received;
+    unsigned long started;
+    int length[AISMAXFRAGMENTS];
+    char fragment[AISMAXFRAGMENTS][AISTAGLENGTH + AISFRAGMENTLENGTH];
+} aisslot_t;
+
+
+/* Duplicate set entry: a payload hash and the time it was last seen.
+   An entry older than the window counts as free. */
+typedef struct {
+    unsigned int hash;
+    unsigned int seen;
+} aisdedup_t;
+
+
+typedef struct {
+    int mode;
+    int window;                      /* ms; zero disables deduplication */
+    int maxlength;                   /* longest sentence that may be emitted */
+    unsigned long duplicates;
+    aisslot_t slot[AISSLOTS];
+    aisdedup_t dedup[AISDEDUPSIZE];
+} aisfilter_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+aisfilter_t * newaisfilter (int mode, int window, int maxlength);
+void destroyaisfilter (aisfilter_t * ais);
+int isaissentence (const char * msg, int length);
+int parseais (const char * msg, int length, aisfields_t * f);
+void aisfilter (aisfilter_t * ais, const char * msg, int length,
+                aisemit_t emit, void * ctx);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* AIS_H */
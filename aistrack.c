@@ -0,0 +1,1291 @@
+/*
+* aistrack.c
+*
+* NMEA Server Application
+*
+* AIS target tracker.  AIS messages are decoded as they pass through the
+* talker, keeping for each target its latest position, course and speed,
+* and static and voyage data.  The target's last known position is
+* recorded with every sentence about it, so that a worker can tell with
+* one comparison whether a client that asked for an area (commands AREA
+* and RANGE) is to be sent it.  The table also answers SNAPSHOT, which
+* describes the targets to a client without waiting for them to report.
+*
+* Targets are found by MMSI through a hash table and by position through
+* a grid of 0.1 degree cells, hashed into a fixed number of buckets; an
+* area query visits only the cells the area overlaps.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "nmead.h"
+#include "aistrack.h"
+
+
+#define GRIDROWS        (180 * AISDEGREE / AISCELLSIZE)
+#define GRIDCOLS        (360 * AISDEGREE / AISCELLSIZE)
+
+
+extern int verbose;
+
+
+/* Where each kind of position report carries its position.  Long-range
+   broadcasts (type 27) give it in 1/10 minute. */
+static const struct {
+    int type;
+    int lonbit, lonbits;
+    int latbit, latbits;
+    int scale;
+} positionfield[] = {
+    {  1,  61, 28,  89, 27,    1 },     /* class A position report */
+    {  2,  61, 28,  89, 27,    1 },
+    {  3,  61, 28,  89, 27,    1 },
+    {  4,  79, 28, 107, 27,    1 },     /* base station report */
+    {  9,  61, 28,  89, 27,    1 },     /* SAR aircraft */
+    { 11,  79, 28, 107, 27,    1 },     /* UTC/date response */
+    { 18,  57, 28,  85, 27,    1 },     /* class B position report */
+    { 19,  57, 28,  85, 27,    1 },     /* extended class B report */
+    { 21, 164, 28, 192, 27,    1 },     /* aid to navigation */
+    { 27,  44, 18,  62, 17, 1000 },     /* long-range broadcast */
+};
+
+
+
+
+/*
+* payloadbits
+*
+* Extracts a field from an armoured AIS payload.
+*
+* Parameters:
+*     payload : const char * : Payload characters.
+*     start   : int          : Index of the field's first bit.
+*     n       : int          : Width of the field, at most 32 bits.
+*
+* Return Value:
+*     The function returns the field as an unsigned number.
+*
+* Remarks:
+*     The caller makes sure the payload holds start + n bits.
+*
+*/
+static unsigned int payloadbits (const char * payload, int start, int n)
+{
+    unsigned int value = 0;
+    int i, c;
+
+    for (i = start; i < start + n; i++) {
+        c = payload[i / 6] - 48;
+        if (c > 40)
+            c -= 8;
+        value = (value << 1) | ((c >> (5 - i % 6)) & 1);
+    }
+
+    return value;
+}
+
+
+
+
+/*
+* signedbits
+*
+* Extracts a two's complement field from an armoured AIS payload.
+*
+* Parameters:
+*     payload : const char * : Payload characters.
+*     start   : int          : Index of the field's first bit.
+*     n       : int          : Width of the field, at most 32 bits.
+*
+* Return Value:
+*     The function returns the field, sign extended.
+*
+* Remarks:
+*
+*/
+static int signedbits (const char * payload, int start, int n)
+{
+    unsigned int value = payloadbits (payload, start, n);
+
+    if (n < 32 && (value & (1U << (n - 1))))
+        value |= ~0U << n;
+
+    return (int) value;
+}
+
+
+
+
+/*
+* gridcell
+*
+* Determines the grid cell a position lies in.
+*
+* Parameters:
+*     lat : int : Latitude, 1/10000 minute.
+*     lon : int : Longitude, 1/10000 minute.
+*
+* Return Value:
+*     The function returns the cell number.
+*
+* Remarks:
+*     Cells are numbered row by row from the south-west corner.
+*
+*/
+static int gridcell (int lat, int lon)
+{
+    int row = (lat + 90 * AISDEGREE) / AISCELLSIZE;
+    int col = (lon + 180 * AISDEGREE) / AISCELLSIZE;
+
+    if (row >= GRIDROWS)
+        row = GRIDROWS - 1;
+    if (col >= GRIDCOLS)
+        col = GRIDCOLS - 1;
+
+    return row * GRIDCOLS + col;
+}
+
+
+
+
+/*
+* cellbucket
+*
+* Maps a grid cell to its bucket.
+*
+* Parameters:
+*     cell : int : The cell number.
+*
+* Return Value:
+*     The function returns the bucket index.
+*
+* Remarks:
+*     Fibonacci hashing spreads neighbouring cells over the buckets.
+*
+*/
+static int cellbucket (int cell)
+{
+    return (int) (((unsigned int) cell * 2654435761U) >> 20)
+           & (AISCELLS - 1);
+}
+
+
+
+
+/*
+* uncell
+*
+* Takes a target out of its grid bucket.
+*
+* Parameters:
+*     track  : aistrack_t *  : The tracker.
+*     target : aistarget_t * : The target.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void uncell (aistrack_t * track, aistarget_t * target)
+{
+    if (target->cell < 0)
+        return;
+
+    if (target->cellprev != NULL)
+        target->cellprev->cellnext = target->cellnext;
+    else
+        track->cell[cellbucket (target->cell)] = target->cellnext;
+    if (target->cellnext != NULL)
+        target->cellnext->cellprev = target->cellprev;
+    target->cell = -1;
+
+    return;
+}
+
+
+
+
+/*
+* unage
+*
+* Takes a target out of the list by age.
+*
+* Parameters:
+*     track  : aistrack_t *  : The tracker.
+*     target : aistarget_t * : The target.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void unage (aistrack_t * track, aistarget_t * target)
+{
+    if (target->newer != NULL)
+        target->newer->older = target->older;
+    else
+        track->newest = target->older;
+    if (target->older != NULL)
+        target->older->newer = target->newer;
+    else
+        track->oldest = target->newer;
+    target->newer = target->older = NULL;
+
+    return;
+}
+
+
+
+
+/*
+* findtarget
+*
+* Looks up a target by MMSI, adding it if it is not known.
+*
+* Parameters:
+*     track : aistrack_t * : The tracker.
+*     mmsi  : unsigned int : The target's MMSI.
+*
+* Return Value:
+*     The function returns the target, moved to the head of the list by
+*     age.
+*
+* Remarks:
+*     When the table is full the target heard from least recently is
+*     forgotten.  Called with the tracker locked.
+*
+*/
+static aistarget_t * findtarget (aistrack_t * track, unsigned int mmsi)
+{
+    aistarget_t ** link = &track->hash[mmsi & (AISTARGETS - 1)];
+    aistarget_t * target;
+
+    for (target = *link; target != NULL; target = target->hashnext)
+        if (target->mmsi == mmsi)
+            break;
+
+    if (target == NULL) {
+        target = track->freelist;
+        if (target != NULL) {
+            track->freelist = target->hashnext;
+            track->ntargets++;
+        }
+        else {
+            target = track->oldest;
+            unage (track, target);
+            uncell (track, target);
+            link = &track->hash[target->mmsi & (AISTARGETS - 1)];
+            while (*link != target)
+                link = &(*link)->hashnext;
+            *link = target->hashnext;
+            if (track->partial == target)
+                track->partial = NULL;
+            if (verbose >= 100)
+                LOG ("aistrack: forgot target %lu\n", target->mmsi);
+            link = &track->hash[mmsi & (AISTARGETS - 1)];
+        }
+        memset (target, 0, sizeof (aistarget_t));
+        target->mmsi = mmsi;
+        target->lat = target->lon = AISNOPOSITION;
+        target->cell = -1;
+        target->hashnext = *link;
+        *link = target;
+    }
+    else
+        unage (track, target);
+
+    target->older = track->newest;
+    if (track->newest != NULL)
+        track->newest->newer = target;
+    else
+        track->oldest = target;
+    track->newest = target;
+
+    return target;
+}
+
+
+
+
+/*
+* placetarget
+*
+* Records a target's new position.
+*
+* Parameters:
+*     track  : aistrack_t *  : The tracker.
+*     target : aistarget_t * : The target.
+*     lat    : int           : Latitude, 1/10000 minute.
+*     lon    : int           : Longitude, 1/10000 minute.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The target changes bucket only when it moves to another cell.
+*     Called with the tracker locked.
+*
+*/
+static void placetarget (aistrack_t * track, aistarget_t * target,
+                         int lat, int lon)
+{
+    int cell = gridcell (lat, lon);
+    aistarget_t ** head;
+
+    target->lat = lat;
+    target->lon = lon;
+    if (cell == target->cell)
+        return;
+
+    uncell (track, target);
+    head = &track->cell[cellbucket (cell)];
+    target->cell = cell;
+    target->cellprev = NULL;
+    target->cellnext = *head;
+    if (*head != NULL)
+        (*head)->cellprev = target;
+    *head = target;
+
+    return;
+}
+
+
+
+
+/*
+* payloadtext
+*
+* Extracts a text field from an armoured AIS payload.
+*
+* Parameters:
+*     payload : const char * : Payload characters.
+*     start   : int          : Index of the field's first bit.
+*     n       : int          : Number of characters in the field.
+*     text    : char *       : Receives the text; n + 1 bytes.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Trailing padding ('@') and spaces are removed.
+*
+*/
+static void payloadtext (const char * payload, int start, int n, char * text)
+{
+    int i, c;
+
+    for (i = 0; i < n; i++) {
+        c = payloadbits (payload, start + 6 * i, 6);
+        text[i] = (c < 32) ? c + 64 : c;
+    }
+    while (n > 0 && (text[n - 1] == '@' || text[n - 1] == ' '))
+        n--;
+    text[n] = '\0';
+
+    return;
+}
+
+
+
+
+/*
+* decodemessage
+*
+* Updates a target from a complete AIS message.
+*
+* Parameters:
+*     track   : aistrack_t *  : The tracker.
+*     target  : aistarget_t * : The target the message is from.
+*     payload : const char *  : The message's payload characters.
+*     length  : int           : Number of payload characters.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Position reports move the target and update its course and speed;
+*     static and voyage reports (types 5, 19 and 24) its particulars.
+*     Messages too short for their type are ignored.  Called with the
+*     tracker locked.
+*
+*/
+static void decodemessage (aistrack_t * track, aistarget_t * target,
+                           const char * payload, int length)
+{
+    int bits = length * 6;
+    int type = payloadbits (payload, 0, 6);
+    int lat, lon;
+    unsigned int i;
+
+    for (i = 0; i < sizeof (positionfield) / sizeof (positionfield[0]); i++) {
+        if (positionfield[i].type != type)
+            continue;
+        if (bits < positionfield[i].latbit + positionfield[i].latbits)
+            return;
+        lon = signedbits (payload, positionfield[i].lonbit,
+                          positionfield[i].lonbits) * positionfield[i].scale;
+        lat = signedbits (payload, positionfield[i].latbit,
+                          positionfield[i].latbits) * positionfield[i].scale;
+        if (lat >= -90 * AISDEGREE && lat <= 90 * AISDEGREE
+          && lon >= -180 * AISDEGREE && lon <= 180 * AISDEGREE)
+            placetarget (track, target, lat, lon);
+        break;
+    }
+
+    switch (type) {
+    case 1:
+    case 2:
+    case 3:
+        if (bits < 143)
+            break;
+        target->station = AISCLASS_A;
+        target->status = payloadbits (payload, 38, 4);
+        target->rot = signedbits (payload, 42, 8);
+        target->sog = payloadbits (payload, 50, 10);
+        target->accuracy = payloadbits (payload, 60, 1);
+        target->cog = payloadbits (payload, 116, 12);
+        target->heading = payloadbits (payload, 128, 9);
+        target->second = payloadbits (payload, 137, 6);
+        target->have |= AISHAVE_NAV;
+        break;
+
+    case 18:
+    case 19:
+        if (bits < 139)
+            break;
+        target->station = AISCLASS_B;
+        target->status = 15;                /* not defined */
+        target->rot = -128;                 /* not available */
+        target->sog = payloadbits (payload, 46, 10);
+        target->accuracy = payloadbits (payload, 56, 1);
+        target->cog = payloadbits (payload, 112, 12);
+        target->heading = payloadbits (payload, 124, 9);
+        target->second = payloadbits (payload, 133, 6);
+        target->have |= AISHAVE_NAV;
+        if (type == 18 || bits < 305)
+            break;
+        payloadtext (payload, 143, AISNAMELENGTH, target->name);
+        target->shiptype = payloadbits (payload, 263, 8);
+        target->tobow = payloadbits (payload, 271, 9);
+        target->tostern = payloadbits (payload, 280, 9);
+        target->toport = payloadbits (payload, 289, 6);
+        target->tostarboard = payloadbits (payload, 295, 6);
+        target->epfd = payloadbits (payload, 301, 4);
+        target->have |= AISHAVE_STATIC;
+        break;
+
+    case 27:
+        if (bits < 94)
+            break;
+        target->station = AISCLASS_A;
+        target->status = payloadbits (payload, 40, 4);
+        target->rot = -128;
+        target->sog = payloadbits (payload, 79, 6) * 10;
+        target->accuracy = payloadbits (payload, 38, 1);
+        target->cog = payloadbits (payload, 85, 9) * 10;
+        target->heading = 511;              /* not available */
+        target->second = 60;
+        target->have |= AISHAVE_NAV;
+        break;
+
+    case 5:
+        if (bits < 420)
+            break;
+        target->imo = payloadbits (payload, 40, 30);
+        payloadtext (payload, 70, 7, target->callsign);
+        payloadtext (payload, 112, AISNAMELENGTH, target->name);
+        target->shiptype = payloadbits (payload, 232, 8);
+        target->tobow = payloadbits (payload, 240, 9);
+        target->tostern = payloadbits (payload, 249, 9);
+        target->toport = payloadbits (payload, 258, 6);
+        target->tostarboard = payloadbits (payload, 264, 6);
+        target->epfd = payloadbits (payload, 270, 4);
+        target->eta = payloadbits (payload, 274, 20);
+        target->draught = payloadbits (payload, 294, 8);
+        payloadtext (payload, 302, AISNAMELENGTH, target->destination);
+        target->have |= AISHAVE_STATIC | AISHAVE_VOYAGE;
+        break;
+
+    case 24:
+        if (bits < 160)
+            break;
+        if (payloadbits (payload, 38, 2) == 0)
+            payloadtext (payload, 40, AISNAMELENGTH, target->name);
+        else if (bits >= 162) {
+            target->shiptype = payloadbits (payload, 40, 8);
+            payloadtext (payload, 90, 7, target->callsign);
+            target->tobow = payloadbits (payload, 132, 9);
+            target->tostern = payloadbits (payload, 141, 9);
+            target->toport = payloadbits (payload, 150, 6);
+            target->tostarboard = payloadbits (payload, 156, 6);
+        }
+        target->have |= AISHAVE_STATIC;
+        break;
+    }
+
+    return;
+}
+
+
+
+
+/*
+* setbits
+*
+* Stores a field in a payload being built.
+*
+* Parameters:
+*     six   : unsigned char * : The payload, six bits per element, zeroed
+*                               beforehand.
+*     start : int             : Index of the field's first bit.
+*     n     : int             : Width of the field.
+*     value : unsigned int    : The field; only its low n bits are used.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void setbits (unsigned char * six, int start, int n,
+                     unsigned int value)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if ((value >> (n - 1 - i)) & 1)
+            six[(start + i) / 6] |= 0x20 >> ((start + i) % 6);
+
+    return;
+}
+
+
+
+
+/*
+* settext
+*
+* Stores a text field in a payload being built.
+*
+* Parameters:
+*     six   : unsigned char * : The payload.
+*     start : int             : Index of the field's first bit.
+*     n     : int             : Number of characters in the field.
+*     text  : const char *    : The text; padded with '@' to n characters.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void settext (unsigned char * six, int start, int n, const char * text)
+{
+    int i, c;
+
+    for (i = 0; i < n; i++) {
+        c = (*text != '\0') ? (unsigned char) *text++ : '@';
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        setbits (six, start + 6 * i, 6, (c >= 64) ? c - 64 : c);
+    }
+
+    return;
+}
+
+
+
+
+/*
+* putsentences
+*
+* Formats a payload as !AIVDM sentences.
+*
+* Parameters:
+*     out   : char *                : Receives the sentences.
+*     six   : const unsigned char * : The payload.
+*     bits  : int                   : Length of the message in bits.
+*     seqid : int                   : Sequential message ID, 0 to 9, used
+*                                     if the message needs more than one
+*                                     sentence.
+*
+* Return Value:
+*     The function returns the number of bytes written.
+*
+* Remarks:
+*     Sentences carry at most 60 payload characters, which keeps them
+*     within the 82 characters of NMEA 0183.
+*
+*/
+static int putsentences (char * out, const unsigned char * six, int bits,
+                         int seqid)
+{
+    char payload[AISPAYLOADLENGTH];
+    char body[100];
+    int nchars = (bits + 5) / 6;
+    int count = (nchars + 59) / 60;
+    int length = 0;
+    int n, i, j, c;
+    unsigned char sum;
+
+    for (i = 0; i < nchars; i++) {
+        c = six[i];
+        payload[i] = (c < 40) ? c + 48 : c + 56;
+    }
+
+    for (i = 0; i < count; i++) {
+        n = (i == count - 1) ? nchars - 60 * i : 60;
+        if (count > 1)
+            sprintf (body, "AIVDM,%d,%d,%d,A,%.*s,%d", count, i + 1, seqid,
+                     n, payload + 60 * i,
+                     (i == count - 1) ? nchars * 6 - bits : 0);
+        else
+            sprintf (body, "AIVDM,1,1,,A,%.*s,%d", n, payload,
+                     nchars * 6 - bits);
+        for (sum = 0, j = 0; body[j] != '\0'; j++)
+            sum ^= (unsigned char) body[j];
+        length += sprintf (out + length, "!%s*%02X\r\n", body, sum);
+    }
+
+    return length;
+}
+
+
+
+
+/*
+* newaistrack
+*
+* Creates an AIS target tracker.
+*
+* Parameters:
+*     None.
+*
+* Return Value:
+*     The function returns a pointer to a new aistrack_t object, or NULL
+*     if it cannot be allocated.
+*
+* Remarks:
+*
+*/
+aistrack_t * newaistrack (void)
+{
+    aistrack_t * track = (aistrack_t *) calloc (1, sizeof (aistrack_t));
+    int i;
+
+    if (track == NULL) return NULL;
+
+    pthread_mutex_init (&track->lock, NULL);
+    for (i = AISTARGETS - 1; i >= 0; i--) {
+        track->target[i].cell = -1;
+        track->target[i].hashnext = track->freelist;
+        track->freelist = &track->target[i];
+    }
+
+    return track;
+}
+
+
+
+
+/*
+* destroyaistrack
+*
+* Destroys an AIS target tracker.
+*
+* Parameters:
+*     track : aistrack_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroyaistrack (aistrack_t * track)
+{
+    if (track == NULL) return;
+
+    pthread_mutex_destroy (&track->lock);
+    free (track);
+
+    return;
+}
+
+
+
+
+/*
+* aistrack
+*
+* Updates the tracker from an AIS sentence and finds the target the
+* sentence is about.
+*
+* Parameters:
+*     track  : aistrack_t * : The tracker.
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*     lat    : int *        : Receives the target's last known latitude,
+*                             or AISNOPOSITION.
+*     lon    : int *        : Receives its longitude.
+*
+* Return Value:
+*     The function returns the target's MMSI, or zero if the sentence
+*     cannot be attributed to a target.
+*
+* Remarks:
+*     Every message begins with its type and the sender's MMSI, so a
+*     single sentence or first fragment identifies its target; the
+*     fragments that follow are attributed to the same target as long as
+*     they arrive in order, and the message is decoded once the last has
+*     arrived.  Only position reports move a target, and TAG blocks in
+*     front of a sentence are skipped.  Each sentence
+*     attributed to a target counts in track->changes, since at least the
+*     time it was last heard has changed.
+*
+*/
+int aistrack (aistrack_t * track, const char * msg, int length,
+              int * lat, int * lon)
+{
+    aistarget_t * target = NULL;
+    aisfields_t f;
+    unsigned int mmsi;
+    int skip;
+
+    *lat = *lon = AISNOPOSITION;
+    skip = skiptags (msg, length);
+    msg += skip;
+    length -= skip;
+    if (parseais (msg, length, &f) != 0)
+        return 0;
+
+    pthread_mutex_lock (&track->lock);
+
+    if (f.number > 1) {
+        if (track->partial != NULL && f.number == track->partialnext
+          && f.count == track->partialcount
+          && f.seqid == track->partialseqid
+          && f.channel == track->partialchannel
+          && memcmp (track->partialtalker, msg + 1, 2) == 0
+          && track->partiallength + f.payloadlength <= AISPAYLOADLENGTH) {
+            target = track->partial;
+            memcpy (track->partialpayload + track->partiallength,
+                    f.payload, f.payloadlength);
+            track->partiallength += f.payloadlength;
+            track->partialnext++;
+            clock_gettime (CLOCK_MONOTONIC, &target->heard);
+            if (f.number == f.count) {
+                decodemessage (track, target, track->partialpayload,
+                               track->partiallength);
+                track->partial = NULL;
+            }
+        }
+        else
+            track->partial = NULL;
+    }
+    else if (f.payloadlength * 6 >= 38) {
+        mmsi = payloadbits (f.payload, 8, 30);
+        if (mmsi != 0) {
+            target = findtarget (track, mmsi);
+            clock_gettime (CLOCK_MONOTONIC, &target->heard);
+        }
+
+        track->partial = (f.count > 1) ? target : NULL;
+        if (target != NULL && f.count > 1) {
+            memcpy (track->partialtalker, msg + 1, 2);
+            track->partialseqid = f.seqid;
+            track->partialchannel = f.channel;
+            track->partialcount = f.count;
+            track->partialnext = 2;
+            memcpy (track->partialpayload, f.payload, f.payloadlength);
+            track->partiallength = f.payloadlength;
+        }
+        else if (target != NULL)
+            decodemessage (track, target, f.payload, f.payloadlength);
+    }
+
+    if (target != NULL) {
+        *lat = target->lat;
+        *lon = target->lon;
+        mmsi = target->mmsi;
+        track->changes++;
+    }
+    else
+        mmsi = 0;
+
+    pthread_mutex_unlock (&track->lock);
+
+    return (int) mmsi;
+}
+
+
+
+
+/*
+* aisquery
+*
+* Finds the targets whose last known position lies in an area.
+*
+* Parameters:
+*     track : aistrack_t *      : The tracker.
+*     area  : const aisarea_t * : The area.
+*     visit : aisvisit_t        : Called for each target found, or NULL.
+*     ctx   : void *            : Context for visit.
+*
+* Return Value:
+*     The function returns the number of targets found.
+*
+* Remarks:
+*     Only the cells overlapping the area's bounding box are examined,
+*     unless there are more of them than buckets; then every target is.
+*     visit is called with the tracker locked, and must not call back
+*     into it.
+*
+*/
+int aisquery (aistrack_t * track, const aisarea_t * area,
+              aisvisit_t visit, void * ctx)
+{
+    aistarget_t * target;
+    int south = 0, north = 0, west = 0, east = 0, rows, cols;
+    int row, col, cell, found = 0;
+
+    pthread_mutex_lock (&track->lock);
+
+    if (area->kind == AISAREA_NONE)
+        rows = cols = GRIDROWS;
+    else {
+        south = gridcell (area->south, 0) / GRIDCOLS;
+        north = gridcell (area->north, 0) / GRIDCOLS;
+        west = gridcell (0, area->west) % GRIDCOLS;
+        east = gridcell (0, area->east) % GRIDCOLS;
+        rows = north - south + 1;
+        cols = (east - west + GRIDCOLS) % GRIDCOLS + 1;
+    }
+
+    if ((long) rows * cols > AISCELLS) {
+        for (target = track->newest; target != NULL; target = target->older)
+            if (target->cell >= 0
+              && inaisarea (area, target->lat, target->lon)) {
+                if (visit != NULL)
+                    visit (ctx, target);
+                found++;
+            }
+    }
+    else {
+        for (row = south; row <= north; row++)
+            for (col = 0; col < cols; col++) {
+                cell = row * GRIDCOLS + (west + col) % GRIDCOLS;
+                for (target = track->cell[cellbucket (cell)]; target != NULL;
+                     target = target->cellnext)
+                    if (target->cell == cell
+                      && inaisarea (area, target->lat, target->lon)) {
+                        if (visit != NULL)
+                            visit (ctx, target);
+                        found++;
+                    }
+            }
+    }
+
+    pthread_mutex_unlock (&track->lock);
+
+    return found;
+}
+
+
+
+
+/*
+* aislookup
+*
+* Looks up a target by MMSI.
+*
+* Parameters:
+*     track : aistrack_t *  : The tracker.
+*     mmsi  : unsigned int  : The target's MMSI.
+*     copy  : aistarget_t * : Receives a copy of the target.
+*
+* Return Value:
+*     The function returns zero if the target is known, nonzero if not.
+*
+* Remarks:
+*     The copy's links are not meaningful.
+*
+*/
+int aislookup (aistrack_t * track, unsigned int mmsi, aistarget_t * copy)
+{
+    aistarget_t * target;
+
+    pthread_mutex_lock (&track->lock);
+    for (target = track->hash[mmsi & (AISTARGETS - 1)]; target != NULL;
+         target = target->hashnext)
+        if (target->mmsi == mmsi) {
+            *copy = *target;
+            break;
+        }
+    pthread_mutex_unlock (&track->lock);
+
+    return (target != NULL) ? 0 : -1;
+}
+
+
+
+
+/*
+* aisencode
+*
+* Describes a target in !AIVDM sentences, as a client that has just
+* connected would have learned it from the live feed.
+*
+* Parameters:
+*     target : const aistarget_t * : The target.
+*     out    : char *              : Receives the sentences; at least
+*                                    AISENCODEMAX bytes.
+*     seqid  : int                 : Sequential message ID for a message
+*                                    of several sentences.
+*
+* Return Value:
+*     The function returns the number of bytes written, zero if there is
+*     nothing to tell of the target.
+*
+* Remarks:
+*     A vessel is described by a position report (type 1 for class A,
+*     18 for class B) and its particulars: a type 5 message if a voyage
+*     report has been heard, otherwise the two parts of a type 24.  Other
+*     stations are left out.
+*
+*/
+int aisencode (const aistarget_t * target, char * out, int seqid)
+{
+    unsigned char six[AISPAYLOADLENGTH];
+    int length = 0;
+
+    if (target->station != AISCLASS_OTHER && (target->have & AISHAVE_NAV)
+      && target->lat != AISNOPOSITION) {
+        memset (six, 0, sizeof (six));
+        if (target->station == AISCLASS_A) {
+            setbits (six, 0, 6, 1);
+            setbits (six, 8, 30, target->mmsi);
+            setbits (six, 38, 4, target->status);
+            setbits (six, 42, 8, target->rot);
+            setbits (six, 50, 10, target->sog);
+            setbits (six, 60, 1, target->accuracy);
+            setbits (six, 61, 28, target->lon);
+            setbits (six, 89, 27, target->lat);
+            setbits (six, 116, 12, target->cog);
+            setbits (six, 128, 9, target->heading);
+            setbits (six, 137, 6, target->second);
+        }
+        else {
+            setbits (six, 0, 6, 18);
+            setbits (six, 8, 30, target->mmsi);
+            setbits (six, 46, 10, target->sog);
+            setbits (six, 56, 1, target->accuracy);
+            setbits (six, 57, 28, target->lon);
+            setbits (six, 85, 27, target->lat);
+            setbits (six, 112, 12, target->cog);
+            setbits (six, 124, 9, target->heading);
+            setbits (six, 133, 6, target->second);
+            setbits (six, 141, 1, 1);               /* carrier-sense unit */
+        }
+        length += putsentences (out + length, six, 168, seqid);
+    }
+
+    if (target->station != AISCLASS_B && (target->have & AISHAVE_VOYAGE)) {
+        memset (six, 0, sizeof (six));
+        setbits (six, 0, 6, 5);
+        setbits (six, 8, 30, target->mmsi);
+        setbits (six, 40, 30, target->imo);
+        settext (six, 70, 7, target->callsign);
+        settext (six, 112, AISNAMELENGTH, target->name);
+        setbits (six, 232, 8, target->shiptype);
+        setbits (six, 240, 9, target->tobow);
+        setbits (six, 249, 9, target->tostern);
+        setbits (six, 258, 6, target->toport);
+        setbits (six, 264, 6, target->tostarboard);
+        setbits (six, 270, 4, target->epfd);
+        setbits (six, 274, 20, target->eta);
+        setbits (six, 294, 8, target->draught);
+        settext (six, 302, AISNAMELENGTH, target->destination);
+        length += putsentences (out + length, six, 424, seqid);
+    }
+    else if (target->have & AISHAVE_STATIC) {
+        memset (six, 0, sizeof (six));
+        setbits (six, 0, 6, 24);
+        setbits (six, 8, 30, target->mmsi);
+        settext (six, 40, AISNAMELENGTH, target->name);
+        length += putsentences (out + length, six, 160, seqid);
+
+        memset (six, 0, sizeof (six));
+        setbits (six, 0, 6, 24);
+        setbits (six, 8, 30, target->mmsi);
+        setbits (six, 38, 2, 1);
+        setbits (six, 40, 8, target->shiptype);
+        settext (six, 90, 7, target->callsign);
+        setbits (six, 132, 9, target->tobow);
+        setbits (six, 141, 9, target->tostern);
+        setbits (six, 150, 6, target->toport);
+        setbits (six, 156, 6, target->tostarboard);
+        length += putsentences (out + length, six, 168, seqid);
+    }
+
+    return length;
+}
+
+
+
+
+/*
+* aisexport
+*
+* Copies out every target, for the state file.
+*
+* Parameters:
+*     track : aistrack_t *  : The tracker.
+*     out   : aistarget_t * : Receives the targets.
+*     max   : int           : Room at out, in targets.
+*
+* Return Value:
+*     The function returns the number of targets copied.
+*
+* Remarks:
+*     Targets are copied from the least to the most recently heard, the
+*     order in which aisimport should take them.  The copies' links are
+*     not meaningful.
+*
+*/
+int aisexport (aistrack_t * track, aistarget_t * out, int max)
+{
+    aistarget_t * target;
+    int n = 0;
+
+    pthread_mutex_lock (&track->lock);
+    for (target = track->oldest; target != NULL && n < max;
+         target = target->newer)
+        out[n++] = *target;
+    pthread_mutex_unlock (&track->lock);
+
+    return n;
+}
+
+
+
+
+/*
+* aisimport
+*
+* Adds targets saved by aisexport.
+*
+* Parameters:
+*     track : aistrack_t *        : The tracker.
+*     in    : const aistarget_t * : The targets, least recently heard
+*                                   first.
+*     n     : int                 : Number of targets.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     A target already known is overwritten.
+*
+*/
+void aisimport (aistrack_t * track, const aistarget_t * in, int n)
+{
+    aistarget_t * target, links;
+    int i;
+
+    pthread_mutex_lock (&track->lock);
+    for (i = 0; i < n; i++) {
+        if (in[i].mmsi == 0)
+            continue;
+        target = findtarget (track, in[i].mmsi);
+        uncell (track, target);
+        links = *target;
+        *target = in[i];
+        target->cell = -1;
+        target->hashnext = links.hashnext;
+        target->newer = links.newer;
+        target->older = links.older;
+        target->lat = target->lon = AISNOPOSITION;
+        if (in[i].lat != AISNOPOSITION)
+            placetarget (track, target, in[i].lat, in[i].lon);
+        track->changes++;
+    }
+    pthread_mutex_unlock (&track->lock);
+
+    return;
+}
+
+
+
+
+/*
+* setaisarea
+*
+* Sets up an area of interest.
+*
+* Parameters:
+*     area : aisarea_t *    : Receives the area.
+*     kind : int            : AISAREA_NONE, AISAREA_BOX or AISAREA_RANGE.
+*     arg  : const double * : For a box its south, west, north and east
+*                             edges in degrees; for a range the latitude
+*                             and longitude of its centre in degrees and
+*                             the radius in nautical miles.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if the arguments
+*     are out of range.
+*
+* Remarks:
+*     A range is measured on a flat projection about its centre, which is
+*     accurate enough over the few tens of miles AIS reaches.
+*
+*/
+int setaisarea (aisarea_t * area, int kind, const double * arg)
+{
+    double reach;
+
+    memset (area, 0, sizeof (aisarea_t));
+    area->kind = kind;
+    if (kind == AISAREA_NONE)
+        return 0;
+
+    if (arg[0] < -90.0 || arg[0] > 90.0 || arg[1] < -180.0 || arg[1] > 180.0)
+        return -1;
+
+    if (kind == AISAREA_BOX) {
+        if (arg[2] < arg[0] || arg[2] > 90.0
+          || arg[3] < -180.0 || arg[3] > 180.0)
+            return -1;
+        area->south = (int) (arg[0] * AISDEGREE);
+        area->west = (int) (arg[1] * AISDEGREE);
+        area->north = (int) (arg[2] * AISDEGREE);
+        area->east = (int) (arg[3] * AISDEGREE);
+        return 0;
+    }
+
+    if (arg[2] <= 0.0 || arg[2] > 3000.0)
+        return -1;
+    area->lat = (int) (arg[0] * AISDEGREE);
+    area->lon = (int) (arg[1] * AISDEGREE);
+    area->range = arg[2] * AISMINUTE;
+    area->coslat = cos (arg[0] * M_PI / 180.0);
+
+    area->south = area->lat - (int) area->range;
+    area->north = area->lat + (int) area->range;
+    if (area->south < -90 * AISDEGREE)
+        area->south = -90 * AISDEGREE;
+    if (area->north > 90 * AISDEGREE)
+        area->north = 90 * AISDEGREE;
+
+    reach = (area->coslat > 0.0) ? area->range / area->coslat : 0.0;
+    if (area->coslat <= 0.0 || reach >= 180.0 * AISDEGREE) {
+        area->west = -180 * AISDEGREE;
+        area->east = 180 * AISDEGREE;
+    }
+    else {
+        area->west = area->lon - (int) reach;
+        area->east = area->lon + (int) reach;
+        if (area->west < -180 * AISDEGREE)
+            area->west += 360 * AISDEGREE;
+        if (area->east > 180 * AISDEGREE)
+            area->east -= 360 * AISDEGREE;
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+* inaisarea
+*
+* Determines whether a position lies in an area of interest.
+*
+* Parameters:
+*     area : const aisarea_t * : The area.
+*     lat  : int               : Latitude, 1/10000 minute, or
+*                                AISNOPOSITION.
+*     lon  : int               : Longitude, 1/10000 minute.
+*
+* Return Value:
+*     The function returns TRUE if the position is in the area, FALSE
+*     otherwise.
+*
+* Remarks:
+*     An unknown position is in no area but the whole world.
+*
+*/
+int inaisarea (const aisarea_t * area, int lat, int lon)
+{
+    double dlat, dlon;
+
+    if (area->kind == AISAREA_NONE)
+        return TRUE;
+    if (lat == AISNOPOSITION || lat < area->south || lat > area->north)
+        return FALSE;
+    if (area->west <= area->east) {
+        if (lon < area->west || lon > area->east)
+            return FALSE;
+    }
+    else if (lon < area->west && lon > area->east)
+        return FALSE;
+    if (area->kind == AISAREA_BOX)
+        return TRUE;
+
+    dlat = lat - area->lat;
+    dlon = lon - area->lon;
+    if (dlon > 180.0 * AISDEGREE)
+        dlon -= 360.0 * AISDEGREE;
+    else if (dlon < -180.0 * AISDEGREE)
+        dlon += 360.0 * AISDEGREE;
+    dlon *= area->coslat;
+
+    return (dlat * dlat + dlon * dlon <= area->range * area->range);
+}
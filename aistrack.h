@@ -0,0 +1,201 @@
+/*
+* aistrack.h
+*
+* NMEA Server Application
+*
+* Structures and function prototypes for the AIS target tracker, which
+* keeps the latest report of each vessel, with its position in a grid
+* index, so that clients can be sent only the targets in an area of their
+* choosing, and new clients a snapshot of the targets at once.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef AISTRACK_H
+#define AISTRACK_H
+
+#include <time.h>
+#include <pthread.h>
+#include "ais.h"
+
+
+/* Positions are kept in the units of the AIS position reports, 1/10000
+   minute of arc, north and east positive.  One unit of latitude is thus
+   1/10000 nautical mile. */
+#define AISMINUTE       10000
+#define AISDEGREE       (60 * AISMINUTE)
+#define AISNOPOSITION   (91 * AISDEGREE)    /* latitude of an unknown position */
+
+#ifdef NMEAD_SMALL
+#define AISTARGETS      1024      /* targets tracked at once (2^n) */
+#define AISCELLS        1024      /* grid buckets (2^n) */
+#else
+#define AISTARGETS      4096      /* targets tracked at once (2^n) */
+#define AISCELLS        4096      /* grid buckets (2^n) */
+#endif
+#define AISCELLSIZE     (6 * AISMINUTE)     /* grid cells 0.1 degree square */
+#define AISNAMELENGTH   20        /* characters in names and destinations */
+#define AISENCODEMAX    320       /* sentences describing one target */
+
+
+/* Kinds of station, by their position reports */
+#define AISCLASS_OTHER  0         /* base station, aid to navigation... */
+#define AISCLASS_A      1
+#define AISCLASS_B      2
+
+
+/* What has been heard from a target */
+#define AISHAVE_NAV     0x01      /* course and speed of a vessel */
+#define AISHAVE_STATIC  0x02      /* name, call sign, type, dimensions */
+#define AISHAVE_VOYAGE  0x04      /* destination, ETA, draught */
+
+
+/* Area kinds */
+#define AISAREA_NONE    0         /* every target */
+#define AISAREA_BOX     1         /* between two parallels and meridians */
+#define AISAREA_RANGE   2         /* within a distance of a point */
+
+
+/* An area of interest.  A box whose west edge lies east of its east edge
+   spans the 180th meridian.  A range also has the bounding box used to
+   find candidate cells. */
+typedef struct {
+    int kind;
+    int south, north;
+    int west, east;
+    int lat, lon;                  /* centre of a range */
+    double range;                  /* radius, 1/10000 nautical mile */
+    double coslat;                 /* cosine of the centre's latitude */
+} aisarea_t;
+
+
+/* A target.  Targets are chained in a hash bucket by MMSI, in a grid
+   bucket by position, and in a list from the most to the least recently
+   heard, whose tail is reused when the table is full.  Fields are kept in
+   the units and with the "not available" values of the messages. */
+typedef struct aistarget_struct {
+    unsigned int mmsi;             /* zero while the slot is free */
+    int lat, lon;                  /* AISNOPOSITION until reported */
+    int cell;                      /* grid cell, or -1 */
+    struct timespec heard;         /* last message, CLOCK_MONOTONIC */
+    int have;                      /* AISHAVE_ bits */
+    int station;                   /* AISCLASS_ of the position reports */
+    int status;                    /* navigational status (class A) */
+    int rot;                       /* rate of turn, as sent (class A) */
+    int sog;                       /* 0.1 knot */
+    int cog;                       /* 0.1 degree */
+    int heading;                   /* degree */
+    int accuracy;
+    int second;                    /* UTC second of the position */
+    unsigned int imo;
+    int shiptype;
+    int tobow, tostern, toport, tostarboard;   /* metres */
+    int epfd;                      /* type of position fixing device */
+    unsigned int eta;              /* month, day, hour, minute, as sent */
+    int draught;                   /* 0.1 metre */
+    char callsign[8];
+    char name[AISNAMELENGTH + 1];
+    char destination[AISNAMELENGTH + 1];
+    struct aistarget_struct * hashnext;
+    struct aistarget_struct * cellnext;
+    struct aistarget_struct * cellprev;
+    struct aistarget_struct * newer;
+    struct aistarget_struct * older;
+} aistarget_t;
+
+
+/* Called for each target found in an area */
+typedef void (* aisvisit_t) (void * ctx, const aistarget_t * target);
+
+
+/* The tracker is updated by the talker and queried by the workers, under
+   its lock.  The message in progress is that of the last first fragment,
+   so that the fragments following it can be attributed to its target;
+   their payloads are collected so the complete message can be decoded. */
+typedef struct {
+    pthread_mutex_t lock;
+    int ntargets;
+    aistarget_t * newest;
+    aistarget_t * oldest;
+    aistarget_t * freelist;
+    aistarget_t * hash[AISTARGETS];
+    aistarget_t * cell[AISCELLS];
+    aistarget_t target[AISTARGETS];
+    volatile unsigned long changes;  /* updates, for the state file */
+    char partialtalker[2];
+    char partialseqid;
+    char partialchannel;
+    int partialcount;
+    int partialnext;               /* fragment number expected next */
+    aistarget_t * partial;         /* target of the message, or NULL */
+    int partiallength;
+    char partialpayload[AISPAYLOADLENGTH];
+} aistrack_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+aistrack_t * newaistrack (void);
+void destroyaistrack (aistrack_t * track);
+int aistrack (aistrack_t * track, const char * msg, int length,
+              int * lat, int * lon);
+int aisquery (aistrack_t * track, const aisarea_t * area,
+              aisvisit_t visit, void * ctx);
+int aislookup (aistrack_t * track, unsigned int mmsi, aistarget_t * copy);
+int aisencode (const aistarget_t * target, char * out, int seqid);
+int aisexport (aistrack_t * track, aistarget_t * out, int max);
+void aisimport (aistrack_t * track, const aistarget_t * in, int n);
+int setaisarea (aisarea_t * area, int kind, const double * arg);
+int inaisarea (const aisarea_t * area, int lat, int lon);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* AISTRACK_H */
@@ -0,0 +1,356 @@
+/*
+* channel.c
+*
+* NMEA Server Application
+*
+* Channels.  One nmead may serve several receivers, each as a channel
+* with its own port, queues and talker thread but sharing the worker
+* threads.  The channels are described in a configuration file (option
+* -f) such as
+*
+*     # Position receiver
+*     channel gps
+*         input      /dev/ttyS0
+*         baud       4800
+*         port       10110
+*
+*     # AIS receiver, also for local readers
+*     channel ais
+*         input      /dev/ttyS1
+*         baud       38400
+*         port       10111
+*         local      /run/nmead-ais.sock
+*         queue      131072
+*         snapshot   yes
+*         history    8192
+*
+* Each channel line starts a channel; the lines after it, up to the next,
+* configure it.  Settings not given are those of the command line.  An
+* input of tcp:host:port or udp:address:port relays another nmead or a
+* datagram feed instead of reading a receiver (see relay.c).
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include "nmead.h"
+
+
+#define CONFIGLINESIZE  256
+
+
+extern int verbose;
+
+
+
+
+/*
+* newchannel
+*
+* Allocates a channel with the given settings.
+*
+* Parameters:
+*     defaults : const channel_t * : Settings to start from.
+*     name     : const char *      : Name of the channel.
+*
+* Return Value:
+*     The function returns a pointer to the new channel, or NULL if it
+*     cannot be allocated.
+*
+* Remarks:
+*     The talker and link fields are cleared.
+*
+*/
+channel_t * newchannel (const channel_t * defaults, const char * name)
+{
+    channel_t * ch = (channel_t *) malloc (sizeof (channel_t));
+
+    if (ch == NULL)
+        return NULL;
+
+    *ch = *defaults;
+    memset (&ch->talker, 0, sizeof (ch->talker));
+    ch->next = NULL;
+    strncpy (ch->name, name, CHANNELNAMESIZE - 1);
+    ch->name[CHANNELNAMESIZE - 1] = '\0';
+
+    return ch;
+}
+
+
+
+
+/*
+* setchannel
+*
+* Applies one setting from the configuration file to a channel.
+*
+* Parameters:
+*     ch    : channel_t *  : The channel.
+*     key   : const char * : Name of the setting.
+*     value : const char * : Its value.
+*
+* Return Value:
+*     The function returns zero, or -1 if the setting is not known or its
+*     value is not valid.
+*
+* Remarks:
+*
+*/
+static int setchannel (channel_t * ch, const char * key, const char * value)
+{
+    if (strcasecmp (key, "input") == 0)
+        ch->input = strdup (value);
+    else if (strcasecmp (key, "baud") == 0)
+        ch->baud = atol (value);
+    else if (strcasecmp (key, "port") == 0)
+        ch->port = atoi (value);
+    else if (strcasecmp (key, "highport") == 0)
+        ch->highport = atoi (value);
+    else if (strcasecmp (key, "http") == 0)
+        ch->httpport = atoi (value);
+    else if (strcasecmp (key, "local") == 0) {
+        ch->localtype = SOCK_STREAM;
+        if (strncmp (value, "seqpacket:", 10) == 0) {
+            ch->localtype = SOCK_SEQPACKET;
+            value += 10;
+        }
+        ch->localpath = strdup (value);
+    }
+    else if (strcasecmp (key, "shm") == 0)
+        ch->shmname = strdup (value);
+    else if (strcasecmp (key, "types") == 0) {
+        ch->types = parseframetypes (value);
+        if (ch->types <= 0)
+            return -1;
+    }
+    else if (strcasecmp (key, "connections") == 0) {
+        ch->maxconn = atoi (value);
+        if (ch->maxconn < 1)
+            return -1;
+    }
+    else if (strcasecmp (key, "queue") == 0)
+        ch->buffersize[PRIORITY_NORMAL] = atoi (value);
+    else if (strcasecmp (key, "highqueue") == 0)
+        ch->buffersize[PRIORITY_HIGH] = atoi (value);
+    else if (strcasecmp (key, "budget") == 0)
+        ch->budget = atol (value);
+    else if (strcasecmp (key, "history") == 0) {
+        ch->history = atoi (value);
+        if (ch->history < 1)
+            return -1;
+    }
+    else if (strcasecmp (key, "track") == 0) {
+        if (strcasecmp (value, "yes") == 0)
+            ch->track = TRUE;
+        else if (strcasecmp (value, "no") == 0)
+            ch->track = FALSE;
+        else
+            return -1;
+    }
+    else if (strcasecmp (key, "snapshot") == 0) {
+        if (strcasecmp (value, "yes") == 0)
+            ch->snapshot = TRUE;
+        else if (strcasecmp (value, "no") == 0)
+            ch->snapshot = FALSE;
+        else
+            return -1;
+    }
+    else
+        return -1;
+
+    return 0;
+}
+
+
+
+
+/*
+* sharedendpoint
+*
+* Finds an endpoint that two channels would both open.
+*
+* Parameters:
+*     a : const channel_t * : One channel.
+*     b : const channel_t * : The other.
+*
+* Return Value:
+*     The function returns the name of the setting in conflict, or NULL
+*     if there is none.
+*
+* Remarks:
+*     A second channel on the same port, socket path or shared-memory
+*     name would silently take it over, or with SO_REUSEPORT share its
+*     clients, so each must be the channel's own.
+*
+*/
+static const char * sharedendpoint (const channel_t * a, const channel_t * b)
+{
+    int pa[3], pb[3];
+    int i, j;
+
+    pa[0] = a->port;  pa[1] = a->highport;  pa[2] = a->httpport;
+    pb[0] = b->port;  pb[1] = b->highport;  pb[2] = b->httpport;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+            if (pa[i] > 0 && pa[i] == pb[j])
+                return "port";
+
+    if (a->localpath != NULL && b->localpath != NULL
+      && strcmp (a->localpath, b->localpath) == 0)
+        return "local";
+    if (a->shmname != NULL && b->shmname != NULL
+      && strcmp (a->shmname, b->shmname) == 0)
+        return "shm";
+    if (strcmp (a->input, b->input) == 0)
+        return "input";
+
+    return NULL;
+}
+
+
+
+
+/*
+* readchannels
+*
+* Reads the channels from a configuration file.
+*
+* Parameters:
+*     path     : const char *      : The file.
+*     defaults : const channel_t * : Settings of the command line.
+*
+* Return Value:
+*     The function returns the list of channels, or NULL if the file
+*     cannot be read, has an error, or describes no channel.
+*
+* Remarks:
+*     Errors are reported on stderr with their line numbers.  At most
+*     MAXCHANNELS channels may be given.  Settings taken from the command
+*     line count too, so no two channels may share a port, socket path,
+*     shared-memory ring or input.
+*
+*/
+channel_t * readchannels (const char * path, const channel_t * defaults)
+{
+    char line[CONFIGLINESIZE];
+    channel_t * first = NULL, * last = NULL, * ch;
+    const channel_t * other;
+    const char * shared;
+    char * key, * value, * save;
+    int lineno = 0, nchannels = 0;
+    FILE * fp;
+
+    fp = fopen (path, "r");
+    if (fp == NULL) {
+        perror (path);
+        return NULL;
+    }
+
+    while (fgets (line, sizeof (line), fp) != NULL) {
+        lineno++;
+        line[strcspn (line, "#\r\n")] = '\0';
+        key = strtok_r (line, " \t", &save);
+        if (key == NULL)
+            continue;
+        value = strtok_r (NULL, " \t", &save);
+
+        if (strcasecmp (key, "channel") == 0) {
+            if (value == NULL || nchannels == MAXCHANNELS) {
+                fprintf (stderr, "%s:%d: %s\n", path, lineno,
+                    value == NULL ? "channel needs a name"
+                                  : "too many channels");
+                goto fail;
+            }
+            ch = newchannel (defaults, value);
+            if (ch == NULL) {
+                perror ("newchannel");
+                goto fail;
+            }
+            if (last == NULL)
+                first = ch;
+            else
+                last->next = ch;
+            last = ch;
+            nchannels++;
+        }
+        else if (last == NULL || value == NULL
+                 || setchannel (last, key, value) != 0) {
+            fprintf (stderr, "%s:%d: bad setting %s\n", path, lineno, key);
+            goto fail;
+        }
+    }
+    fclose (fp);
+    fp = NULL;
+
+    for (ch = first; ch != NULL; ch = ch->next)
+        for (other = ch->next; other != NULL; other = other->next)
+            if ((shared = sharedendpoint (ch, other)) != NULL) {
+                fprintf (stderr, "%s: channels %s and %s share their %s\n",
+                    path, ch->name, other->name, shared);
+                goto fail;
+            }
+
+    if (first == NULL)
+        fprintf (stderr, "%s: no channels\n", path);
+    else if (verbose >= 10)
+        for (ch = first; ch != NULL; ch = ch->next)
+            printf ("Channel %s: %s at %ld baud, port %d\n", ch->name,
+                ch->input, ch->baud, ch->port);
+
+    return first;
+
+fail:
+    if (fp != NULL)
+        fclose (fp);
+    while (first != NULL) {
+        ch = first->next;
+        free (first);
+        first = ch;
+    }
+    return NULL;
+}
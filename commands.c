@@ -0,0 +1,423 @@
+/*
+* commands.c
+*
+* NMEA Server Application
+*
+* Commands sent by clients.  A client may write lines of text to its
+* connection to select what it receives; the server answers each command
+* with a proprietary $PNMEAD sentence queued ahead of any further data.
+* Clients that send nothing are served as before.  WebSocket clients send
+* their commands as text messages (see http.c).
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <time.h>
+#include "nmead.h"
+
+
+#define REPLYSIZE   256
+
+
+extern int verbose;
+
+
+
+
+/*
+* clientsend
+*
+* Queues a sentence for one client only.
+*
+* Parameters:
+*     conn   : connection_t * : The connection.
+*     msg    : const char *   : The sentence, with its line ending.
+*     length : int            : Length of the sentence, at most
+*                               REPLYSIZE + 8 bytes.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if the queue is
+*     full.
+*
+* Remarks:
+*     The sentence is framed for the connection's protocol.
+*
+*/
+int clientsend (connection_t * conn, const char * msg, int length)
+{
+    char encoded[REPLYSIZE + 8 + WSHEADERMAX + SSEHEADERMAX];
+    struct timespec now;
+
+    if (conn->protocol == PROTO_WEBSOCKET)
+        length = wsencode (encoded, FRAME_NMEA, msg, length);
+    else if (conn->protocol == PROTO_SSE)
+        length = sseencode (encoded, msg, length);
+    else
+        memcpy (encoded, msg, length);
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return putmsg (conn->msgbuffer, encoded, length, msgstamp (&now));
+}
+
+
+
+
+/*
+* clientreply
+*
+* Queues a $PNMEAD reply sentence for a client.
+*
+* Parameters:
+*     conn   : connection_t * : The connection.
+*     format : const char *   : printf-style format of the fields after
+*                               "PNMEAD,".
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The checksum and line ending are added here.  A reply that does not
+*     fit in the queue is lost, like any other sentence.
+*
+*/
+static void clientreply (connection_t * conn, const char * format, ...)
+{
+    char body[REPLYSIZE], reply[REPLYSIZE + 8];
+    unsigned char sum = 0;
+    va_list ap;
+    int i;
+
+    va_start (ap, format);
+    strcpy (body, "PNMEAD,");
+    vsnprintf (body + 7, sizeof (body) - 7, format, ap);
+    va_end (ap);
+
+    for (i = 0; body[i] != '\0'; i++)
+        sum ^= (unsigned char) body[i];
+    sprintf (reply, "$%s*%02X\r\n", body, sum);
+    clientsend (conn, reply, strlen (reply));
+
+    return;
+}
+
+
+
+
+/*
+* typesname
+*
+* Formats a mask of frame types as a list of names.
+*
+* Parameters:
+*     types : int    : The mask.
+*     buf   : char * : Receives the list; at least 32 bytes.
+*
+* Return Value:
+*     The function returns buf.
+*
+* Remarks:
+*
+*/
+static char * typesname (int types, char * buf)
+{
+    buf[0] = '\0';
+    if (types & FRAME_NMEA)
+        strcat (buf, ",nmea");
+    if (types & FRAME_UBX)
+        strcat (buf, ",ubx");
+    if (types & FRAME_RTCM3)
+        strcat (buf, ",rtcm3");
+    if (types & FRAME_POS)
+        strcat (buf, ",pos");
+
+    return (buf[0] != '\0') ? buf + 1 : buf;
+}
+
+
+
+
+/*
+* clientcommand
+*
+* Carries out one command line from a client.
+*
+* Parameters:
+*     conn : connection_t * : The connection.
+*     line : char *         : The command, without its line ending.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Commands are not case sensitive.  Lines that are not commands are
+*     ignored, since clients have always been free to write to the
+*     server.
+*
+*     TYPES list   selects the frame types received (nmea, ubx, rtcm3,
+*                  pos, all), replacing the server's default (option -T).
+*
+*     PRIORITY high|normal
+*                  moves the connection to a priority class, with that
+*                  class's queue cap.  Only connections accepted on the
+*                  high-priority port or the Unix domain socket may move
+*                  to the high class.
+*
+*     AREA south,west,north,east
+*                  sends only the AIS sentences about targets last known
+*                  to be in a box, given in decimal degrees; the reply
+*                  counts the targets in it now.
+*
+*     RANGE lat,lon,nm
+*                  does the same for targets within nm nautical miles.
+*
+*     AREA off, RANGE off
+*                  sends every AIS target again.
+*
+*     SNAPSHOT [south,west,north,east | lat,lon,nm]
+*                  describes the AIS targets known now, in the area given
+*                  or else the connection's own, ahead of the live feed;
+*                  the reply counts them.
+*
+*     SEQ on|off   puts a TAG block with the sentence's sequence number,
+*                  "\n:1234*hh\", in front of every NMEA sentence, and a
+*                  sentence "$PNMEAD,SEQ,1234*hh" after every binary
+*                  frame or position record; the reply gives the number
+*                  of the next one.
+*
+*     RESUME seq   does the same, and first sends again the sentences from
+*                  number seq on, as far as the server still holds them
+*                  (option -R).  A client coming back passes one more than
+*                  the last number it saw; the reply gives the number the
+*                  replay starts at, so that the client knows what it has
+*                  lost.  Sentences sent live between connecting and
+*                  RESUME are repeated.
+*
+*     SEQ and RESUME are not available to WebSocket clients.  AREA, RANGE
+*     and SNAPSHOT are refused unless the channel keeps its AIS targets
+*     (option -g).
+*
+*/
+void clientcommand (connection_t * conn, char * line)
+{
+    char * verb, * args, * save;
+    const char * name;
+    char names[32];
+    aisarea_t area;
+    stream_t * st = conn->cmgr->stream;
+    unsigned long seq, head;
+    double arg[4];
+    int types, priority, kind, n;
+
+    verb = strtok_r (line, " \t", &save);
+    if (verb == NULL)
+        return;
+    args = strtok_r (NULL, " \t", &save);
+
+    if (verbose >= 10)
+        printf ("Command from client %d: %s %s\n", conn->socketfd, verb,
+            args != NULL ? args : "");
+
+    if (strcasecmp (verb, "TYPES") == 0) {
+        types = (args != NULL) ? parseframetypes (args) : -1;
+        if (types <= 0) {
+            clientreply (conn, "ERROR,TYPES");
+            return;
+        }
+        conn->types = types;
+        clientreply (conn, "TYPES,%s", typesname (types, names));
+    }
+    else if (strcasecmp (verb, "PRIORITY") == 0) {
+        if (args != NULL && strcasecmp (args, "high") == 0
+          && conn->mayhigh)
+            priority = PRIORITY_HIGH;
+        else if (args != NULL && strcasecmp (args, "normal") == 0)
+            priority = PRIORITY_NORMAL;
+        else {
+            clientreply (conn, "ERROR,PRIORITY");
+            return;
+        }
+        if (priority != conn->priority) {
+            if (conn->msgbuffer->size > conn->cmgr->buffersize[priority]
+              && resizeconnection (conn, conn->cmgr->buffersize[priority])
+                   != 0) {
+                clientreply (conn, "ERROR,PRIORITY");
+                return;
+            }
+            conn->priority = priority;
+            conn->worker->reprioritize = TRUE;
+        }
+        clientreply (conn, "PRIORITY,%s",
+            priority == PRIORITY_HIGH ? "high" : "normal");
+    }
+    else if (strcasecmp (verb, "SNAPSHOT") == 0) {
+        area = conn->area;
+        n = (args != NULL) ? sscanf (args, "%lf,%lf,%lf,%lf", &arg[0],
+                                     &arg[1], &arg[2], &arg[3]) : 0;
+        if ((n == 3 && setaisarea (&area, AISAREA_RANGE, arg) != 0)
+          || (n == 4 && setaisarea (&area, AISAREA_BOX, arg) != 0)
+          || (args != NULL && n != 3 && n != 4)
+          || (n = startsnapshot (conn, &area)) < 0) {
+            clientreply (conn, "ERROR,SNAPSHOT");
+            return;
+        }
+        clientreply (conn, "SNAPSHOT,%d", n);
+    }
+    else if (strcasecmp (verb, "AREA") == 0
+           || strcasecmp (verb, "RANGE") == 0) {
+        kind = (strcasecmp (verb, "AREA") == 0) ? AISAREA_BOX
+                                                : AISAREA_RANGE;
+        name = (kind == AISAREA_BOX) ? "AREA" : "RANGE";
+        if (args != NULL && strcasecmp (args, "off") == 0)
+            kind = AISAREA_NONE;
+        else if (args == NULL
+          || sscanf (args, "%lf,%lf,%lf,%lf", &arg[0], &arg[1], &arg[2],
+                     &arg[3]) != (kind == AISAREA_BOX ? 4 : 3)) {
+            clientreply (conn, "ERROR,%s", name);
+            return;
+        }
+        if (conn->cmgr->track == NULL || setaisarea (&area, kind, arg) != 0) {
+            clientreply (conn, "ERROR,%s", name);
+            return;
+        }
+        conn->area = area;
+        if (kind == AISAREA_NONE)
+            clientreply (conn, "%s,off", name);
+        else {
+            n = aisquery (conn->cmgr->track, &area, NULL, NULL);
+            clientreply (conn, "%s,%d", name, n);
+        }
+    }
+    else if (strcasecmp (verb, "SEQ") == 0) {
+        if (conn->protocol != PROTO_RAW || args == NULL
+          || (strcasecmp (args, "on") != 0 && strcasecmp (args, "off") != 0)) {
+            clientreply (conn, "ERROR,SEQ");
+            return;
+        }
+        conn->tagged = (strcasecmp (args, "on") == 0);
+        if (conn->tagged)
+            clientreply (conn, "SEQ,on,%lu", streamhead (st));
+        else
+            clientreply (conn, "SEQ,off");
+    }
+    else if (strcasecmp (verb, "RESUME") == 0) {
+        if (conn->protocol != PROTO_RAW || args == NULL
+          || sscanf (args, "%lu", &seq) != 1) {
+            clientreply (conn, "ERROR,RESUME");
+            return;
+        }
+
+        /* Start at the oldest record still held; a number ahead of the
+           stream, as after a restart without a state file, replays
+           nothing */
+        head = streamhead (st);
+        if ((long) (seq - head) > 0)
+            seq = head;
+        else if (head - seq > st->nentries)
+            seq = head - st->nentries;
+        while (seq != head && !streamheld (st, seq))
+            seq++;
+
+        conn->tagged = TRUE;
+        conn->replaying = TRUE;
+        conn->replayseq = seq;
+        clientreply (conn, "RESUME,%lu", seq);
+        if (verbose >= 10)
+            printf ("Replaying %lu sentences to client %d\n", head - seq,
+                conn->socketfd);
+    }
+
+    return;
+}
+
+
+
+
+/*
+* clientinput
+*
+* Collects what a client has written into command lines.
+*
+* Parameters:
+*     conn   : connection_t * : The connection.
+*     data   : const char *   : The bytes read from the client.
+*     length : int            : Number of bytes.
+*
+* Return Value:
+*     The function returns zero, or -1 if the connection is to be closed.
+*
+* Remarks:
+*     Lines longer than CMDLINESIZE are discarded.  Connections from the
+*     HTTP port are handed to httpinput.  Called only from the worker
+*     thread owning the connection.
+*
+*/
+int clientinput (connection_t * conn, const char * data, int length)
+{
+    int i;
+
+    if (conn->protocol != PROTO_RAW)
+        return httpinput (conn, data, length);
+
+    for (i = 0; i < length; i++) {
+        if (data[i] == '\n') {
+            if (conn->cmdlength > 0 && conn->cmdlength < CMDLINESIZE) {
+                if (conn->cmd[conn->cmdlength - 1] == '\r')
+                    conn->cmdlength--;
+                conn->cmd[conn->cmdlength] = '\0';
+                clientcommand (conn, conn->cmd);
+            }
+            conn->cmdlength = 0;
+        }
+        else if (conn->cmdlength < CMDLINESIZE - 1)
+            conn->cmd[conn->cmdlength++] = data[i];
+        else
+            conn->cmdlength = CMDLINESIZE;      /* overlong: discard */
+    }
+
+    return 0;
+}
@@ -53,55 +53,77 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
 #include "nmead.h"
+#include "probes.h"
 
 
 extern int verbose;
 
 
+/* Layout of a pooled connection slot.  Slots are CACHELINESIZE-aligned
+   so that workers serving neighbouring connections do not share cache
+   lines.  The message ring storage follows the structure
+   within the slot. */
+typedef struct connslot_struct {
+    connection_t conn;
+    msgbuffer msgbuffer;
+    struct connslot_struct * nextfree;
+} connslot_t;
+
+
 /*
 * newconnection
 *
-* Creates and initializes a new connection_t object.
+* Takes a connection_t object from the connection manager's pool and
+* initializes it.
 *
 * Parameters:
-*     None.
+*     cmgr     : pointer to connectionmgr_t : The connection manager
+*                                             owning the pool.
+*     priority : int                        : PRIORITY_ class of the
+*                                             connection.
 *
 * Return Value:
 *     The function returns a pointer to a new connection_t object, or
-*     NULL if an error occurred.
+*     NULL if the pool is exhausted.
 *
 * Remarks:
+*     The queue starts at the pool's initial size whatever the class.
 *
 */
-connection_t * newconnection (void)
+connection_t * newconnection (connectionmgr_t * cmgr, int priority)
 {
-    key_t qkey;
-    connection_t * c
-        = (connection_t *) calloc (1, sizeof (connection_t));
-
-    if (c == NULL) return NULL;
+    connslot_t * slot;
 
-    /* Use the address of the newly-allocated memory block as the
-       key ID. */
-    qkey = ftok (".", (int) c);
+    sem_wait (&cmgr->sempool);
+    slot = (connslot_t *) cmgr->freelist;
+    if (slot != NULL)
+        cmgr->freelist = slot->nextfree;
+    sem_post (&cmgr->sempool);
 
-    c->msgbuffer = newmsgbuffer ();
-    if (c->msgbuffer == NULL) {
+    if (slot == NULL) {
         if (verbose >= 10)
-            printf ("Failed to create message buffer for id = 0x%08lx\n",
-                (unsigned long) c);
-        free (c);
+            printf ("newconnection: connection pool exhausted\n");
         return NULL;
     }
+
+    memset (&slot->conn, 0, sizeof (slot->conn));
+    slot->conn.msgbuffer = &slot->msgbuffer;
+    slot->conn.cmgr = cmgr;
+    slot->conn.socketfd = -1;
+    slot->conn.types = cmgr->types;
+    slot->conn.priority = priority;
+    initmsgbuffer (&slot->msgbuffer, (char *) (slot + 1), cmgr->initialsize);
+
     if (verbose >= 100)
         printf ("Created message buffer for id = 0x%08lx\n",
-            (unsigned long) c);
+            (unsigned long) &slot->conn);
 
-    return c;
+    return &slot->conn;
 }
 
 
@@ -110,7 +132,7 @@ connection_t * newconnection (void)
 /*
 * destroyconnection
 *
-* Destroys a connection object.
+* Returns a connection object to the pool it was taken from.
 *
 * Parameters:
 *     conn : pointer to connection_t : A pointer to a connection object.
@@ -121,9 +143,20 @@ connection_t * newconnection (void)
 */
 void destroyconnection (connection_t * conn)
 {
-    destroymsgbuffer (conn->msgbuffer);
+    connslot_t * slot = (connslot_t *) conn;
+    connectionmgr_t * cmgr = conn->cmgr;
+
+    if (conn->heapdata != NULL) {
+        __sync_fetch_and_sub (&cmgr->queuebytes, conn->msgbuffer->size);
+        free (conn->heapdata);
+    }
+    free (conn->snapshot);
+    cleanupmsgbuffer (conn->msgbuffer);
 
-    free (conn);
+    sem_wait (&cmgr->sempool);
+    slot->nextfree = (connslot_t *) cmgr->freelist;
+    cmgr->freelist = slot;
+    sem_post (&cmgr->sempool);
 
     return;
 }
@@ -137,23 +170,72 @@ void destroyconnection (connection_t * conn)
 * Creates and initializes a new connectionmgr_t object.
 *
 * Parameters:
-*     None.
+*     maxconn     : int         : Number of connections the pool is
+*                                 sized for.
+*     initialsize : int         : Bytes of message storage each
+*                                 connection starts with.
+*     buffersize  : const int * : Most bytes of message storage a
+*                                 connection may grow to, by priority
+*                                 class.
+*     history     : int         : Number of records the stream keeps.
 *
 * Return Value:
 *     The function returns a pointer to a connectionmgr_t object, or
 *     NULL if the function fails.
 *
 * Remarks:
+*     All connection slots are allocated here, up front, with initialsize
+*     bytes of queue each.  The budget for grown queues is unlimited
+*     until the caller sets cmgr->budget.  The stream has room for
+*     history records of STREAMRECORDSIZE bytes on average, and at least
+*     for two of the longest frames.
 *
 */
-connectionmgr_t * newconnectionmgr (void)
+connectionmgr_t * newconnectionmgr (int maxconn, int initialsize,
+                                    const int * buffersize, int history)
 {
+    connslot_t * slot;
+    unsigned long size;
+    int i;
     connectionmgr_t * c
         = (connectionmgr_t *) calloc (1, sizeof (connectionmgr_t));
 
     if (c == NULL) return NULL;
 
+    c->maxconn = maxconn;
+    c->initialsize = initialsize;
+    for (i = 0; i < NPRIORITIES; i++)
+        c->buffersize[i] = buffersize[i];
+    c->budget = LONG_MAX;
+    c->types = FRAME_NMEA;
+    c->poolstride = (sizeof (connslot_t) + initialsize + CACHELINESIZE - 1)
+                  & ~((size_t) CACHELINESIZE - 1);
+    if (posix_memalign ((void **) &c->pool, CACHELINESIZE,
+                        c->poolstride * maxconn) != 0) {
+        free (c);
+        return NULL;
+    }
+    memset (c->pool, 0, c->poolstride * maxconn);
+
+    /* Thread the free list so that the lowest slots are used first */
+    for (i = maxconn - 1; i >= 0; i--) {
+        slot = (connslot_t *) (c->pool + i * c->poolstride);
+        slot->nextfree = (connslot_t *) c->freelist;
+        c->freelist = slot;
+    }
+
+    size = (unsigned long) history * STREAMRECORDSIZE;
+    if (size < 2 * MSGLENGTHLIMIT)
+        size = 2 * MSGLENGTHLIMIT;
+    c->stream = newstream (size, history);
+    if (c->stream == NULL) {
+        free (c->pool);
+        free (c);
+        return NULL;
+    }
+
     sem_init (&c->semaccess, 0, 1);
+    sem_init (&c->sempool, 0, 1);
 
     return c;
 }
@@ -175,12 +257,16 @@ connectionmgr_t * newconnectionmgr (void)
 *
 * Remarks:
 *     The function does not destroy any connection objects.  This is
-*     the responsibility of the listener threads.
+*     the responsibility of the worker threads, which must have done
+*     so before the pool is released here.
 *
 */
 void destroyconnectionmgr (connectionmgr_t * cmgr)
 {
     sem_destroy (&cmgr->semaccess);
+    sem_destroy (&cmgr->sempool);
+    destroystream (cmgr->stream);
+    free (cmgr->pool);
 
     free (cmgr);
 
@@ -216,12 +302,13 @@ int addconnection (connectionmgr_t * cmgr, connection_t * conn)
 
     sem_wait (&cmgr->semaccess);
 
-    if (cmgr->nconn >= MAXCONNECTIONS)
+    if (cmgr->nconn >= cmgr->maxconn)
         result = TOO_MANY_CONNECTIONS;
     else {
         conn->next = cmgr->head;
         cmgr->head = conn;
         cmgr->nconn++;
+        PROBE3 (connect, conn->socketfd, conn->priority, cmgr->nconn);
     }
 
     sem_post (&cmgr->semaccess);
@@ -272,6 +359,7 @@ int removeconnection (connectionmgr_t * cmgr, connection_t * conn)
             else
                 c0->next = c->next;
             cmgr->nconn--;
+            PROBE3 (disconnect, conn->socketfd, conn->dropped, cmgr->nconn);
 
         }
     }
@@ -283,43 +371,218 @@ int removeconnection (connectionmgr_t * cmgr, connection_t * conn)
 
 
 
+/*
+* resizeconnection
+*
+* Changes the capacity of a connection's queue, keeping its contents.
+*
+* Parameters:
+*     conn : pointer to connection_t : The connection.
+*     size : int                     : New capacity in bytes.  A size no
+*                                      larger than the pool's initial
+*                                      size moves the queue back into the
+*                                      connection's slot.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 if the queued
+*     messages do not fit, the budget for grown queues would be exceeded,
+*     or memory cannot be allocated.
+*
+* Remarks:
+*     Called only from the worker thread owning the connection.
+*
+*/
+int resizeconnection (connection_t * conn, int size)
+{
+    connectionmgr_t * cmgr = conn->cmgr;
+    msgbuffer * buf = conn->msgbuffer;
+    char * olddata = conn->heapdata;
+    long oldbytes = (olddata != NULL) ? buf->size : 0;
+    long newbytes = (size > cmgr->initialsize) ? size : 0;
+    char * data;
+
+    if (newbytes == oldbytes)
+        return 0;
+
+    /* Reserve any increase against the budget before allocating */
+    if (newbytes > oldbytes
+      && __sync_add_and_fetch (&cmgr->queuebytes, newbytes - oldbytes)
+           > cmgr->budget) {
+        __sync_fetch_and_sub (&cmgr->queuebytes, newbytes - oldbytes);
+        return -1;
+    }
+
+    if (newbytes > 0)
+        data = (char *) malloc (newbytes);
+    else
+        data = (char *) ((connslot_t *) conn + 1);
+
+    if (data == NULL || movemsgbuffer (buf, data, (newbytes > 0)
+                                       ? size : cmgr->initialsize) != 0) {
+        if (newbytes > 0)
+            free (data);
+        if (newbytes > oldbytes)
+            __sync_fetch_and_sub (&cmgr->queuebytes, newbytes - oldbytes);
+        return -1;
+    }
+
+    conn->heapdata = (newbytes > 0) ? data : NULL;
+    free (olddata);
+    if (newbytes < oldbytes)
+        __sync_fetch_and_sub (&cmgr->queuebytes, oldbytes - newbytes);
+
+    if (verbose >= 100)
+        LOG ("Queue of connection 0x%08lx now %ld bytes\n",
+            conn, buf->size);
+
+    return 0;
+}
+
+
+
+
+/*
+* growconnection
+*
+* Enlarges a connection's queue so that a message of the given length
+* fits.
+*
+* Parameters:
+*     conn   : pointer to connection_t : The connection.
+*     length : int                     : Length of the message.
+*
+* Return Value:
+*     The function returns zero if the queue has been enlarged, or -1 if
+*     it is already at the cap for its class or cannot grow within the
+*     budget.
+*
+* Remarks:
+*     The queue is doubled as many times as needed.  Called only from the
+*     worker thread owning the connection.
+*
+*/
+int growconnection (connection_t * conn, int length)
+{
+    msgbuffer * buf = conn->msgbuffer;
+    int cap = conn->cmgr->buffersize[conn->priority];
+    int needed = buf->used + MSGHEADERLENGTH + length;
+    int size = buf->size;
+
+    if (size >= cap)
+        return -1;
+    while (size < needed && size < cap)
+        size *= 2;
+    if (size > cap)
+        size = cap;
+    if (size < needed)
+        return -1;
+
+    conn->lagged = conn->worker->now;
+
+    return resizeconnection (conn, size);
+}
+
+
+
+
 /*
 * writetoconnections
 *
-* Writes a string to the message queue for each connection in the
-* connectionmgr_t object.
+* Publishes a sentence to the shared stream, from which the worker
+* threads queue it for each connection.
 *
 * Parameters:
-*     cmgr : pointer to connectionmgr_t : A pointer to the connection manager.
-*     buf  : pointer to character       : The string to be disseminated.
+*     cmgr   : pointer to connectionmgr_t : A pointer to the connection
+*                                           manager.
+*     buf    : pointer to character       : The sentence to be disseminated.
+*     length : int                        : Length of the sentence.
+*     info   : pointer to streamentry_t   : Receive times of the sentence,
+*                                           or NULL.
 *
 * Return Value:
+*     The function returns zero.
 *
 * Remarks:
+*     The sentence is copied once regardless of the number of
+*     connections, and the call never waits for a worker.  It is also
+*     published to the shared-memory ring if there is one.
 *
 */
-int writetoconnections (connectionmgr_t * cmgr, const char * buf)
+int writetoconnections (connectionmgr_t * cmgr, const char * buf, int length,
+                        const streamentry_t * info)
 {
-    connection_t * c;
+    holdforconnections (cmgr, buf, length, info);
+    releasetoconnections (cmgr);
 
-    sem_wait (&cmgr->semaccess);
+    return 0;
+}
 
-    if (cmgr->nconn > 0) {
 
-        for (c = cmgr->head; c != NULL; c = c->next) {
-            if (putmsg (c->msgbuffer, buf) != 0) {
-                if (verbose >= 100)
-                    printf (
-                      "writetoconnections: dropped message to buffer %p\n",
-                       c->msgbuffer);
-            }
-        }
 
+
+/*
+* holdforconnections
+*
+* Publishes a sentence to the shared stream but holds it back from the
+* workers until releasetoconnections is called.
+*
+* Parameters:
+*     cmgr   : pointer to connectionmgr_t : A pointer to the connection
+*                                           manager.
+*     buf    : pointer to character       : The sentence to be disseminated.
+*     length : int                        : Length of the sentence.
+*     info   : pointer to streamentry_t   : Receive times of the sentence,
+*                                           or NULL.
+*
+* Return Value:
+*     The function returns zero.
+*
+* Remarks:
+*     Sentences held together reach each client in one write.  The
+*     shared-memory ring is not held back: its readers take sentences
+*     one at a time anyway.
+*
+*/
+int holdforconnections (connectionmgr_t * cmgr, const char * buf, int length,
+                        const streamentry_t * info)
+{
+    stream_t * st = cmgr->stream;
+    streamentry_t * e;
+
+    if (streampublish (st, buf, length, info) != 0)
+        return 0;
+
+    if (cmgr->shm != NULL) {
+        e = &st->entry[(st->headseq - 1) % st->nentries];
+        nmeashmpublish (cmgr->shm, buf, length, e->type,
+                        &e->receivedrt, &e->received);
     }
 
-    sem_post (&cmgr->semaccess);
     return 0;
 }
 
 
 
+
+/*
+* releasetoconnections
+*
+* Hands every sentence held so far to the workers.
+*
+* Parameters:
+*     cmgr : pointer to connectionmgr_t : A pointer to the connection
+*                                         manager.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void releasetoconnections (connectionmgr_t * cmgr)
+{
+    streamrelease (cmgr->stream);
+    wakeworkers (cmgr);
+
+    return;
+}
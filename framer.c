@@ -0,0 +1,711 @@
+/*
+* framer.c
+*
+* NMEA Server Application
+*
+* The framing stage.  GPS receivers commonly interleave NMEA sentences
+* with binary u-blox UBX messages and RTCM3 correction frames on one
+* port.  The framer recognizes each kind by its sync bytes and length
+* field, checks the binary ones against their checksums, and passes
+* every frame on without copying it, tagged with its type.  NMEA 4.10 TAG
+* blocks in front of a sentence are passed on with it, so the source and
+* time a receiver gives a sentence are kept.  A relay's framer instead
+* takes off the block carrying the upstream's sequence number, keeping the
+* number for the relay.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "nmead.h"
+#include "framer.h"
+
+
+#define UBXSYNC1     0xb5
+#define UBXSYNC2     0x62
+#define UBXHEADER    6            /* sync, class, id, length */
+#define UBXOVERHEAD  8            /* header and checksum */
+
+#define RTCM3SYNC    0xd3
+#define RTCM3HEADER  3            /* sync, reserved bits, length */
+#define RTCM3OVERHEAD 6           /* header and CRC-24Q */
+
+#define CRC24QPOLY   0x1864cfb
+
+#define TAGMAXLENGTH 80           /* longest TAG block recognized */
+
+
+extern int verbose;
+
+static unsigned long crc24qtable[256];
+
+
+
+
+/*
+* initcrc24q
+*
+* Fills the CRC-24Q lookup table.
+*
+* Parameters:
+*     None.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Called from newframer, before any thread can use the table.
+*
+*/
+static void initcrc24q (void)
+{
+    unsigned long crc;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        crc = (unsigned long) i << 16;
+        for (j = 0; j < 8; j++) {
+            crc <<= 1;
+            if (crc & 0x1000000)
+                crc ^= CRC24QPOLY;
+        }
+        crc24qtable[i] = crc & 0xffffff;
+    }
+
+    return;
+}
+
+
+
+
+/*
+* ubxvalid
+*
+* Checks the Fletcher checksum of a complete UBX message.
+*
+* Parameters:
+*     frame  : const unsigned char * : The message, from its sync bytes.
+*     length : int                   : Length of the message.
+*
+* Return Value:
+*     The function returns TRUE if the checksum matches.
+*
+* Remarks:
+*     The checksum covers the class, id, length and payload.
+*
+*/
+static int ubxvalid (const unsigned char * frame, int length)
+{
+    unsigned char a = 0, b = 0;
+    int i;
+
+    for (i = 2; i < length - 2; i++) {
+        a += frame[i];
+        b += a;
+    }
+
+    return a == frame[length - 2] && b == frame[length - 1];
+}
+
+
+
+
+/*
+* rtcm3valid
+*
+* Checks the CRC-24Q of a complete RTCM3 frame.
+*
+* Parameters:
+*     frame  : const unsigned char * : The frame, from its sync byte.
+*     length : int                   : Length of the frame.
+*
+* Return Value:
+*     The function returns TRUE if the CRC matches.
+*
+* Remarks:
+*     The CRC covers the header and payload.
+*
+*/
+static int rtcm3valid (const unsigned char * frame, int length)
+{
+    unsigned long crc = 0;
+    int i;
+
+    for (i = 0; i < length - 3; i++)
+        crc = ((crc << 8) & 0xffffff) ^ crc24qtable[(crc >> 16) ^ frame[i]];
+
+    return crc == (((unsigned long) frame[length - 3] << 16)
+                   | (frame[length - 2] << 8) | frame[length - 1]);
+}
+
+
+
+
+/*
+* nmealength
+*
+* Finds the end of an NMEA sentence.
+*
+* Parameters:
+*     frame     : const unsigned char * : The sentence, from its '$' or '!'.
+*     available : int                   : Number of bytes available.
+*     maxlength : int                   : Longest sentence accepted.
+*
+* Return Value:
+*     The function returns the length of the sentence including its
+*     newline, 0 if more bytes are needed, or -1 if this is not the start
+*     of an acceptable sentence.
+*
+* Remarks:
+*     A sentence ends at the first newline.  A byte that cannot occur in
+*     NMEA text also ends the search, so that a damaged line does not
+*     swallow a binary frame following it, and the address field must
+*     start with a letter or digit, so that stray '$' and '!' bytes in
+*     binary data are not mistaken for sentences.
+*
+*/
+static int nmealength (const unsigned char * frame, int available,
+                       int maxlength)
+{
+    int i;
+
+    if (available >= 2 && !(frame[1] >= 'A' && frame[1] <= 'Z')
+                       && !(frame[1] >= '0' && frame[1] <= '9'))
+        return -1;
+
+    for (i = 1; i < available && i < maxlength; i++) {
+        if (frame[i] == '\n')
+            return i + 1;
+        if (frame[i] >= 0x7f || (frame[i] < ' ' && frame[i] != '\r'
+                                                 && frame[i] != '\t'))
+            return -1;
+    }
+
+    return (available < maxlength) ? 0 : -1;
+}
+
+
+
+
+/*
+* hexdigit
+*
+* Returns the value of a hexadecimal digit.
+*
+* Parameters:
+*     c : unsigned char : The digit.
+*
+* Return Value:
+*     The function returns the value, or -1 if c is not a digit.
+*
+* Remarks:
+*
+*/
+static int hexdigit (unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+
+
+
+/*
+* taglength
+*
+* Finds the length of the TAG block starting at a backslash.
+*
+* Parameters:
+*     frame     : const unsigned char * : The candidate block.
+*     available : int                   : Number of bytes at frame.
+*     seq       : unsigned long *       : Receives the line count
+*                                         parameter (n:), if there is one.
+*     hasseq    : int *                 : Set to TRUE if there is one.
+*
+* Return Value:
+*     The function returns the length of the block, 0 if it may be
+*     incomplete, or -1 if the bytes are not a TAG block.
+*
+* Remarks:
+*     A block is "\param,param*hh\"; the checksum covers the parameters
+*     and must be right.
+*
+*/
+static int taglength (const unsigned char * frame, int available,
+                      unsigned long * seq, int * hasseq)
+{
+    unsigned char sum = 0;
+    int star = -1;
+    int i, j;
+
+    for (i = 1; i < available && i < TAGMAXLENGTH; i++) {
+        if (frame[i] == '\\')
+            break;
+        if (frame[i] < ' ' || frame[i] >= 0x7f)
+            return -1;
+        if (frame[i] == '*')
+            star = i;
+        else if (star < 0)
+            sum ^= frame[i];
+    }
+    if (i == available)
+        return (available < TAGMAXLENGTH) ? 0 : -1;
+    if (i == TAGMAXLENGTH || star < 0 || i - star != 3
+      || hexdigit (frame[star + 1]) < 0 || hexdigit (frame[star + 2]) < 0
+      || hexdigit (frame[star + 1]) * 16 + hexdigit (frame[star + 2]) != sum)
+        return -1;
+
+    *seq = 0;
+    *hasseq = FALSE;
+    for (j = 1; j < star; j++) {
+        if ((j == 1 || frame[j - 1] == ',') && frame[j] == 'n'
+          && frame[j + 1] == ':') {
+            *seq = 0;
+            for (j += 2; j < star && frame[j] >= '0' && frame[j] <= '9'; j++)
+                *seq = *seq * 10 + (frame[j] - '0');
+            *hasseq = TRUE;
+        }
+    }
+
+    return i + 1;
+}
+
+
+
+
+/*
+* taggedlength
+*
+* Finds the length of a sentence with the TAG blocks in front of it.
+*
+* Parameters:
+*     frame     : const unsigned char * : The first block.
+*     available : int                   : Number of bytes at frame.
+*     first     : int                   : Length of the first block.
+*     maxlength : int                   : Longest frame accepted.
+*
+* Return Value:
+*     The function returns the length of the blocks and the sentence, 0
+*     if they may be incomplete, or -1 if they are not a tagged sentence.
+*
+* Remarks:
+*     The sentence counts against maxlength together with its blocks, so
+*     that what is passed on fits wherever a sentence does.
+*
+*/
+static int taggedlength (const unsigned char * frame, int available,
+                         int first, int maxlength)
+{
+    unsigned long seq;
+    int hasseq, n, q = first;
+
+    while (q < available && frame[q] == '\\') {
+        n = taglength (frame + q, available - q, &seq, &hasseq);
+        if (n <= 0)
+            return n;
+        q += n;
+    }
+    if (q == available)
+        return (q < maxlength) ? 0 : -1;
+    if ((frame[q] != '$' && frame[q] != '!') || maxlength - q < 8)
+        return -1;
+
+    n = nmealength (frame + q, available - q, maxlength - q);
+
+    return (n > 0) ? q + n : n;
+}
+
+
+
+
+/*
+* skiptags
+*
+* Finds where a sentence starts behind its TAG blocks.
+*
+* Parameters:
+*     msg    : const char * : A sentence as the framer passed it on.
+*     length : int          : Length of the sentence.
+*
+* Return Value:
+*     The function returns the number of bytes taken by TAG blocks in
+*     front of the sentence; zero if there are none.
+*
+* Remarks:
+*     The blocks were checked by the framer, so only their delimiters
+*     are looked at.
+*
+*/
+int skiptags (const char * msg, int length)
+{
+    int i = 0, j;
+
+    while (i < length && msg[i] == '\\') {
+        for (j = i + 1; j < length && msg[j] != '\\'; j++)
+            ;
+        if (j == length)
+            break;
+        i = j + 1;
+    }
+
+    return i;
+}
+
+
+
+
+/*
+* newframer
+*
+* Allocates and initializes a framer.
+*
+* Parameters:
+*     maxnmea : int : Longest NMEA sentence passed on, including its
+*                     newline; at most FRAMEMAXLENGTH.
+*
+* Return Value:
+*     The function returns a pointer to a new framer_t object, or NULL if
+*     it cannot be allocated.
+*
+* Remarks:
+*
+*/
+framer_t * newframer (int maxnmea)
+{
+    framer_t * fr = (framer_t *) calloc (1, sizeof (framer_t));
+
+    if (fr == NULL) return NULL;
+
+    fr->size = FRAMEMAXLENGTH + FRAMEREADSIZE;
+    fr->buf = (char *) malloc (fr->size);
+    if (fr->buf == NULL) {
+        free (fr);
+        return NULL;
+    }
+    fr->maxnmea = maxnmea;
+
+    initcrc24q ();
+
+    return fr;
+}
+
+
+
+
+/*
+* destroyframer
+*
+* Destroys a framer.
+*
+* Parameters:
+*     fr : framer_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroyframer (framer_t * fr)
+{
+    free (fr->buf);
+    free (fr);
+
+    return;
+}
+
+
+
+
+/*
+* framerbuffer
+*
+* Returns the space into which the next read should be made.
+*
+* Parameters:
+*     fr    : framer_t * : The framer.
+*     avail : int *      : Receives the number of bytes available, which
+*                          is at least FRAMEREADSIZE.
+*
+* Return Value:
+*     The function returns a pointer to the space.
+*
+* Remarks:
+*
+*/
+char * framerbuffer (framer_t * fr, int * avail)
+{
+    *avail = fr->size - fr->held;
+
+    return fr->buf + fr->held;
+}
+
+
+
+
+/*
+* framerparse
+*
+* Passes on the frames completed by a read.
+*
+* Parameters:
+*     fr     : framer_t *            : The framer.
+*     length : int                   : Number of bytes read into the space
+*                                      returned by framerbuffer.
+*     rx     : const streamentry_t * : Receive times of the read.
+*     emit   : frameemit_t           : Receives each frame.
+*     ctx    : void *                : Passed to emit.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Bytes that do not start a recognizable frame are skipped, as are
+*     binary frames whose checksum fails and NMEA sentences longer than
+*     the limit; scanning resumes at the next byte, so a good frame
+*     following a damaged one is not lost.
+*
+*     A sentence is passed on with the TAG blocks in front of it, which
+*     count towards its length limit.  If fr->striptags is set, a block
+*     with a sequence number is taken off instead, and while emit runs,
+*     fr->tagged tells whether the frame came after one, and fr->tagseq
+*     gives the number.  Only the first such block before a frame is
+*     taken off; any others stay with the sentence.
+*
+*/
+void framerparse (framer_t * fr, int length, const streamentry_t * rx,
+                  frameemit_t emit, void * ctx)
+{
+    const unsigned char * b = (const unsigned char *) fr->buf;
+    int held = fr->held;
+    int end = held + length;
+    int p = 0;
+    int n, type, hasseq;
+    unsigned long seq = 0;
+    streamentry_t info;
+
+    while (p < end) {
+        switch (b[p]) {
+        case '\\':
+            n = taglength (b + p, end - p, &seq, &hasseq);
+            if (n > 0 && fr->striptags && hasseq && !fr->pendingtag) {
+                fr->pendingtag = TRUE;
+                fr->pendingseq = seq;
+                p += n;
+                continue;
+            }
+            if (n > 0)
+                n = taggedlength (b + p, end - p, n, fr->maxnmea);
+            if (n < 0 && verbose >= 10 && end - p >= fr->maxnmea)
+                LOG ("framer: dropped sentence longer than %ld bytes\n",
+                    fr->maxnmea);
+            type = FRAME_NMEA;
+            break;
+
+        case '$':
+        case '!':
+            n = nmealength (b + p, end - p, fr->maxnmea);
+            if (n < 0 && verbose >= 10 && end - p >= fr->maxnmea)
+                LOG ("framer: dropped sentence longer than %ld bytes\n",
+                    fr->maxnmea);
+            type = FRAME_NMEA;
+            break;
+
+        case UBXSYNC1:
+            n = 0;
+            if (end - p >= 2 && b[p + 1] != UBXSYNC2)
+                n = -1;
+            else if (end - p >= UBXHEADER) {
+                n = UBXOVERHEAD + (b[p + 4] | (b[p + 5] << 8));
+                if (n > FRAMEMAXLENGTH)
+                    n = -1;
+                else if (end - p < n)
+                    n = 0;
+                else if (!ubxvalid (b + p, n)) {
+                    fr->rejected++;
+                    n = -1;
+                }
+            }
+            type = FRAME_UBX;
+            break;
+
+        case RTCM3SYNC:
+            n = 0;
+            if (end - p >= 2 && (b[p + 1] & 0xfc) != 0)
+                n = -1;
+            else if (end - p >= RTCM3HEADER) {
+                n = RTCM3OVERHEAD + (((b[p + 1] & 0x03) << 8) | b[p + 2]);
+                if (end - p < n)
+                    n = 0;
+                else if (!rtcm3valid (b + p, n)) {
+                    fr->rejected++;
+                    n = -1;
+                }
+            }
+            type = FRAME_RTCM3;
+            break;
+
+        default:
+            p++;
+            continue;
+        }
+
+        if (n == 0)                     /* incomplete: wait for more */
+            break;
+        if (n < 0) {                    /* not a frame: resynchronize */
+            p++;
+            continue;
+        }
+
+        info = (p < held) ? fr->heldrx : *rx;
+        info.type = type;
+        fr->tagged = fr->pendingtag;
+        fr->tagseq = fr->pendingseq;
+        fr->pendingtag = FALSE;
+        emit (ctx, (const char *) b + p, n, &info);
+        p += n;
+    }
+
+    /* Keep the start of an incomplete frame for the next read */
+    if (p >= held)
+        fr->heldrx = *rx;
+    fr->held = end - p;
+    if (fr->held > 0 && p > 0)
+        memmove (fr->buf, fr->buf + p, fr->held);
+
+    return;
+}
+
+
+
+
+/*
+* framerreset
+*
+* Discards the bytes of an incomplete frame.
+*
+* Parameters:
+*     fr : framer_t * : The framer.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Called when the source reopens, so that the start of a frame from
+*     before is not joined to what follows.
+*
+*/
+void framerreset (framer_t * fr)
+{
+    fr->held = 0;
+    fr->pendingtag = FALSE;
+
+    return;
+}
+
+
+
+
+/*
+* parseframetypes
+*
+* Converts a list of frame type names to a mask.
+*
+* Parameters:
+*     list : const char * : Comma-separated names: nmea, ubx, rtcm3,
+*                           pos or all.
+*
+* Return Value:
+*     The function returns the mask of FRAME_ bits, or -1 if a name is not
+*     recognized.
+*
+* Remarks:
+*     Names are not case sensitive.  all means every kind of frame from
+*     the receiver; the position stream, being derived from it, must be
+*     named.
+*
+*/
+int parseframetypes (const char * list)
+{
+    static const struct {
+        const char * name;
+        int type;
+    } names[] = {
+        { "nmea",  FRAME_NMEA },
+        { "ubx",   FRAME_UBX },
+        { "rtcm3", FRAME_RTCM3 },
+        { "rtcm",  FRAME_RTCM3 },
+        { "pos",   FRAME_POS },
+        { "all",   FRAME_ALL }
+    };
+    const char * p = list;
+    int types = 0;
+    size_t n;
+    int i;
+
+    while (*p != '\0') {
+        n = strcspn (p, ",");
+        for (i = 0; i < (int) (sizeof (names) / sizeof (names[0])); i++) {
+            if (strlen (names[i].name) == n
+              && strncasecmp (p, names[i].name, n) == 0)
+                break;
+        }
+        if (i == (int) (sizeof (names) / sizeof (names[0])))
+            return -1;
+        types |= names[i].type;
+        p += n;
+        if (*p == ',')
+            p++;
+    }
+
+    return types;
+}
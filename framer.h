@@ -0,0 +1,119 @@
+/*
+* framer.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the framing stage, which splits
+* the byte stream from the receiver into NMEA sentences, u-blox UBX
+* messages and RTCM3 frames.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#include "stream.h"
+
+
+/* Frame types, as bits so that clients can select any combination */
+#define FRAME_NMEA        0x01
+#define FRAME_UBX         0x02
+#define FRAME_RTCM3       0x04
+#define FRAME_ALL         (FRAME_NMEA | FRAME_UBX | FRAME_RTCM3)
+#define FRAME_POS         0x08    /* position records made by the server */
+
+#define FRAMEMAXLENGTH    4096    /* longest binary frame passed on */
+#define FRAMEREADSIZE     1024    /* space always available for a read */
+
+
+/* Receives each frame, in place in the framer's buffer, together with the
+   receive times of its first byte (type is filled in). */
+typedef void (* frameemit_t) (void * ctx, const char * frame, int length,
+                              const streamentry_t * rx);
+
+
+/* The port is read straight into buf; frames complete in it are passed
+   on where they lie, and only the start of an incomplete frame is moved
+   to the front to await the next read.  held bytes from earlier reads
+   precede the new data, and heldrx gives the receive times of the first
+   of them. */
+typedef struct {
+    char * buf;
+    int size;
+    int held;
+    streamentry_t heldrx;
+    int maxnmea;                   /* longest NMEA sentence, with newline */
+    unsigned long rejected;        /* binary frames failing their check */
+    int striptags;                 /* take off TAG blocks with sequence
+                                      numbers, for a relay */
+    int tagged;                    /* the frame emitted had a sequence
+                                      number in a TAG block */
+    unsigned long tagseq;
+    int pendingtag;                /* a TAG block awaits its sentence */
+    unsigned long pendingseq;
+} framer_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+framer_t * newframer (int maxnmea);
+void destroyframer (framer_t * fr);
+char * framerbuffer (framer_t * fr, int * avail);
+void framerparse (framer_t * fr, int length, const streamentry_t * rx,
+                  frameemit_t emit, void * ctx);
+void framerreset (framer_t * fr);
+int skiptags (const char * msg, int length);
+int parseframetypes (const char * list);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* FRAMER_H */
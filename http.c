@@ -0,0 +1,607 @@
+/*
+* http.c
+*
+* NMEA Server Application
+*
+* The HTTP endpoint, for browser-based chart plotters that cannot open a
+* raw TCP socket.  A connection to the HTTP port sends an ordinary GET
+* request and is then upgraded to a WebSocket, over which each sentence
+* arrives as one text message (binary frames as binary messages), or
+* answered as a Server-Sent Events stream.  After the handshake the
+* connection is queued and written like any other; the worker encodes
+* each record once for all of its WebSocket clients and once for all of
+* its event-stream clients.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include "nmead.h"
+
+
+#define WSGUID      "258EAFA5-E914-47DA-95CA-C5AB0DC11B63"
+
+#define WS_TEXT     0x1
+#define WS_BINARY   0x2
+#define WS_CLOSE    0x8
+#define WS_PING     0x9
+
+/* Request headers the handshake looks for */
+#define HTTP_GET      0x01
+#define HTTP_UPGRADE  0x02
+#define HTTP_SSE      0x04
+
+
+extern int verbose;
+
+
+/* SHA-1 state, for the WebSocket accept key */
+typedef struct {
+    unsigned long h[5];
+    unsigned char block[64];
+    int used;
+    unsigned long bytes;
+} sha1_t;
+
+
+
+
+/*
+* sha1block
+*
+* Processes one 64-byte block.
+*
+* Parameters:
+*     s : sha1_t * : The state; s->block holds the block.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void sha1block (sha1_t * s)
+{
+    unsigned long w[80], a, b, c, d, e, f, k, t;
+    int i;
+
+#define ROL(x, n)  ((((x) << (n)) | ((x) >> (32 - (n)))) & 0xffffffffUL)
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((unsigned long) s->block[4 * i] << 24)
+             | ((unsigned long) s->block[4 * i + 1] << 16)
+             | ((unsigned long) s->block[4 * i + 2] << 8)
+             | s->block[4 * i + 3];
+    for (i = 16; i < 80; i++)
+        w[i] = ROL (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3]; e = s->h[4];
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999UL;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1UL;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdcUL;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6UL;
+        }
+        t = (ROL (a, 5) + (f & 0xffffffffUL) + e + k + w[i]) & 0xffffffffUL;
+        e = d;
+        d = c;
+        c = ROL (b, 30);
+        b = a;
+        a = t;
+    }
+    s->h[0] = (s->h[0] + a) & 0xffffffffUL;
+    s->h[1] = (s->h[1] + b) & 0xffffffffUL;
+    s->h[2] = (s->h[2] + c) & 0xffffffffUL;
+    s->h[3] = (s->h[3] + d) & 0xffffffffUL;
+    s->h[4] = (s->h[4] + e) & 0xffffffffUL;
+
+#undef ROL
+
+    return;
+}
+
+
+
+
+/*
+* sha1
+*
+* Computes the SHA-1 digest of a string.
+*
+* Parameters:
+*     data   : const char *    : The data.
+*     length : int             : Number of bytes.
+*     digest : unsigned char * : Receives the 20-byte digest.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void sha1 (const char * data, int length, unsigned char * digest)
+{
+    sha1_t s;
+    unsigned long long bits = (unsigned long long) length * 8;
+    int i;
+
+    s.h[0] = 0x67452301UL;
+    s.h[1] = 0xefcdab89UL;
+    s.h[2] = 0x98badcfeUL;
+    s.h[3] = 0x10325476UL;
+    s.h[4] = 0xc3d2e1f0UL;
+    s.used = 0;
+
+    for (i = 0; i < length; i++) {
+        s.block[s.used++] = (unsigned char) data[i];
+        if (s.used == 64) {
+            sha1block (&s);
+            s.used = 0;
+        }
+    }
+
+    s.block[s.used++] = 0x80;
+    if (s.used > 56) {
+        while (s.used < 64)
+            s.block[s.used++] = 0;
+        sha1block (&s);
+        s.used = 0;
+    }
+    while (s.used < 56)
+        s.block[s.used++] = 0;
+    for (i = 7; i >= 0; i--)
+        s.block[s.used++] = (unsigned char) (bits >> (8 * i));
+    sha1block (&s);
+
+    for (i = 0; i < 20; i++)
+        digest[i] = (unsigned char) (s.h[i / 4] >> (24 - 8 * (i % 4)));
+
+    return;
+}
+
+
+
+
+/*
+* base64
+*
+* Encodes bytes in base64.
+*
+* Parameters:
+*     data   : const unsigned char * : The bytes.
+*     length : int                   : Number of bytes.
+*     out    : char *                : Receives the zero-terminated text.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void base64 (const unsigned char * data, int length, char * out)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned long v;
+    int i;
+
+    for (i = 0; i < length; i += 3) {
+        v = (unsigned long) data[i] << 16;
+        if (i + 1 < length)
+            v |= data[i + 1] << 8;
+        if (i + 2 < length)
+            v |= data[i + 2];
+        *out++ = digits[(v >> 18) & 0x3f];
+        *out++ = digits[(v >> 12) & 0x3f];
+        *out++ = (i + 1 < length) ? digits[(v >> 6) & 0x3f] : '=';
+        *out++ = (i + 2 < length) ? digits[v & 0x3f] : '=';
+    }
+    *out = '\0';
+
+    return;
+}
+
+
+
+
+/*
+* wsencode
+*
+* Builds a WebSocket message carrying one record.
+*
+* Parameters:
+*     out    : char *       : Receives the message; at least
+*                             length + WSHEADERMAX bytes.
+*     type   : int          : FRAME_ type of the record.
+*     msg    : const char * : The record.
+*     length : int          : Length of the record.
+*
+* Return Value:
+*     The function returns the length of the message.
+*
+* Remarks:
+*     NMEA sentences become text messages and binary frames binary
+*     messages.  Server messages are not masked.
+*
+*/
+int wsencode (char * out, int type, const char * msg, int length)
+{
+    int n = 0;
+
+    out[n++] = (char) (0x80 | ((type == FRAME_NMEA) ? WS_TEXT : WS_BINARY));
+    if (length < 126)
+        out[n++] = (char) length;
+    else {
+        out[n++] = 126;
+        out[n++] = (char) (length >> 8);
+        out[n++] = (char) (length & 0xff);
+    }
+    memcpy (out + n, msg, length);
+
+    return n + length;
+}
+
+
+
+
+/*
+* sseencode
+*
+* Builds a Server-Sent Events message carrying one sentence.
+*
+* Parameters:
+*     out    : char *       : Receives the message; at least
+*                             length + SSEHEADERMAX bytes.
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*
+* Return Value:
+*     The function returns the length of the message.
+*
+* Remarks:
+*     The sentence's line ending is replaced by the event terminator.
+*
+*/
+int sseencode (char * out, const char * msg, int length)
+{
+    while (length > 0 && (msg[length - 1] == '\n' || msg[length - 1] == '\r'))
+        length--;
+
+    memcpy (out, "data: ", 6);
+    memcpy (out + 6, msg, length);
+    memcpy (out + 6 + length, "\n\n", 2);
+
+    return length + 8;
+}
+
+
+
+
+/*
+* httpreject
+*
+* Answers a request that is neither a WebSocket upgrade nor an event
+* stream.
+*
+* Parameters:
+*     conn : connection_t * : The connection, which the caller closes.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Written directly: the socket is fresh and the answer short.
+*
+*/
+static void httpreject (connection_t * conn)
+{
+    static const char answer[] =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Type: text/plain\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "nmead: connect with a WebSocket, or GET /events for an event stream\r\n";
+
+    write (conn->socketfd, answer, sizeof (answer) - 1);
+
+    return;
+}
+
+
+
+
+/*
+* httpheader
+*
+* Handles one line of an HTTP request.
+*
+* Parameters:
+*     conn : connection_t * : The connection.
+*     line : char *         : The line, without its line ending.
+*
+* Return Value:
+*     The function returns zero, or -1 if the connection is to be closed.
+*
+* Remarks:
+*     Only the request line and the headers the handshake needs are
+*     looked at.  The blank line ending the request completes the
+*     handshake.
+*
+*/
+static int httpheader (connection_t * conn, char * line)
+{
+    char response[256];
+    char key[64 + sizeof (WSGUID)];
+    unsigned char digest[20];
+    char accept[32];
+    struct timespec now;
+    char * value, * query;
+    int types;
+
+    if (strncmp (line, "GET ", 4) == 0) {
+        conn->httpflags |= HTTP_GET;
+        query = strchr (line + 4, ' ');
+        if (query != NULL)
+            *query = '\0';
+        if (strncmp (line + 4, "/events", 7) == 0)
+            conn->httpflags |= HTTP_SSE;
+        query = strstr (line + 4, "types=");
+        if (query != NULL) {
+            query[6 + strcspn (query + 6, "&")] = '\0';
+            types = parseframetypes (query + 6);
+            if (types > 0)
+                conn->types = types;
+        }
+        return 0;
+    }
+
+    if (line[0] != '\0') {
+        value = strchr (line, ':');
+        if (value == NULL)
+            return 0;
+        *value++ = '\0';
+        value += strspn (value, " \t");
+
+        if (strcasecmp (line, "Upgrade") == 0
+          && strcasecmp (value, "websocket") == 0)
+            conn->httpflags |= HTTP_UPGRADE;
+        else if (strcasecmp (line, "Accept") == 0
+          && strstr (value, "text/event-stream") != NULL)
+            conn->httpflags |= HTTP_SSE;
+        else if (strcasecmp (line, "Sec-WebSocket-Key") == 0
+          && strlen (value) < sizeof (conn->wskey))
+            strcpy (conn->wskey, value);
+        return 0;
+    }
+
+    /* End of the request */
+    if (!(conn->httpflags & HTTP_GET)) {
+        httpreject (conn);
+        return -1;
+    }
+
+    if ((conn->httpflags & HTTP_UPGRADE) && conn->wskey[0] != '\0') {
+        sprintf (key, "%s%s", conn->wskey, WSGUID);
+        sha1 (key, strlen (key), digest);
+        base64 (digest, sizeof (digest), accept);
+        sprintf (response,
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: %s\r\n"
+            "\r\n", accept);
+        conn->protocol = PROTO_WEBSOCKET;
+    }
+    else if (conn->httpflags & HTTP_SSE) {
+        sprintf (response,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "\r\n");
+        conn->types &= FRAME_NMEA;    /* events carry text only */
+        conn->protocol = PROTO_SSE;
+    }
+    else {
+        httpreject (conn);
+        return -1;
+    }
+
+    if (verbose >= 10)
+        printf ("HTTP client %d upgraded to %s\n", conn->socketfd,
+            conn->protocol == PROTO_SSE ? "event stream" : "WebSocket");
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    putmsg (conn->msgbuffer, response, strlen (response), msgstamp (&now));
+
+    return 0;
+}
+
+
+
+
+/*
+* wsinput
+*
+* Handles the messages a WebSocket client sends.
+*
+* Parameters:
+*     conn : connection_t * : The connection; conn->cmd holds the bytes
+*                             received but not yet handled.
+*
+* Return Value:
+*     The function returns zero, or -1 if the connection is to be closed.
+*
+* Remarks:
+*     Text messages are taken as commands.  Client messages must be
+*     short, since they are only ever commands and control frames.
+*
+*/
+static int wsinput (connection_t * conn)
+{
+    unsigned char * b = (unsigned char *) conn->cmd;
+    char pong[CMDLINESIZE + WSHEADERMAX];
+    char line[CMDLINESIZE];
+    struct timespec now;
+    int header, length, i;
+
+    while (conn->cmdlength >= 2) {
+        if (!(b[1] & 0x80))
+            return -1;                  /* clients must mask */
+        length = b[1] & 0x7f;
+        header = 6;
+        if (length == 126) {
+            if (conn->cmdlength < 4)
+                break;
+            length = (b[2] << 8) | b[3];
+            header = 8;
+        }
+        else if (length == 127)
+            return -1;
+        if (header + length > CMDLINESIZE)
+            return -1;
+        if (conn->cmdlength < header + length)
+            break;
+
+        for (i = 0; i < length; i++)
+            line[i] = b[header + i] ^ b[header - 4 + (i & 3)];
+
+        switch (b[0] & 0x0f) {
+        case WS_TEXT:
+            while (length > 0 && (line[length - 1] == '\n'
+                               || line[length - 1] == '\r'))
+                length--;
+            line[length] = '\0';
+            clientcommand (conn, line);
+            break;
+
+        case WS_CLOSE:
+            return -1;
+
+        case WS_PING:
+            pong[0] = (char) 0x8a;
+            pong[1] = (char) length;
+            memcpy (pong + 2, line, length);
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            putmsg (conn->msgbuffer, pong, length + 2, msgstamp (&now));
+            break;
+        }
+
+        conn->cmdlength -= header + length;
+        memmove (conn->cmd, conn->cmd + header + length, conn->cmdlength);
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+* httpinput
+*
+* Handles what an HTTP client has written: the request, and then any
+* WebSocket messages.
+*
+* Parameters:
+*     conn   : connection_t * : The connection.
+*     data   : const char *   : The bytes read from the client.
+*     length : int            : Number of bytes.
+*
+* Return Value:
+*     The function returns zero, or -1 if the connection is to be closed.
+*
+* Remarks:
+*     Called only from the worker thread owning the connection.
+*
+*/
+int httpinput (connection_t * conn, const char * data, int length)
+{
+    int i, n;
+
+    for (i = 0; i < length && conn->protocol == PROTO_HTTP; i++) {
+        if (data[i] == '\n') {
+            if (conn->cmdlength < CMDLINESIZE) {
+                if (conn->cmdlength > 0
+                  && conn->cmd[conn->cmdlength - 1] == '\r')
+                    conn->cmdlength--;
+                conn->cmd[conn->cmdlength] = '\0';
+                if (httpheader (conn, conn->cmd) != 0)
+                    return -1;
+            }
+            conn->cmdlength = 0;
+        }
+        else if (conn->cmdlength < CMDLINESIZE - 1)
+            conn->cmd[conn->cmdlength++] = data[i];
+        else
+            conn->cmdlength = CMDLINESIZE;      /* overlong: ignore */
+    }
+
+    if (conn->protocol == PROTO_WEBSOCKET && i < length) {
+        while (i < length) {
+            n = CMDLINESIZE - conn->cmdlength;
+            if (n > length - i)
+                n = length - i;
+            memcpy (conn->cmd + conn->cmdlength, data + i, n);
+            conn->cmdlength += n;
+            i += n;
+            if (wsinput (conn) != 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
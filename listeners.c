@@ -59,245 +59,486 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "nmead.h"
 
 
+/* Pending connections the kernel may queue on a listening socket */
+#define LISTENBACKLOG   16
+
+
 /* Local structure definitions */
 union sock {
     struct sockaddr s;
     struct sockaddr_in i;
+    struct sockaddr_un u;
 };
 
 
+/* A socket multilisten accepts on, and what its connections get */
 typedef struct {
-    connection_t * conn;
+    int fd;
     connectionmgr_t * cmgr;
-    int socketfd;
-} listenerinfo_t;
+    int priority;
+    int protocol;
+} listener_t;
 
 
 extern int verbose;
-extern int port;
+extern int nworkers;
+extern int workercpus[];
+extern int nworkercpus;
+extern int reuseport;
+extern int localmode;
 
 
-/* Forward reference */
-void * listenproc (void * arg);
-
 
 
 /*
-* multilisten
+* openlistener
 *
-* Await and accept connections from listener applications.
+* Creates a TCP socket listening on the given port.
 *
 * Parameters:
-*     cmgr : pointer to connectionmgr_t : A pointer to the connection manager
-*                                         object shared between the talker
-*                                         and listener threads.
+*     port      : int : The TCP port.
+*     reuseport : int : TRUE to set SO_REUSEPORT, so that several sockets
+*                       (one per worker) can listen on the same port.
 *
 * Return Value:
-*     The function does not return a value.
+*     The function returns the socket, or -1 in the event of an error.
 *
 * Remarks:
 *
 */
-void multilisten (connectionmgr_t * cmgr)
+int openlistener (int port, int reuseport)
 {
-    union sock sock, work, peer;
-    int wsd, sd;
-    socklen_t addlen, peerlen;
-    listenerinfo_t * listenerinfo;
-    pthread_t * listener;
-    pthread_attr_t attr;
-    int threadresult;
+    union sock sock;
     int so_reuse = 1;
-
-    time_t now;
-
-    char buff[BUFSIZ];
-
-    int rv;
-
-    signal (SIGPIPE, SIG_IGN);    /* Watch return codes for pipe signal */
-
-    rv = pthread_attr_init(&attr);
-    if (rv != 0) {
-        perror ("attr_init");
-        exit (1);
-    }
-
-    rv = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    if (rv != 0) {
-        perror ("attr_set");
-        exit (1);
-    }
+    int sd;
 
     sd = socket (AF_INET,SOCK_STREAM,0);
     if (sd == -1) {
         perror ("socket");
-        exit (1);
+        return -1;
     }
     bzero ((char *) &sock, sizeof (sock));
     sock.i.sin_family = AF_INET;
     sock.i.sin_port = htons (port);
     sock.i.sin_addr.s_addr = htonl (INADDR_ANY);
     setsockopt(sd,SOL_SOCKET,SO_REUSEADDR,(char*)&so_reuse,sizeof(so_reuse));
-    rv = bind (sd, &(sock.s), sizeof (struct sockaddr));
-    if (rv == -1) {
+    if (reuseport) {
+#ifdef SO_REUSEPORT
+        if (setsockopt (sd, SOL_SOCKET, SO_REUSEPORT, (char *) &so_reuse,
+                        sizeof (so_reuse)) != 0) {
+            perror ("setsockopt SO_REUSEPORT");
+            close (sd);
+            return -1;
+        }
+#else
+        fprintf (stderr, "SO_REUSEPORT is not supported\n");
+        close (sd);
+        return -1;
+#endif
+    }
+    if (bind (sd, &(sock.s), sizeof (struct sockaddr)) == -1) {
         perror ("bind");
-        exit (1);
+        close (sd);
+        return -1;
     }
-    rv = listen (sd,2);
-    if (rv == -1) {
+    if (listen (sd, LISTENBACKLOG) == -1) {
         perror ("listen");
-        exit (1);
+        close (sd);
+        return -1;
     }
 
-    do {          
-       addlen=sizeof(work.s);
-       memset(&work.s,0,addlen);
-       wsd = accept (sd, &(work.s), &addlen);
-       if (wsd == -1 ) {
-          perror("accept");
-          exit(1);
-        }
-        peerlen = sizeof (struct sockaddr);
-        getpeername (wsd, &(peer.s), &peerlen);
-        time (&now);
-        if (verbose >= 10)
-            printf ("Connection from %s at %s",
-                 inet_ntoa (peer.i.sin_addr),
-                 ctime (&now));
-
-        /* Note that the listener thread proc will delete this memory
-           unless an error occurs before the thread is started */
-        listenerinfo = (listenerinfo_t *) calloc (1, sizeof (listenerinfo_t));
-        listenerinfo->conn = newconnection ();
-        if (addconnection (cmgr, listenerinfo->conn) != 0) {
-            destroyconnection (listenerinfo->conn);
-            free (listenerinfo);
-            sprintf (buff, "*** Too many connections\r\n");
-            write (wsd, buff, strlen (buff));
-            close (wsd);
-            break;
+    return sd;
+}
+
+
+
+
+/*
+* openlocallistener
+*
+* Creates a Unix domain socket listening at the given path.
+*
+* Parameters:
+*     path : const char * : Filesystem path of the socket.
+*     type : int          : SOCK_STREAM, or SOCK_SEQPACKET to send each
+*                           sentence as one record.
+*     mode : int          : Permissions of the socket file, or -1 to leave
+*                           them to the umask.
+*
+* Return Value:
+*     The function returns the socket, or -1 in the event of an error.
+*
+* Remarks:
+*     A socket left at the path by an earlier run is removed; any other
+*     kind of file there is an error.
+*
+*/
+int openlocallistener (const char * path, int type, int mode)
+{
+    union sock sock;
+    struct stat st;
+    int sd;
+
+    if (strlen (path) >= sizeof (sock.u.sun_path)) {
+        fprintf (stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    if (lstat (path, &st) == 0) {
+        if (!S_ISSOCK (st.st_mode)) {
+            fprintf (stderr, "%s exists and is not a socket\n", path);
+            return -1;
         }
-        listenerinfo->cmgr = cmgr;
-        listenerinfo->socketfd = wsd;
+        unlink (path);
+    }
 
-        listener = (pthread_t *) malloc (sizeof (pthread_t));
-        threadresult = pthread_create (listener, &attr, listenproc, (void *) listenerinfo);
+    sd = socket (AF_UNIX, type, 0);
+    if (sd == -1) {
+        perror ("socket");
+        return -1;
+    }
+    memset (&sock, 0, sizeof (sock));
+    sock.u.sun_family = AF_UNIX;
+    strcpy (sock.u.sun_path, path);
+    if (bind (sd, &(sock.s), sizeof (struct sockaddr_un)) == -1) {
+        perror ("bind");
+        close (sd);
+        return -1;
+    }
+    if (mode != -1 && chmod (path, (mode_t) mode) == -1) {
+        perror ("chmod");
+        close (sd);
+        unlink (path);
+        return -1;
+    }
+    if (listen (sd, LISTENBACKLOG) == -1) {
+        perror ("listen");
+        close (sd);
+        unlink (path);
+        return -1;
+    }
 
-    } while (1);
+    return sd;
 }
 
 
 
 
 /*
-* listenproc_cleanup
+* admitconnection
 *
-* Cleanup handler for the listener process.
+* Creates the connection structure for a newly accepted socket.
 *
 * Parameters:
-*     arg : pointer : A pointer to a listenerinfo_t structure containing
-*                     information required by the thread.
+*     cmgr     : pointer to connectionmgr_t : The connection manager.
+*     wsd      : int                        : The accepted socket.
+*     priority : int                        : PRIORITY_ class of the
+*                                             connection.
 *
 * Return Value:
-*     The function returns NULL.
+*     The function returns the new connection, or NULL if it was refused;
+*     the socket is closed in that case.
 *
 * Remarks:
-*     This routine was originally intended to work with the pthread_cleanup_push
-*     and pthread_cleanup_pop mechanism, but support for this mechanism isn't
-*     widely supported in the environments in which this code was tested.
-*     Therefore this routine is called explicitly by listenproc.
+*     The caller assigns the connection to a worker.  TCP and Unix
+*     domain sockets are both accepted.
 *
 */
-static void * listenproc_cleanup (void * arg)
+connection_t * admitconnection (connectionmgr_t * cmgr, int wsd,
+                                int priority)
 {
-    listenerinfo_t * myli = (listenerinfo_t *) arg;
-
+    union sock peer;
+    socklen_t peerlen;
+    connection_t * conn;
+    time_t now;
+    char buff[BUFSZ];
+    int type = SOCK_STREAM;
+    socklen_t typelen = sizeof (type);
+
+    memset (&peer, 0, sizeof (peer));
+    peerlen = sizeof (peer);
+    getpeername (wsd, &(peer.s), &peerlen);
+    getsockopt (wsd, SOL_SOCKET, SO_TYPE, (char *) &type, &typelen);
+    time (&now);
     if (verbose >= 10)
-        printf ("listenproc_cleanup: shutting down connection\n");
+        printf ("%sConnection from %s at %s",
+             priority == PRIORITY_HIGH ? "High-priority " : "",
+             peer.s.sa_family == AF_UNIX ? "local socket"
+                                         : inet_ntoa (peer.i.sin_addr),
+             ctime (&now));
+
+    conn = newconnection (cmgr, priority);
+    if (conn == NULL || addconnection (cmgr, conn) != 0) {
+        if (conn != NULL)
+            destroyconnection (conn);
+        sprintf (buff, "*** Too many connections\r\n");
+        write (wsd, buff, strlen (buff));
+        close (wsd);
+        return NULL;
+    }
 
-    removeconnection (myli->cmgr, myli->conn);
-    destroyconnection (myli->conn);
-    close (myli->socketfd);
-    free (myli);
+    conn->socketfd = wsd;
+    conn->local = (peer.s.sa_family == AF_UNIX);
+    conn->packet = (type == SOCK_SEQPACKET);
+    conn->mayhigh = (priority == PRIORITY_HIGH || conn->local);
+    fcntl (wsd, F_SETFL, O_NONBLOCK);
 
-    return NULL;
+    return conn;
 }
 
 
 
 
 /*
-* listenproc
+* addlistener
 *
-* Handles a connection with a listener application.
+* Adds a listening socket to multilisten's poll set.
 *
 * Parameters:
-*     arg : pointer : A pointer to a listenerinfo_t structure containing
-*                     information required by the thread.
+*     l        : listener_t *      : The entry to fill in.
+*     fd       : int               : The socket, or -1 if it could not be
+*                                    opened.
+*     cmgr     : connectionmgr_t * : The channel it belongs to.
+*     priority : int               : PRIORITY_ class of its connections.
+*     protocol : int               : PROTO_ its connections start in.
 *
 * Return Value:
-*     The function returns NULL.
+*     The function does not return a value.
 *
 * Remarks:
+*     Exits if the socket could not be opened.
 *
 */
-void * listenproc (void * arg)
+static void addlistener (listener_t * l, int fd, connectionmgr_t * cmgr,
+                         int priority, int protocol)
 {
-    char buff[MSGELEMENTLENGTH];
-    listenerinfo_t * li = (listenerinfo_t *) arg;
-    listenerinfo_t * myli
-        = (listenerinfo_t *) calloc (1, sizeof (listenerinfo_t));
-    int byteswritten;
-    int result;
+    if (fd == -1)
+        exit (1);
+
+    fcntl (fd, F_SETFL, O_NONBLOCK);
+    l->fd = fd;
+    l->cmgr = cmgr;
+    l->priority = priority;
+    l->protocol = protocol;
 
-    if ((li == NULL) || (myli == NULL)) return NULL;
+    return;
+}
 
-    myli->conn = li->conn;
-    myli->cmgr = li->cmgr;
-    myli->socketfd = li->socketfd;
 
-    /* Destroy the object passed from the parent thread */
-    free (li);
 
-    /* Read and send data as long as the connection is open */
-    do {
-        if (verbose >= 100)
-            printf ("listenproc: reading from buffer %p\n",
-                myli->conn->msgbuffer);
-
-        result = getmsg (myli->conn->msgbuffer, buff, MSGELEMENTLENGTH);
-        if (result != 0) {
-            if (verbose >= 100)
-                printf ("listenproc: nonzero result for buffer %p\n",
-                    myli->conn->msgbuffer);
-            usleep (10);
-            continue;
+
+/*
+* takeconnection
+*
+* Admits an accepted connection and hands it to a worker.
+*
+* Parameters:
+*     l   : listener_t * : The socket it was accepted on.
+*     wsd : int          : The accepted socket.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     admitconnection closes the socket if the channel is full.
+*
+*/
+static void takeconnection (listener_t * l, int wsd)
+{
+    connection_t * conn;
+
+    conn = admitconnection (l->cmgr, wsd, l->priority);
+    if (conn != NULL) {
+        conn->protocol = l->protocol;
+        assignconnection (l->cmgr, conn);
+    }
+
+    return;
+}
+
+
+
+
+/*
+* uringlisten
+*
+* Accepts connections through io_uring, with a multishot accept armed on
+* every listening socket.
+*
+* Parameters:
+*     listener   : listener_t * : The sockets.
+*     nlisteners : int          : The number of sockets.
+*
+* Return Value:
+*     The function returns only if io_uring cannot be used, leaving the
+*     sockets to poll.
+*
+* Remarks:
+*     The sockets are made blocking while they are armed, so that the
+*     kernel waits for connections instead of failing with EAGAIN; a
+*     kernel without multishot accept fails the first request with
+*     EINVAL, and a build without it cannot arm them at all; either way
+*     they are made non-blocking again and left to poll.
+*
+*/
+static void uringlisten (listener_t * listener, int nlisteners)
+{
+    uring_t * u;
+    unsigned long tag;
+    int i, res, more;
+
+    u = newuring (2 * nlisteners);
+    if (u == NULL)
+        return;
+
+    for (i = 0; i < nlisteners; i++) {
+        fcntl (listener[i].fd, F_SETFL, 0);
+        if (uringaccept (u, listener[i].fd, (unsigned long) i) != 0)
+            goto fallback;
+    }
+
+    while (uringsubmit (u, 1) == 0) {
+        while (uringreap (u, &tag, &res, &more)) {
+            if (res >= 0)
+                takeconnection (&listener[tag], res);
+            else if (res == -EINVAL)
+                goto fallback;
+            else if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED) {
+                errno = -res;
+                perror ("accept");
+                exit (1);
+            }
+
+            if (!more && uringaccept (u, listener[tag].fd, tag) != 0)
+                goto fallback;
         }
-        byteswritten = write (myli->socketfd, buff, strlen (buff));
-        if (byteswritten < 0) {
-            /* The connection is closed.  Remove the connection
-               object and drop this socket. */
-            if (verbose >= 100)
-                printf ("listenproc: connection closed\n");
-            break;
+    }
+    perror ("io_uring_enter");
+
+fallback:
+    if (verbose >= 10)
+        printf ("accepting with poll\n");
+    destroyuring (u);
+    for (i = 0; i < nlisteners; i++)
+        fcntl (listener[i].fd, F_SETFL, O_NONBLOCK);
+
+    return;
+}
+
+
+
+
+/*
+* multilisten
+*
+* Await and accept connections from listener applications.
+*
+* Parameters:
+*     channels : pointer to channel_t : The channels, whose connection
+*                                       managers are set up and linked.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Starts the worker threads and hands each accepted connection to one
+*     of them.  This thread accepts, for every channel, on the TCP port
+*     (unless it is 0, or the workers accept for themselves with
+*     SO_REUSEPORT, which only the first channel may use), on the
+*     high-priority TCP port, on the HTTP port and on the Unix domain
+*     socket if these are configured.  Connections from the HTTP port
+*     receive nothing until their request has been answered.  Where
+*     io_uring is built in and the kernel has multishot accept, the
+*     sockets are accepted on through a ring; otherwise with poll.
+*
+*/
+void multilisten (channel_t * channels)
+{
+    listener_t listener[4 * MAXCHANNELS];
+    struct pollfd pfd[4 * MAXCHANNELS];
+    channel_t * ch;
+    connectionmgr_t * cmgr;
+    int npfd = 0;
+    int wsd, i;
+
+    signal (SIGPIPE, SIG_IGN);    /* Watch return codes for pipe signal */
+
+    if (startworkers (channels->talker.cmgr, nworkers, workercpus,
+                      nworkercpus, reuseport ? channels->port : 0) != 0) {
+        fprintf (stderr, "Cannot start worker threads\n");
+        exit (1);
+    }
+
+    for (ch = channels; ch != NULL; ch = ch->next) {
+        cmgr = ch->talker.cmgr;
+        if (ch->port > 0 && !(reuseport && ch == channels))
+            addlistener (&listener[npfd++], openlistener (ch->port, FALSE),
+                         cmgr, PRIORITY_NORMAL, PROTO_RAW);
+        if (ch->highport > 0)
+            addlistener (&listener[npfd++],
+                         openlistener (ch->highport, FALSE),
+                         cmgr, PRIORITY_HIGH, PROTO_RAW);
+        if (ch->httpport > 0)
+            addlistener (&listener[npfd++],
+                         openlistener (ch->httpport, FALSE),
+                         cmgr, PRIORITY_NORMAL, PROTO_HTTP);
+        if (ch->localpath != NULL)
+            addlistener (&listener[npfd++],
+                         openlocallistener (ch->localpath, ch->localtype,
+                                            localmode),
+                         cmgr, PRIORITY_NORMAL, PROTO_RAW);
+    }
+
+    if (npfd == 0) {
+        while (1)
+            pause ();
+    }
+
+    uringlisten (listener, npfd);
+
+    for (i = 0; i < npfd; i++) {
+        pfd[i].fd = listener[i].fd;
+        pfd[i].events = POLLIN;
+    }
+
+    do {
+        if (poll (pfd, npfd, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("poll");
+            exit (1);
         }
 
-    } while (1);
+        for (i = 0; i < npfd; i++) {
+            if (pfd[i].revents == 0)
+                continue;
 
-    listenproc_cleanup ((void *) myli);
+            wsd = accept (pfd[i].fd, NULL, NULL);
+            if (wsd == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+                  || errno == ECONNABORTED)
+                    continue;
+                perror ("accept");
+                exit (1);
+            }
 
-    return NULL;
-}
+            takeconnection (&listener[i], wsd);
+        }
 
+    } while (1);
+}
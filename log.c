@@ -0,0 +1,396 @@
+/*
+* log.c
+*
+* NMEA Server Application
+*
+* The asynchronous log.  printf from the talker and the workers took the
+* stdio lock and often made a system call, with a queue semaphore held
+* at that; at high verbosity it set the pace of distribution.  Instead
+* each thread now copies a record of the format and its arguments into a
+* ring of its own, which costs a clock read and a few stores and never
+* waits.  A formatter thread drains the rings every LOGINTERVAL msec,
+* oldest record first, and writes the text out.  A thread whose ring is
+* full loses records rather than wait; the loss is reported.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include "nmead.h"
+#include "log.h"
+
+
+#define barrier()   __sync_synchronize ()
+
+
+static logring_t * rings[LOGMAXTHREADS];
+static volatile int nrings = 0;
+static volatile int started = 0;
+static FILE * logout = NULL;
+static __thread logring_t * myring = NULL;
+
+
+
+
+/*
+* threadring
+*
+* Returns the calling thread's ring, creating it on first use.
+*
+* Parameters:
+*     None.
+*
+* Return Value:
+*     The function returns the ring, or NULL if there can be no more.
+*
+* Remarks:
+*
+*/
+static logring_t * threadring (void)
+{
+    logring_t * ring;
+    int i;
+
+    if (myring != NULL)
+        return myring;
+
+    ring = (logring_t *) calloc (1, sizeof (logring_t));
+    if (ring == NULL)
+        return NULL;
+
+    i = __sync_fetch_and_add (&nrings, 1);
+    if (i >= LOGMAXTHREADS) {
+        free (ring);
+        return NULL;
+    }
+    barrier ();
+    rings[i] = ring;
+    myring = ring;
+
+    return ring;
+}
+
+
+
+
+/*
+* newrecord
+*
+* Claims the next free record of the calling thread's ring.
+*
+* Parameters:
+*     ring : logring_t ** : Receives the ring.
+*
+* Return Value:
+*     The function returns the record, or NULL if the ring is full.
+*
+* Remarks:
+*
+*/
+static logrecord_t * newrecord (logring_t ** ring)
+{
+    logring_t * r = threadring ();
+
+    *ring = r;
+    if (r == NULL)
+        return NULL;
+    if (r->head - r->tail >= LOGRINGSIZE) {
+        r->dropped++;
+        return NULL;
+    }
+
+    return &r->record[r->head & (LOGRINGSIZE - 1)];
+}
+
+
+
+
+/*
+* lograw
+*
+* Logs a message with up to four long arguments.
+*
+* Parameters:
+*     fmt     : const char * : printf format, a string constant.
+*     a .. d  : long         : Arguments; those fmt does not use are
+*                              ignored.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Before startlogger is called the message is printed at once.
+*
+*/
+void lograw (const char * fmt, long a, long b, long c, long d)
+{
+    logring_t * ring;
+    logrecord_t * rec;
+
+    if (!started) {
+        printf (fmt, a, b, c, d);
+        return;
+    }
+
+    rec = newrecord (&ring);
+    if (rec == NULL)
+        return;
+
+    clock_gettime (CLOCK_MONOTONIC, &rec->when);
+    rec->fmt = fmt;
+    rec->arg[0] = a;
+    rec->arg[1] = b;
+    rec->arg[2] = c;
+    rec->arg[3] = d;
+    rec->textlength = -1;
+
+    barrier ();
+    ring->head++;
+
+    return;
+}
+
+
+
+
+/*
+* logtext
+*
+* Logs a message that includes some text, such as a sentence.
+*
+* Parameters:
+*     fmt    : const char * : printf format, a string constant, whose
+*                             first conversion is %.*s.
+*     text   : const char * : The text, not necessarily zero-terminated.
+*     length : int          : Length of the text.
+*     a, b   : long         : Further arguments.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     At most LOGTEXTSIZE bytes of text are kept.
+*
+*/
+void logtext (const char * fmt, const char * text, int length,
+              long a, long b)
+{
+    logring_t * ring;
+    logrecord_t * rec;
+
+    if (!started) {
+        printf (fmt, length, text, a, b);
+        return;
+    }
+
+    rec = newrecord (&ring);
+    if (rec == NULL)
+        return;
+
+    if (length > LOGTEXTSIZE)
+        length = LOGTEXTSIZE;
+    clock_gettime (CLOCK_MONOTONIC, &rec->when);
+    rec->fmt = fmt;
+    memcpy (rec->text, text, length);
+    rec->textlength = length;
+    rec->arg[0] = a;
+    rec->arg[1] = b;
+
+    barrier ();
+    ring->head++;
+
+    return;
+}
+
+
+
+
+/*
+* earlier
+*
+* Compares the times of two records.
+*
+* Parameters:
+*     x, y : const logrecord_t * : The records.
+*
+* Return Value:
+*     The function returns nonzero if x was made before y.
+*
+* Remarks:
+*
+*/
+static int earlier (const logrecord_t * x, const logrecord_t * y)
+{
+    if (x->when.tv_sec != y->when.tv_sec)
+        return x->when.tv_sec < y->when.tv_sec;
+
+    return x->when.tv_nsec < y->when.tv_nsec;
+}
+
+
+
+
+/*
+* formatter
+*
+* Thread procedure writing out the records of all rings.
+*
+* Parameters:
+*     arg : void * : Not used.
+*
+* Return Value:
+*     The function does not return.
+*
+* Remarks:
+*     Each pass writes the records present at its start, merging the
+*     rings by time, so that messages from different threads appear in
+*     the order they were made.  The thread takes no signals: SIGUSR1 in
+*     particular belongs to the statistics reporter.
+*
+*/
+static void * formatter (void * arg)
+{
+    unsigned long head[LOGMAXTHREADS], reported[LOGMAXTHREADS];
+    logrecord_t * rec, * oldest;
+    logring_t * ring;
+    sigset_t sigs;
+    int n, i, pick;
+
+    sigfillset (&sigs);
+    pthread_sigmask (SIG_BLOCK, &sigs, NULL);
+    memset (reported, 0, sizeof (reported));
+
+    while (1) {
+        usleep (LOGINTERVAL * 1000);
+
+        n = nrings;
+        if (n > LOGMAXTHREADS)
+            n = LOGMAXTHREADS;
+        for (i = 0; i < n; i++)
+            head[i] = (rings[i] != NULL) ? rings[i]->head : 0;
+        barrier ();
+
+        do {
+            oldest = NULL;
+            pick = -1;
+            for (i = 0; i < n; i++) {
+                ring = rings[i];
+                if (ring == NULL || ring->tail == head[i])
+                    continue;
+                rec = &ring->record[ring->tail & (LOGRINGSIZE - 1)];
+                if (oldest == NULL || earlier (rec, oldest)) {
+                    oldest = rec;
+                    pick = i;
+                }
+            }
+            if (oldest == NULL)
+                break;
+
+            if (oldest->textlength >= 0)
+                fprintf (logout, oldest->fmt, oldest->textlength,
+                    oldest->text, oldest->arg[0], oldest->arg[1]);
+            else
+                fprintf (logout, oldest->fmt, oldest->arg[0],
+                    oldest->arg[1], oldest->arg[2], oldest->arg[3]);
+
+            barrier ();
+            rings[pick]->tail++;
+        } while (1);
+
+        for (i = 0; i < n; i++) {
+            if (rings[i] != NULL && rings[i]->dropped != reported[i]) {
+                fprintf (logout, "log: %lu records lost\n",
+                    rings[i]->dropped - reported[i]);
+                reported[i] = rings[i]->dropped;
+            }
+        }
+
+        fflush (logout);
+    }
+
+    return arg;
+}
+
+
+
+
+/*
+* startlogger
+*
+* Starts the thread writing out the log.
+*
+* Parameters:
+*     out : FILE * : Where the log goes.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 if the thread cannot
+*     be started; messages are then printed directly.
+*
+* Remarks:
+*
+*/
+int startlogger (FILE * out)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    int result;
+
+    logout = out;
+    initthreadattr (&attr);
+    result = pthread_create (&thread, &attr, formatter, NULL);
+    pthread_attr_destroy (&attr);
+    if (result != 0)
+        return -1;
+    pthread_detach (thread);
+
+    barrier ();
+    started = 1;
+
+    return 0;
+}
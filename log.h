@@ -0,0 +1,118 @@
+/*
+* log.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the asynchronous log.  Threads on
+* the distribution path record debug output as fixed-size binary records
+* in rings of their own, without locks or system calls; a background
+* thread formats and writes them.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <time.h>
+
+
+#ifdef NMEAD_SMALL
+#define LOGRINGSIZE     64        /* records per thread, a power of two */
+#else
+#define LOGRINGSIZE     256       /* records per thread, a power of two */
+#endif
+#define LOGMAXTHREADS   64
+#define LOGTEXTSIZE     96        /* text copied into a record */
+#define LOGARGS         4
+#define LOGINTERVAL     10        /* msec between formatter passes */
+
+
+/* One log record.  fmt must be a string constant, and its conversions
+   take long arguments (%ld, %lu, %lx); a record made by logtext passes
+   its copy of the text to fmt's first conversion, a %s or %.*s with the
+   length preceding it. */
+typedef struct {
+    struct timespec when;
+    const char * fmt;
+    long arg[LOGARGS];
+    int textlength;                /* -1 without text */
+    char text[LOGTEXTSIZE];
+} logrecord_t;
+
+
+/* Written by one thread and read by the formatter.  head and tail count
+   records and are masked to index the ring. */
+typedef struct {
+    volatile unsigned long head;
+    volatile unsigned long tail;
+    volatile unsigned long dropped;   /* records lost to a full ring */
+    logrecord_t record[LOGRINGSIZE];
+} logring_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+int startlogger (FILE * out);
+void lograw (const char * fmt, long a, long b, long c, long d);
+void logtext (const char * fmt, const char * text, int length,
+              long a, long b);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+/* LOG (fmt, up to four arguments) */
+#define LOG(...)        LOGPAD (__VA_ARGS__, 0L, 0L, 0L, 0L, 0L)
+#define LOGPAD(fmt, a, b, c, d, ...) \
+    lograw (fmt, (long) (a), (long) (b), (long) (c), (long) (d))
+
+
+#endif  /* LOG_H */
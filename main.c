@@ -70,20 +70,62 @@
 #include <errno.h>
 #include <sys/termios.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <getopt.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
 #include "nmead.h"
+#include "state.h"
 
 
 int verbose = 0;
 int port = 1155;
 long ttybaud = 4800;
 char * ttyport = "/dev/gps";
+int ttyvmin = 1;
+int ttyvtime = 2;
+int ttylowlatency = FALSE;
+int zerocopy = FALSE;
+int maxconnections = MAXCONNECTIONS;
+int msgbuffersize = MSGBUFFERSIZE;
+int highbuffersize = MSGBUFFERSIZE;
+long queuebudget = MSGBUFFERBUDGET;
+int highport = 0;
+int httpport = 0;
+int msgmaxlength = MSGMAXLENGTH;
+int aiswindow = 0;
+int epochgap = 0;
+int epochhold = EPOCHHOLD;
+int poskeyinterval = 0;
+int aisreassemble = FALSE;
+int aissnapshot = FALSE;
+int aistracking = FALSE;
+int history = STREAMENTRIES;
+int nworkers = 0;
+int workercpus[MAXCPUS];
+int nworkercpus = 0;
+int reuseport = FALSE;
+int talkerpriority = 0;
+int talkercpu = -1;
+int lockmem = FALSE;
+int statsinterval = 0;
+int stateinterval = STATEINTERVAL;
+char * localpath = NULL;
+int localtype = SOCK_STREAM;
+int localmode = -1;
+char * shmname = NULL;
+int frametypes = FRAME_NMEA;
 
 
 /* Forward references */
-int openserial (u_char * tty, int blocksz, long ttybaud);
+static void openchannel (channel_t * ch, int index);
+static void starttalker (channel_t * ch);
+int openserial (u_char * tty, int vmin, int vtime, long ttybaud);
+void setlowlatency (int fd);
 void usage (void);
 void * terminate (int);
 
@@ -109,27 +151,170 @@ void * terminate (int);
 */
 int main (int argc, char ** argv)
 {
-    pthread_t    * talker;
-    talkerinfo_t   talkerinfo;
-    u_char       * ttyin = ttyport,
-                   buf[BUFSZ];
+    pthread_t      reporter, keeper;
+    pthread_attr_t attr;
+    sigset_t       sigs;
+    channel_t      defaults;
+    channel_t    * channels, * ch, * prev = NULL;
+    u_char       * ttyin = ttyport;
     char         * logfilepath = NULL;
-    int            c,
-                   gpsfd = -1;
-    int            threadresult;
-    int            talkerretval;
+    char         * configpath = NULL;
+    char         * statepath = NULL;
+    char         * p;
+    state_t      * state = NULL;
+    int            c, i;
 
 
-    while ((c = getopt (argc, argv, "hi:b:v:p:")) != EOF) {
+    while ((c = getopt (argc, argv, "ghi:aAb:B:c:C:d:e:E:f:H:kK:lLm:M:P:q:Q:rR:s:S:t:T:u:U:v:p:w:W:x:z")) != EOF) {
         switch (c) {
         case 'i':		/* gps serial ttyin */
             ttyin = optarg;
             break;
 
+        case 'a':		/* reassemble AIS messages */
+            aisreassemble = TRUE;
+            break;
+
+        case 'A':		/* AIS snapshot for new listeners */
+            aissnapshot = TRUE;
+            break;
+
         case 'b':		/* serial ttyin speed */
             ttybaud = atol (optarg);
             break;
 
+        case 'B':		/* budget for grown queues */
+            queuebudget = atol (optarg);
+            break;
+
+        case 'c':		/* connection pool size */
+            maxconnections = atoi (optarg);
+            if (maxconnections < 1)
+                usage ();
+            break;
+
+        case 'C':		/* talker CPU */
+            talkercpu = atoi (optarg);
+            break;
+
+        case 'd':		/* AIS duplicate window */
+            aiswindow = atoi (optarg);
+            break;
+
+        case 'e':		/* epoch bundling, idle gap */
+            epochgap = atoi (optarg);
+            break;
+
+        case 'E':		/* epoch bundling, longest hold */
+            epochhold = atoi (optarg);
+            break;
+
+        case 'f':		/* channels configuration file */
+            configpath = optarg;
+            break;
+
+        case 'g':		/* keep AIS targets */
+            aistracking = TRUE;
+            break;
+
+        case 'H':		/* high-priority listener port */
+            highport = atoi (optarg);
+            break;
+
+        case 'k':		/* pin worker threads, one per CPU */
+            nworkercpus = (int) sysconf (_SC_NPROCESSORS_ONLN);
+            if (nworkercpus > MAXCPUS)
+                nworkercpus = MAXCPUS;
+            for (c = 0; c < nworkercpus; c++)
+                workercpus[c] = c;
+            break;
+
+        case 'K':		/* pin worker threads to listed CPUs */
+            nworkercpus = parsecpulist (optarg, workercpus, MAXCPUS);
+            if (nworkercpus < 1)
+                usage ();
+            break;
+
+        case 'l':		/* low-latency serial driver mode */
+            ttylowlatency = TRUE;
+            break;
+
+        case 'L':		/* lock memory */
+            lockmem = TRUE;
+            break;
+
+        case 'm':		/* longest sentence accepted */
+            msgmaxlength = atoi (optarg);
+            if (msgmaxlength < 1 || msgmaxlength > MSGLENGTHLIMIT)
+                usage ();
+            break;
+
+        case 'M':		/* shared-memory ring */
+            shmname = optarg;
+            break;
+
+        case 'P':		/* talker SCHED_FIFO priority */
+            talkerpriority = atoi (optarg);
+            break;
+
+        case 'q':		/* largest queue per listener */
+            msgbuffersize = atoi (optarg);
+            break;
+
+        case 'Q':		/* largest queue per high-priority listener */
+            highbuffersize = atoi (optarg);
+            break;
+
+        case 'r':		/* SO_REUSEPORT listening socket per worker */
+            reuseport = TRUE;
+            break;
+
+        case 'R':		/* records kept for clients resuming */
+            history = atoi (optarg);
+            if (history < 1)
+                usage ();
+            break;
+
+        case 's':		/* state file[,checkpoint interval] */
+            statepath = optarg;
+            p = strrchr (optarg, ',');
+            if (p != NULL) {
+                *p = '\0';
+                stateinterval = atoi (p + 1);
+                if (stateinterval < 1)
+                    usage ();
+            }
+            break;
+
+        case 'S':		/* statistics interval */
+            statsinterval = atoi (optarg);
+            break;
+
+        case 't':		/* serial read VMIN[,VTIME] */
+            c = sscanf (optarg, "%d,%d", &ttyvmin, &ttyvtime);
+            if (c < 1 || ttyvmin < 0 || ttyvmin > 255
+                      || ttyvtime < 0 || ttyvtime > 255)
+                usage ();
+            break;
+
+        case 'T':		/* frame types sent by default */
+            frametypes = parseframetypes (optarg);
+            if (frametypes <= 0)
+                usage ();
+            break;
+
+        case 'u':		/* Unix domain socket path */
+            if (strncmp (optarg, "seqpacket:", 10) == 0) {
+                localtype = SOCK_SEQPACKET;
+                optarg += 10;
+            }
+            localpath = optarg;
+            break;
+
+        case 'U':		/* Unix domain socket permissions */
+            localmode = (int) strtol (optarg, NULL, 8);
+            break;
+
         case 'v':		/* verbose */
             verbose = atoi (optarg);
             break;
@@ -138,6 +323,24 @@ int main (int argc, char ** argv)
             port = atoi (optarg);
             break;
 
+        case 'w':		/* HTTP (WebSocket / event stream) port */
+            httpport = atoi (optarg);
+            break;
+
+        case 'W':		/* worker threads */
+            nworkers = atoi (optarg);
+            if (nworkers < 1)
+                usage ();
+            break;
+
+        case 'x':		/* binary position stream */
+            poskeyinterval = atoi (optarg);
+            break;
+
+        case 'z':		/* MSG_ZEROCOPY sends */
+            zerocopy = TRUE;
+            break;
+
         case 'h':
         default:
             usage ();
@@ -157,35 +360,264 @@ int main (int argc, char ** argv)
         usage ();		/* never returns */
     }
 
+    if (nworkers == 0) {
+        nworkers = (int) sysconf (_SC_NPROCESSORS_ONLN);
+        if (nworkers < 1)
+            nworkers = 1;
+    }
+
     if (verbose >= 1)
         fprintf (stderr, "%s %s\n", PACKAGE, VERSION);
 
-    gpsfd = openserial (ttyin, 1, ttybaud);
-    read (gpsfd, buf, BUFSZ);        /* flush */
-
-    talkerinfo.fp = fdopen (gpsfd, "r");
-    if (!talkerinfo.fp) {
-        perror ("fdopen gps");
+    /* Debug output from the distribution path is formatted off it */
+    if (verbose >= 1 && startlogger (stdout) != 0)
+        fprintf (stderr, "Cannot start log thread; logging directly\n");
+
+    /* The channels of the configuration file, or else the one the
+       command line describes */
+    memset (&defaults, 0, sizeof (defaults));
+    defaults.input = (char *) ttyin;
+    defaults.baud = ttybaud;
+    defaults.port = port;
+    defaults.highport = highport;
+    defaults.httpport = httpport;
+    defaults.localpath = localpath;
+    defaults.localtype = localtype;
+    defaults.shmname = shmname;
+    defaults.types = frametypes;
+    defaults.maxconn = maxconnections;
+    defaults.buffersize[PRIORITY_HIGH] = highbuffersize;
+    defaults.buffersize[PRIORITY_NORMAL] = msgbuffersize;
+    defaults.budget = queuebudget;
+    defaults.snapshot = aissnapshot;
+    defaults.track = aistracking || aissnapshot || statepath != NULL;
+    defaults.history = history;
+    if (configpath != NULL)
+        channels = readchannels (configpath, &defaults);
+    else
+        channels = newchannel (&defaults, "default");
+    if (channels == NULL)
         exit (1);
+
+    for (ch = channels, i = 0; ch != NULL; ch = ch->next, i++) {
+        openchannel (ch, i);
+        if (i > 0)
+            prev->talker.cmgr->next = ch->talker.cmgr;
+        prev = ch;
     }
-    talkerinfo.tickinterval = 0;
 
-    talkerinfo.cmgr = newconnectionmgr ();
+    /* Pick up where the last run left off */
+    if (statepath != NULL) {
+        state = openstate (statepath, channels);
+        if (state == NULL)
+            exit (1);
+    }
+
+    /* SIGUSR1 is taken by the statistics reporter alone */
+    sigemptyset (&sigs);
+    sigaddset (&sigs, SIGUSR1);
+    pthread_sigmask (SIG_BLOCK, &sigs, NULL);
 
-    talker = (pthread_t *) malloc (sizeof (pthread_t));
+    if (lockmem && lockmemory () != 0)
+        exit (1);
+
+    /* Workers, talkers, the reporter, the state keeper, the logger */
+    if (verbose >= 1) {
+        for (ch = channels, i = 0; ch != NULL; ch = ch->next, i++)
+            ;
+        reportmemory (channels, nworkers,
+                      nworkers + i + 2 + (state != NULL ? 1 : 0));
+    }
 
-    threadresult = pthread_create (talker, NULL, talk,
-        (void *) &talkerinfo);
+    for (ch = channels; ch != NULL; ch = ch->next)
+        starttalker (ch);
 
-    multilisten (talkerinfo.cmgr);
+    initthreadattr (&attr);
+    pthread_create (&reporter, &attr, reportstats, (void *) channels);
+    if (state != NULL)
+        pthread_create (&keeper, &attr, keepstate, (void *) state);
+    pthread_attr_destroy (&attr);
 
-    pthread_join (*talker, (void **) &talkerretval);
+    multilisten (channels);
+
+    pthread_join (channels->thread, NULL);
 
     exit(0);
 }
 
 
 
+/*
+* openchannel
+*
+* Opens a channel's receiver and sets up its talker and connection
+* manager.
+*
+* Parameters:
+*     ch    : channel_t * : The channel.
+*     index : int         : The channel's number.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Exits if any part of the channel cannot be set up.
+*
+*/
+static void openchannel (channel_t * ch, int index)
+{
+    talkerinfo_t * ti = &ch->talker;
+    int initialsize;
+    int fd;
+
+    if (ch->buffersize[PRIORITY_NORMAL] < msgmaxlength + MSGHEADERLENGTH
+      || ch->buffersize[PRIORITY_HIGH] < msgmaxlength + MSGHEADERLENGTH) {
+        fprintf (stderr, "%s: queue size must hold at least one %d-byte "
+                 "sentence\n", ch->name, msgmaxlength);
+        exit (1);
+    }
+
+    /* A relay source is opened by the talker, which reopens it when it
+       is lost */
+    if (isrelay (ch->input)) {
+        ti->relay = newrelay (ch->input);
+        if (ti->relay == NULL) {
+            fprintf (stderr, "%s: bad relay source %s (tcp:host:port or "
+                     "udp:address:port)\n", ch->name, ch->input);
+            exit (1);
+        }
+        fd = -1;
+    }
+    else {
+        fd = openserial ((u_char *) ch->input, ttyvmin, ttyvtime, ch->baud);
+        if (fd < 0)
+            exit (1);
+        if (ttylowlatency)
+            setlowlatency (fd);
+        tcflush (fd, TCIFLUSH);
+    }
+
+    ti->fd = fd;
+    ti->framer = newframer (msgmaxlength);
+    if (ti->framer == NULL) {
+        perror ("newframer");
+        exit (1);
+    }
+    ti->framer->striptags = (ti->relay != NULL);
+    ti->tickinterval = 0;
+    ti->maxlength = msgmaxlength;
+    ti->epochgap = epochgap;
+    ti->epochhold = epochhold;
+    if (poskeyinterval > 0) {
+        ti->pos = newposencoder (poskeyinterval);
+        if (ti->pos == NULL) {
+            perror ("newposencoder");
+            exit (1);
+        }
+    }
+    ti->ais = NULL;
+    if (aisreassemble || aiswindow > 0) {
+        ti->ais = newaisfilter (aisreassemble ? AIS_FORWARD_REASSEMBLED
+                                              : AIS_FORWARD_FRAGMENTS,
+                                aiswindow, msgmaxlength);
+        if (ti->ais == NULL) {
+            perror ("newaisfilter");
+            exit (1);
+        }
+    }
+
+    /* Queues start small enough for fast clients, but hold at least one
+       sentence, and grow when a client lags */
+    initialsize = MSGBUFFERINITIAL;
+    if (initialsize < msgmaxlength + MSGHEADERLENGTH)
+        initialsize = msgmaxlength + MSGHEADERLENGTH;
+    if (initialsize > ch->buffersize[PRIORITY_NORMAL])
+        initialsize = ch->buffersize[PRIORITY_NORMAL];
+    if (initialsize > ch->buffersize[PRIORITY_HIGH])
+        initialsize = ch->buffersize[PRIORITY_HIGH];
+    ti->cmgr = newconnectionmgr (ch->maxconn, initialsize, ch->buffersize,
+                                 ch->history);
+    if (ti->cmgr == NULL) {
+        fprintf (stderr, "Cannot allocate %d connections\n", ch->maxconn);
+        exit (1);
+    }
+    ti->cmgr->types = ch->types;
+    ti->cmgr->budget = ch->budget;
+    ti->cmgr->snapshot = ch->snapshot;
+    ti->cmgr->index = index;
+    if (ch->shmname != NULL) {
+        ti->cmgr->shm = nmeashmcreate (ch->shmname, NMEASHMSIZE,
+                                       NMEASHMENTRIES, 0644);
+        if (ti->cmgr->shm == NULL) {
+            fprintf (stderr, "Cannot create shared memory %s: %s\n",
+                ch->shmname, strerror (errno));
+            exit (1);
+        }
+    }
+    /* The AIS targets are kept only for the features that need them */
+    if (ch->track || ch->snapshot) {
+        ti->cmgr->track = newaistrack ();
+        if (ti->cmgr->track == NULL) {
+            perror ("newaistrack");
+            exit (1);
+        }
+    }
+
+    return;
+}
+
+
+
+
+/*
+* starttalker
+*
+* Starts the thread reading a channel's receiver.
+*
+* Parameters:
+*     ch : channel_t * : The channel, set up by openchannel.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The thread runs at the SCHED_FIFO priority given with -P if that is
+*     allowed, and on the CPU given with -C.  Exits if it cannot start.
+*
+*/
+static void starttalker (channel_t * ch)
+{
+    pthread_attr_t attr;
+    int threadresult;
+
+    initthreadattr (&attr);
+    if (talkerpriority > 0 && setrealtime (&attr, talkerpriority) != 0)
+        fprintf (stderr, "Cannot request SCHED_FIFO priority %d\n",
+            talkerpriority);
+    threadresult = pthread_create (&ch->thread, &attr, talk,
+        (void *) &ch->talker);
+    if (threadresult != 0 && talkerpriority > 0) {
+        fprintf (stderr, "Cannot run talker at SCHED_FIFO priority %d: %s\n",
+            talkerpriority, strerror (threadresult));
+        pthread_attr_destroy (&attr);
+        initthreadattr (&attr);
+        threadresult = pthread_create (&ch->thread, &attr, talk,
+            (void *) &ch->talker);
+    }
+    if (threadresult != 0) {
+        fprintf (stderr, "Cannot start talker: %s\n", strerror (threadresult));
+        exit (1);
+    }
+    pthread_attr_destroy (&attr);
+    if (talkercpu >= 0)
+        pinthread (ch->thread, talkercpu);
+
+    return;
+}
+
+
+
+
 /*
 * openserial
 *
@@ -195,7 +627,8 @@ int main (int argc, char ** argv)
 * Parameters:
 *     tty     : pointer to    : A zero-terminated string containing the device
 *               unsigned char   name of the appropriate serial port.
-*     blocksz : integer       : Block size for port I/O
+*     vmin    : integer       : Bytes a read waits for (VMIN)
+*     vtime   : integer       : Inter-byte timeout in tenths of a second (VTIME)
 *     ttybaud : long          : Baud rate for port I/O
 *
 * Return Value:
@@ -203,9 +636,13 @@ int main (int argc, char ** argv)
 *     The function returns -1 in the event of an error.
 *
 * Remarks:
+*     With the default VMIN of 1 a read returns as soon as a byte has
+*     arrived, so sentences are timestamped and passed on without waiting
+*     for a block to fill.  Rates above 115200 baud are available where
+*     the system defines them.
 *
 */
-int openserial (u_char * tty, int blocksz, long ttybaud)
+int openserial (u_char * tty, int vmin, int vtime, long ttybaud)
 {
     int             fd;
     struct termios  termios;
@@ -236,8 +673,8 @@ int openserial (u_char * tty, int blocksz, long ttybaud)
         for (cnt = 0; cnt < NCCS; cnt++)
             termios.c_cc[cnt] = -1;
     }
-    termios.c_cc[VMIN] = blocksz;
-    termios.c_cc[VTIME] = 2;
+    termios.c_cc[VMIN] = vmin;
+    termios.c_cc[VTIME] = vtime;
 
     switch (ttybaud) {
     case 300:
@@ -261,10 +698,39 @@ int openserial (u_char * tty, int blocksz, long ttybaud)
     case 38400:
         ttyspeed = B38400;
         break;
+    case 57600:
+        ttyspeed = B57600;
+        break;
     case 115200:
         ttyspeed = B115200;
         break;
+#ifdef B230400
+    case 230400:
+        ttyspeed = B230400;
+        break;
+#endif
+#ifdef B460800
+    case 460800:
+        ttyspeed = B460800;
+        break;
+#endif
+#ifdef B500000
+    case 500000:
+        ttyspeed = B500000;
+        break;
+#endif
+#ifdef B576000
+    case 576000:
+        ttyspeed = B576000;
+        break;
+#endif
+#ifdef B921600
+    case 921600:
+        ttyspeed = B921600;
+        break;
+#endif
     default:
+        fprintf (stderr, "Unsupported baud rate %ld, using 4800\n", ttybaud);
         ttyspeed = B4800;
         break;
     }
@@ -291,6 +757,47 @@ int openserial (u_char * tty, int blocksz, long ttybaud)
 
 
 
+/*
+* setlowlatency
+*
+* Asks the serial driver to pass received bytes on immediately.
+*
+* Parameters:
+*     fd : integer : The opened serial port.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Sets ASYNC_LOW_LATENCY, which stops 8250-class drivers holding
+*     received characters back for a scheduler tick.  Drivers without
+*     the setting (USB adapters, ptys) refuse it, which is harmless.
+*
+*/
+void setlowlatency (int fd)
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct serial;
+    int result;
+
+    result = ioctl (fd, TIOCGSERIAL, &serial);
+    if (result == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        result = ioctl (fd, TIOCSSERIAL, &serial);
+    }
+    if (result < 0 && verbose >= 1)
+        fprintf (stderr, "Serial driver low-latency mode unavailable: %s\n",
+            strerror (errno));
+#else
+    if (verbose >= 1)
+        fprintf (stderr, "Serial driver low-latency mode not supported\n");
+#endif
+    return;
+}
+
+
+
+
 /*
 * usage
 *
@@ -310,14 +817,80 @@ void usage (void)
     fprintf (stderr, "nmead: NMEA server application\n");
     fprintf (stderr, "Usage: nmead [OPTIONS]\n");
     fprintf (stderr, "  Options are:\n");
-    fprintf (stderr, "    -b baud_rate  sets serial output baud rate\n");
+    fprintf (stderr, "    -a  passes on multi-fragment AIS messages as one sentence\n");
+    fprintf (stderr, "    -A  sends new listeners the AIS targets known (see SNAPSHOT)\n");
+    fprintf (stderr, "    -b baud_rate  sets serial port baud rate (up to 921600)\n");
     fprintf (stderr, "       default/current value is %ld\n", ttybaud);
+    fprintf (stderr, "    -B bytes  limits the memory all grown queues may take together\n");
+    fprintf (stderr, "       default/current value is %ld\n", queuebudget);
+    fprintf (stderr, "    -c connections  sets maximum number of listeners\n");
+    fprintf (stderr, "       default/current value is %d\n", maxconnections);
+    fprintf (stderr, "    -C cpu  pins the thread reading the serial port to a CPU\n");
+    fprintf (stderr, "    -d msec  drops AIS messages repeated within msec\n");
+    fprintf (stderr, "       (e.g. received by more than one AIS receiver)\n");
+    fprintf (stderr, "    -e msec  delivers each GNSS epoch to listeners in one write; an\n");
+    fprintf (stderr, "       epoch ends when the time field changes or after msec of silence\n");
+    fprintf (stderr, "    -E msec  holds an epoch for at most msec (with -e)\n");
+    fprintf (stderr, "       default/current value is %d\n", epochhold);
+    fprintf (stderr, "    -f file  serves the channels described in a configuration file,\n");
+    fprintf (stderr, "       each with its own receiver and ports (see channel.c);\n");
+    fprintf (stderr, "       the other options give their defaults\n");
+    fprintf (stderr, "    -g  keeps the AIS targets heard, so that listeners may send AREA,\n");
+    fprintf (stderr, "       RANGE and SNAPSHOT (implied by -A and -s)\n");
+    fprintf (stderr, "    -H tcp_port  also listens on a port for high-priority listeners\n");
+    fprintf (stderr, "       (served first; clients on it or the local socket may send \"PRIORITY high\")\n");
     fprintf (stderr, "    -i serial_port  sets name of serial input device\n");
     fprintf (stderr, "       default/current value is %s\n", ttyport);
-    fprintf (stderr, "       (normally a symbolic link to /dev/ttyxxx)\n");
+    fprintf (stderr, "       (normally a symbolic link to /dev/ttyxxx),\n");
+    fprintf (stderr, "       or tcp:host:port to relay another nmead, resuming after\n");
+    fprintf (stderr, "       a lost connection, or udp:address:port to relay datagrams\n");
+    fprintf (stderr, "       (joining the group if the address is multicast)\n");
+    fprintf (stderr, "    -k  pins each worker thread to its own CPU\n");
+    fprintf (stderr, "    -K cpulist  pins worker threads to the listed CPUs in turn\n");
+    fprintf (stderr, "       (e.g. 1-3 or 1,3)\n");
+    fprintf (stderr, "    -l  puts the serial driver in low-latency mode (Linux)\n");
+    fprintf (stderr, "    -L  locks all memory to avoid page-fault stalls\n");
+    fprintf (stderr, "    -m length  sets longest sentence passed on (at most %d)\n",
+        MSGLENGTHLIMIT);
+    fprintf (stderr, "       default/current value is %d\n", msgmaxlength);
+    fprintf (stderr, "    -M name  also publishes to a shared-memory ring (e.g. /nmead)\n");
+    fprintf (stderr, "       read with nmeashmopen() from libnmeashm.a\n");
     fprintf (stderr, "    -p tcp_port  sets port number on which the server will listen\n");
-    fprintf (stderr, "       default/current value is %d\n", port);
+    fprintf (stderr, "       default/current value is %d (0 for none)\n", port);
+    fprintf (stderr, "    -P priority  runs the serial reader at SCHED_FIFO priority\n");
+    fprintf (stderr, "    -q bytes  sets largest queue for each listener\n");
+    fprintf (stderr, "       (queues start at %d bytes and grow while a listener lags)\n",
+        MSGBUFFERINITIAL);
+    fprintf (stderr, "       default/current value is %d\n", msgbuffersize);
+    fprintf (stderr, "    -Q bytes  sets largest queue for each high-priority listener\n");
+    fprintf (stderr, "       default/current value is %d\n", highbuffersize);
+    fprintf (stderr, "    -r  gives each worker its own SO_REUSEPORT listening socket\n");
+    fprintf (stderr, "    -R sentences  keeps the last sentences for listeners that come\n");
+    fprintf (stderr, "       back and send \"RESUME seq\"; %d bytes of data are kept\n",
+        STREAMRECORDSIZE);
+    fprintf (stderr, "       per sentence, so long binary frames leave room for fewer\n");
+    fprintf (stderr, "       default/current value is %d\n", history);
+    fprintf (stderr, "    -s file[,seconds]  keeps AIS targets and sequence numbers in file\n");
+    fprintf (stderr, "       across restarts, saving the targets when they have changed\n");
+    fprintf (stderr, "       default/current interval is %d seconds\n", stateinterval);
+    fprintf (stderr, "    -S seconds  prints latency statistics periodically\n");
+    fprintf (stderr, "       (they are always printed on SIGUSR1)\n");
+    fprintf (stderr, "    -t vmin[,vtime]  sets serial read VMIN and VTIME (tenths)\n");
+    fprintf (stderr, "       default/current value is %d,%d\n", ttyvmin, ttyvtime);
+    fprintf (stderr, "    -T types  sets frames sent to clients that do not ask (nmea,ubx,rtcm3,pos)\n");
+    fprintf (stderr, "       default is nmea; clients may send \"TYPES list\" instead\n");
+    fprintf (stderr, "    -u [seqpacket:]path  also listens on a Unix domain socket\n");
+    fprintf (stderr, "       (seqpacket: sends each sentence as one record)\n");
+    fprintf (stderr, "    -U mode  sets permissions of the Unix domain socket (octal)\n");
     fprintf (stderr, "    -v verblevel  turns on extra output\n");
+    fprintf (stderr, "    -w tcp_port  also listens on a port for WebSocket and event-stream\n");
+    fprintf (stderr, "       listeners (GET /events, ?types= selects frame types)\n");
+    fprintf (stderr, "    -W workers  sets number of threads serving listeners\n");
+    fprintf (stderr, "       default is one per CPU\n");
+    fprintf (stderr, "    -x n  also publishes a binary position stream (frame type pos)\n");
+    fprintf (stderr, "       from GGA and RMC, with a keyframe every n fixes\n");
+    fprintf (stderr, "    -z  sends to listeners with MSG_ZEROCOPY where supported\n");
+    fprintf (stderr, "       (worthwhile only for high-rate streams to many clients)\n");
     exit (2);
 }
 
@@ -60,34 +60,185 @@
 #include <stdlib.h>
 #include <string.h>
 #include "msgbuffer.h"
+#include "probes.h"
+#include "log.h"
 
 
 extern int verbose;
 
 
+/*
+* ringcopyin
+*
+* Copies bytes into the ring at the given index, wrapping at the end.
+*
+* Parameters:
+*     buf   : msgbuffer *  : The buffer.
+*     index : int          : Ring index at which to start.
+*     src   : const char * : The bytes to be copied.
+*     n     : int          : Number of bytes.
+*
+* Return Value:
+*     The function returns the ring index following the copied bytes.
+*
+* Remarks:
+*
+*/
+static int ringcopyin (msgbuffer * buf, int index, const char * src, int n)
+{
+    int first = buf->size - index;
+
+    if (n < first) {
+        memcpy (buf->data + index, src, n);
+        return index + n;
+    }
+
+    memcpy (buf->data + index, src, first);
+    memcpy (buf->data, src + first, n - first);
+    return n - first;
+}
+
+
+
+
+/*
+* ringcopyout
+*
+* Copies bytes out of the ring from the given index, wrapping at the end.
+*
+* Parameters:
+*     buf   : msgbuffer * : The buffer.
+*     index : int         : Ring index at which to start.
+*     dst   : char *      : Destination of the copy.
+*     n     : int         : Number of bytes.
+*
+* Return Value:
+*     The function returns the ring index following the copied bytes.
+*
+* Remarks:
+*
+*/
+static int ringcopyout (msgbuffer * buf, int index, char * dst, int n)
+{
+    int first = buf->size - index;
+
+    if (n < first) {
+        memcpy (dst, buf->data + index, n);
+        return index + n;
+    }
+
+    memcpy (dst, buf->data + index, first);
+    memcpy (dst + first, buf->data, n - first);
+    return n - first;
+}
+
+
+
+
+/*
+* packheader
+*
+* Encodes a record header.
+*
+* Parameters:
+*     header : unsigned char * : Receives MSGHEADERLENGTH bytes.
+*     length : int             : Message length.
+*     stamp  : unsigned int    : Receive stamp of the message.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void packheader (unsigned char * header, int length,
+                        unsigned int stamp)
+{
+    header[0] = (unsigned char) (length & 0xff);
+    header[1] = (unsigned char) (length >> 8);
+    header[2] = (unsigned char) (stamp & 0xff);
+    header[3] = (unsigned char) ((stamp >> 8) & 0xff);
+    header[4] = (unsigned char) ((stamp >> 16) & 0xff);
+    header[5] = (unsigned char) ((stamp >> 24) & 0xff);
+    return;
+}
+
+
+
+
+/*
+* unpackheader
+*
+* Decodes a record header.
+*
+* Parameters:
+*     header : const unsigned char * : MSGHEADERLENGTH header bytes.
+*     stamp  : unsigned int *        : Receives the receive stamp, or NULL.
+*
+* Return Value:
+*     The function returns the message length.
+*
+* Remarks:
+*
+*/
+static int unpackheader (const unsigned char * header, unsigned int * stamp)
+{
+    if (stamp != NULL)
+        *stamp = header[2] | (header[3] << 8) | (header[4] << 16)
+               | ((unsigned int) header[5] << 24);
+
+    return header[0] | (header[1] << 8);
+}
+
+
+
+
+/*
+* msgstamp
+*
+* Converts a CLOCK_MONOTONIC reading to a message receive stamp.
+*
+* Parameters:
+*     ts : const struct timespec * : The reading.
+*
+* Return Value:
+*     The function returns the reading in microseconds, modulo 2^32.
+*
+* Remarks:
+*     Only differences between stamps are meaningful.
+*
+*/
+unsigned int msgstamp (const struct timespec * ts)
+{
+    return (unsigned int) ts->tv_sec * 1000000U
+         + (unsigned int) (ts->tv_nsec / 1000);
+}
+
+
+
+
 /*
 * newmsgbuffer
 *
 * Allocates and initializes a new msgbuffer structure.
 *
 * Parameters:
-*     None.
+*     size : int : Number of bytes of message storage.
 *
 * Return Value:
 *     The function returns an initialized msgbuffer structure.
 *
 * Remarks:
+*     The storage is allocated in the same block as the structure.
 *
 */
-msgbuffer * newmsgbuffer (void)
+msgbuffer * newmsgbuffer (int size)
 {
-    msgbuffer * b = calloc (1, sizeof (msgbuffer));
+    msgbuffer * b = calloc (1, sizeof (msgbuffer) + size);
     if (b == NULL)
         return NULL;
 
-    b->readindex = 0;
-    b->writeindex = 0;
-    sem_init (&b->semaccess, 0, 1);
+    initmsgbuffer (b, (char *) (b + 1), size);
 
     return b;
 }
@@ -111,7 +262,7 @@ msgbuffer * newmsgbuffer (void)
 */
 void destroymsgbuffer (msgbuffer * buf)
 {
-    sem_destroy (&buf->semaccess);
+    cleanupmsgbuffer (buf);
     free (buf);
     return;
 }
@@ -119,41 +270,154 @@ void destroymsgbuffer (msgbuffer * buf)
 
 
 
+/*
+* initmsgbuffer
+*
+* Initializes a msgbuffer structure in caller-provided memory.
+*
+* Parameters:
+*     buf  : msgbuffer * : A pointer to the structure to be initialized.
+*     data : char *      : Storage for the ring.
+*     size : int         : Number of bytes at data.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Used for buffers embedded in pooled connection slots.
+*
+*/
+void initmsgbuffer (msgbuffer * buf, char * data, int size)
+{
+    buf->data = data;
+    buf->size = size;
+    buf->used = 0;
+    buf->readindex = 0;
+    buf->writeindex = 0;
+    buf->sent = 0;
+    sem_init (&buf->semaccess, 0, 1);
+    return;
+}
+
+
+
+
+/*
+* cleanupmsgbuffer
+*
+* Releases the resources of a msgbuffer structure without freeing it.
+*
+* Parameters:
+*     buf : msgbuffer * : A pointer to the structure to be cleaned up.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void cleanupmsgbuffer (msgbuffer * buf)
+{
+    sem_destroy (&buf->semaccess);
+    return;
+}
+
+
+
+
+/*
+* movemsgbuffer
+*
+* Moves the contents of a msgbuffer to new storage.
+*
+* Parameters:
+*     buf  : msgbuffer * : A pointer to the structure.
+*     data : char *      : The new storage, which must not overlap the
+*                          current storage.
+*     size : int         : Number of bytes at data.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 if the queued
+*     messages do not fit in the new storage.
+*
+* Remarks:
+*     The queued messages are copied to the start of the new storage,
+*     partly sent message included.  The caller owns, and releases, the
+*     old storage.
+*
+*/
+int movemsgbuffer (msgbuffer * buf, char * data, int size)
+{
+    int result = 0;
+
+    sem_wait (&buf->semaccess);
+
+    if (buf->used > size)
+        result = -1;
+    else {
+        if (buf->used > 0)
+            ringcopyout (buf, buf->readindex, data, buf->used);
+        buf->data = data;
+        buf->size = size;
+        buf->readindex = 0;
+        buf->writeindex = buf->used % size;
+    }
+
+    sem_post (&buf->semaccess);
+
+    return result;
+}
+
+
+
+
 /*
 * putmsg
 *
 * Stores a message in the msgbuffer structure.
 *
 * Parameters:
-*     buf : msgbuffer * : A pointer to the structure to be given the message.
-*     msg : char *      : A pointer to the message to be stored.
+*     buf    : msgbuffer *  : A pointer to the structure to be given the
+*                             message.
+*     msg    : const char * : A pointer to the message to be stored.
+*     length : int          : Length of the message in bytes.
 *
 * Return Value:
 *     The function returns zero if successful, nonzero if not.
 *
 * Remarks:
+*     The message is stored whole or not at all.
 *
 */
-int putmsg (msgbuffer * buf, const char * msg)
+int putmsg (msgbuffer * buf, const char * msg, int length,
+            unsigned int stamp)
 {
-    int nextwriteindex;
+    unsigned char header[MSGHEADERLENGTH];
     int result = 0;
 
+    if (length < 0 || length > 0xffff)
+        return -1;
+
+    packheader (header, length, stamp);
+
     sem_wait (&buf->semaccess);
 
-    nextwriteindex = (++buf->writeindex % MSGBUFFERELEMENTS);
-    if (nextwriteindex == buf->readindex) {
+    if (buf->size - buf->used < MSGHEADERLENGTH + length) {
         if (verbose >= 100) {
-            printf ("Cannot add message; buffer is full\n");
+            LOG ("Cannot add message; buffer is full\n");
         }
+        PROBE3 (full, buf, length, stamp);
         result = -1;
     }
     else {
         if (verbose >= 100) {
-            printf ("Adding message\n");
+            LOG ("Adding message\n");
         }
-        strncpy (buf->element[nextwriteindex], msg, MSGELEMENTLENGTH - 1);
-        buf->writeindex = nextwriteindex;
+        buf->writeindex = ringcopyin (buf, buf->writeindex,
+                                      (const char *) header, MSGHEADERLENGTH);
+        buf->writeindex = ringcopyin (buf, buf->writeindex, msg, length);
+        buf->used += MSGHEADERLENGTH + length;
+        PROBE3 (enqueue, buf, length, stamp);
     }
 
     sem_post (&buf->semaccess);
@@ -175,31 +439,57 @@ int putmsg (msgbuffer * buf, const char * msg)
 *     msg    : char *      : A pointer to a memory location into which the
 *                            retrieved message is to be stored.
 *     length : int         : Number of available bytes in the memory location.
+*     stamp  : unsigned int * : Receives the message's receive stamp, or
+*                               NULL.
 *
 * Return Value:
-*     The function returns zero if successful, nonzero if not.
+*     The function returns the length of the retrieved message, which is
+*     not zero-terminated.  It returns MSGBUFFER_EMPTY if there is no
+*     message, or MSGBUFFER_TOOLONG if the next message does not fit in
+*     the memory location; the message is left in the buffer in that case.
 *
 * Remarks:
+*     If part of the message was already consumed through consumemsgs,
+*     only the remainder is retrieved.
 *
 */
-int getmsg (msgbuffer * buf, char * msg, int length)
+int getmsg (msgbuffer * buf, char * msg, int length, unsigned int * stamp)
 {
-    int result = 0;
+    unsigned char header[MSGHEADERLENGTH];
+    unsigned int recvstamp;
+    int msglength;
+    int index;
+    int result;
 
     sem_wait (&buf->semaccess);
 
-    if (buf->readindex == buf->writeindex) {
+    if (buf->used == 0) {
         if (verbose >= 100) {
-            printf ("Cannot read message; buffer is empty\n");
+            LOG ("Cannot read message; buffer is empty\n");
         }
-        result = -1;
+        result = MSGBUFFER_EMPTY;
     }
     else {
-        if (verbose >= 100) {
-            printf ("Reading message\n");
+        index = ringcopyout (buf, buf->readindex,
+                             (char *) header, MSGHEADERLENGTH);
+        msglength = unpackheader (header, &recvstamp);
+
+        if (msglength - buf->sent > length)
+            result = MSGBUFFER_TOOLONG;
+        else {
+            if (verbose >= 100) {
+                LOG ("Reading message\n");
+            }
+            index = (index + buf->sent) % buf->size;
+            buf->readindex = ringcopyout (buf, index, msg,
+                                          msglength - buf->sent);
+            buf->used -= MSGHEADERLENGTH + msglength;
+            result = msglength - buf->sent;
+            buf->sent = 0;
+            if (stamp != NULL)
+                *stamp = recvstamp;
+            PROBE3 (dequeue, buf, msglength, recvstamp);
         }
-        strncpy (msg, buf->element[buf->readindex], length);
-        buf->readindex = (++buf->readindex % MSGBUFFERELEMENTS);
     }
 
     sem_post (&buf->semaccess);
@@ -209,3 +499,117 @@ int getmsg (msgbuffer * buf, char * msg, int length)
 
 
 
+
+/*
+* peekmsgs
+*
+* Describes the queued messages as an I/O vector, without removing them.
+*
+* Parameters:
+*     buf    : msgbuffer *    : A pointer to the structure.
+*     iov    : struct iovec * : Receives the vector.
+*     maxiov : int            : Number of elements available at iov.
+*
+* Return Value:
+*     The function returns the number of vector elements filled in, or
+*     zero if the buffer is empty.
+*
+* Remarks:
+*     The vector points into the buffer itself, so that the messages can
+*     be written with writev and no intermediate copy.  The caller then
+*     removes what was written with consumemsgs.  Only the thread that
+*     fills the buffer may use this pair of functions, since the vector
+*     is not protected against concurrent putmsg calls.
+*
+*/
+int peekmsgs (msgbuffer * buf, struct iovec * iov, int maxiov)
+{
+    unsigned char header[MSGHEADERLENGTH];
+    int index = buf->readindex;
+    int remaining = buf->used;
+    int skip = buf->sent;
+    int msglength, n, first;
+    int niov = 0;
+
+    while (remaining > 0 && niov + 2 <= maxiov) {
+        index = ringcopyout (buf, index, (char *) header, MSGHEADERLENGTH);
+        msglength = unpackheader (header, NULL);
+        remaining -= MSGHEADERLENGTH + msglength;
+
+        index = (index + skip) % buf->size;
+        n = msglength - skip;
+        skip = 0;
+
+        first = buf->size - index;
+        if (n <= first) {
+            iov[niov].iov_base = buf->data + index;
+            iov[niov++].iov_len = n;
+        }
+        else {
+            iov[niov].iov_base = buf->data + index;
+            iov[niov++].iov_len = first;
+            iov[niov].iov_base = buf->data;
+            iov[niov++].iov_len = n - first;
+        }
+        index = (index + n) % buf->size;
+    }
+
+    return niov;
+}
+
+
+
+
+/*
+* consumemsgs
+*
+* Removes written bytes from the front of the buffer.
+*
+* Parameters:
+*     buf    : msgbuffer * : A pointer to the structure.
+*     length : int         : Number of message bytes written, as returned
+*                            by writev for a vector from peekmsgs.
+*     stamp  : unsigned int * : Receives the receive stamp of the first
+*                               message completed, or NULL.
+*
+* Return Value:
+*     The function returns the number of messages completely written.
+*
+* Remarks:
+*     A message that was only partly written stays at the front of the
+*     buffer, and its remainder is returned by the next peekmsgs.
+*
+*/
+int consumemsgs (msgbuffer * buf, int length, unsigned int * stamp)
+{
+    unsigned char header[MSGHEADERLENGTH];
+    unsigned int recvstamp;
+    int msglength;
+    int completed = 0;
+
+    sem_wait (&buf->semaccess);
+
+    while (length > 0 && buf->used > 0) {
+        ringcopyout (buf, buf->readindex, (char *) header, MSGHEADERLENGTH);
+        msglength = unpackheader (header, &recvstamp);
+
+        if (length < msglength - buf->sent) {
+            buf->sent += length;
+            break;
+        }
+
+        length -= msglength - buf->sent;
+        buf->readindex = (buf->readindex + MSGHEADERLENGTH + msglength)
+                       % buf->size;
+        buf->used -= MSGHEADERLENGTH + msglength;
+        buf->sent = 0;
+        PROBE3 (dequeue, buf, msglength, recvstamp);
+
+        if (completed++ == 0 && stamp != NULL)
+            *stamp = recvstamp;
+    }
+
+    sem_post (&buf->semaccess);
+
+    return completed;
+}
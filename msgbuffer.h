@@ -61,21 +61,45 @@
 #define MSGBUFFER_H
 
 #include <semaphore.h>
+#include <time.h>
+#include <sys/uio.h>
+
+
+
+/* Messages are stored back to back in a contiguous byte ring, each
+   preceded by a six-byte header, so a short sentence occupies only its
+   own length plus six bytes and long proprietary or TAG-blocked
+   sentences are stored whole rather than truncated.  A record may wrap
+   around the end of the ring.
+
+   The header holds the message length (two bytes) and the time its
+   first byte was received, as a 32-bit microsecond clock (see
+   msgstamp).  The stamp wraps every 71 minutes, which only matters for
+   messages queued that long. */
+#define MSGHEADERLENGTH     6
+#define MSGBUFFERINITIAL    1024  /* ring size a connection starts with */
+#ifdef NMEAD_SMALL
+#define MSGBUFFERSIZE       16384 /* default largest ring per connection */
+#define MSGBUFFERBUDGET     262144   /* default total of all rings */
+#else
+#define MSGBUFFERSIZE       65536 /* default largest ring per connection */
+#define MSGBUFFERBUDGET     1048576  /* default total of all rings */
+#endif
+#define MSGMAXLENGTH        512   /* default longest message accepted */
+#define MSGLENGTHLIMIT      4096  /* upper bound for the configured maximum */
 
-
-
-#define MSGELEMENTLENGTH    88    /* 80 + cr/lf + padding to dword boundary */
-#define MSGBUFFERELEMENTS   20
-
-
-typedef char msgelement[MSGELEMENTLENGTH];
+#define MSGBUFFER_EMPTY     -1
+#define MSGBUFFER_TOOLONG   -2
 
 
 typedef struct msgbuffer {
     sem_t  semaccess;
+    char * data;
+    int size;
+    int used;
     int readindex;
     int writeindex;
-    msgelement element[MSGBUFFERELEMENTS];
+    int sent;          /* bytes of the first message already consumed */
 } msgbuffer;
 
 
@@ -84,10 +108,17 @@ extern "C" {
 #endif
 
 
-msgbuffer * newmsgbuffer (void);
+msgbuffer * newmsgbuffer (int size);
 void destroymsgbuffer (msgbuffer * buf);
-int putmsg (msgbuffer * buf, const char * msg);
-int getmsg (msgbuffer * buf, char * msg, int length);
+void initmsgbuffer (msgbuffer * buf, char * data, int size);
+void cleanupmsgbuffer (msgbuffer * buf);
+int movemsgbuffer (msgbuffer * buf, char * data, int size);
+int putmsg (msgbuffer * buf, const char * msg, int length,
+            unsigned int stamp);
+int getmsg (msgbuffer * buf, char * msg, int length, unsigned int * stamp);
+int peekmsgs (msgbuffer * buf, struct iovec * iov, int maxiov);
+int consumemsgs (msgbuffer * buf, int length, unsigned int * stamp);
+unsigned int msgstamp (const struct timespec * ts);
 
 
 #ifdef __cplusplus
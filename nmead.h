@@ -54,7 +54,20 @@
 
 #include <stdio.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <poll.h>
 #include "msgbuffer.h"
+#include "stream.h"
+#include "nmeashm.h"
+#include "zcsend.h"
+#include "uring.h"
+#include "stats.h"
+#include "log.h"
+#include "ais.h"
+#include "framer.h"
+#include "position.h"
+#include "aistrack.h"
+#include "relay.h"
 
 
 #ifndef TRUE
@@ -68,87 +81,336 @@
    program. */
 #define BUFSZ     (1024)
 
+/* Largest number of CPUs that can be named on the command line */
+#define MAXCPUS   64
+
+/* Thread stack size once memory is locked.  The small profile (make
+   PROFILE=small, for boards with little memory) always gives threads a
+   small stack; none needs more than about 20k. */
+#define LOCKEDSTACKSIZE   (256 * 1024)
+#define SMALLSTACKSIZE    (64 * 1024)
+
 
 /* Connection structure definitions.
 *
-*  Each listener thread has an associated connection structure, which is
-*  a wrapper around a message queue and a pointer to allow the connection
-*  structure to be part of a linked list.
+*  Each listener application has an associated connection structure,
+*  which is a wrapper around a message queue and a pointer to allow the
+*  connection structure to be part of a linked list.
+*
+*  Connections are sharded across a fixed set of worker threads.  Each
+*  connection belongs to exactly one worker, which alone fills its
+*  message queue from the shared sentence stream and writes the queue to
+*  the socket as fast as the listener will take it.  A slow listener
+*  overflows only its own queue.
+*
+*  The connection manager keeps the set of all active connections for
+*  accounting, and provides synchronized access for adding and removing
+*  them.
+*
+*  Connection structures, together with their message buffers, are
+*  carved from a pool of cache-line aligned slots owned by the connection
+*  manager.  The pool is sized once at startup, so connecting and
+*  disconnecting does not touch the heap.
 *
-*  Each listener has unrestricted access to its corresponding
-*  connection structure so that it can access the message queue at its
-*  own speed.  The listener is responsible for creating and destroying
-*  its connection structure.
+*  Each slot holds a small queue.  A client that falls behind has its
+*  queue moved to the heap and doubled as often as needed, up to the cap
+*  for its class and within a budget shared by all connections; once it
+*  has kept up for QUEUESHRINKDELAY seconds the queue moves back into the
+*  slot.
 *
-*  The talker accesses the connection structures only through the parent
-*  connections manager, which provides synchronized access for adding and
-*  removing connection structures (by listeners) as well as distributing
-*  NMEA sentences (by the talker) to each active connection.
+*  Every record of the stream has a sequence number.  A client that comes
+*  back after losing its connection may ask for the records it missed;
+*  they are replayed from the stream, as far as it still holds them,
+*  before the client rejoins the live feed.
 */
+#define CMDLINESIZE     128       /* longest command line from a client */
+
+/* What a connection speaks.  Connections from the HTTP port start in
+*  PROTO_HTTP, receiving nothing until the request has been answered. */
+#define PROTO_RAW         0
+#define PROTO_HTTP        1
+#define PROTO_WEBSOCKET   2
+#define PROTO_SSE         3
+
+#define WSHEADERMAX       4        /* WebSocket header, up to 64k payload */
+#define SSEHEADERMAX      8        /* "data: " and the blank line */
+#define TAGHEADERMAX      40       /* TAG block, or SEQ sentence after a
+                                      frame, with a sequence number */
+
+/* Priority classes.  Workers serve high-priority connections, such as an
+   autopilot, before any others, and each class has its own queue size. */
+#define PRIORITY_HIGH     0
+#define PRIORITY_NORMAL   1
+#define NPRIORITIES       2
+
+struct connectionmgr_struct;
+struct worker_struct;
+
 typedef struct connection_struct {
     msgbuffer * msgbuffer;
     struct connection_struct * next;
+    struct connectionmgr_struct * cmgr;
+    struct worker_struct * worker;         /* owning worker */
+    struct connection_struct * handoff;    /* pending adoption by worker */
+    int socketfd;
+    int waitevents;                /* poll events the flush is waiting on */
+    int local;                     /* Unix domain socket */
+    int packet;                    /* SOCK_SEQPACKET: one sentence per send */
+    int priority;                  /* PRIORITY_ class */
+    int mayhigh;                   /* accepted on the high-priority port
+                                      or the Unix domain socket */
+    int types;                     /* FRAME_ bits the client receives */
+    int cmdlength;
+    char cmd[CMDLINESIZE];         /* partial command line from the client */
+    int protocol;                  /* PROTO_ framing of what is sent */
+    int httpflags;                 /* request headers seen so far */
+    char wskey[32];                /* Sec-WebSocket-Key of the request */
+    aisarea_t area;                /* AIS targets the client receives */
+    unsigned int * snapshot;       /* targets still to be described, or
+                                      NULL */
+    int nsnapshot;
+    int snapshotnext;
+    int tagged;                    /* sentences carry their sequence
+                                      numbers in TAG blocks */
+    int replaying;                 /* sent the records from replayseq
+                                      instead of the live feed */
+    unsigned long replayseq;
+    zcsender_t * zc;               /* NULL unless sending with zerocopy */
+    char * heapdata;               /* grown queue storage, or NULL */
+    long lagged;                   /* when the client last fell behind */
+    unsigned long dropped;
 } connection_t;
 
 
 
+/* Worker structure definitions.
+*
+*  A worker thread runs an event loop over the connections assigned to
+*  it.  The talker publishes each sentence once to the shared stream and
+*  wakes sleeping workers through their wake pipes; each worker then
+*  pulls the new records from its own cursor and queues them for its
+*  connections.  The workers serve every channel, keeping a cursor in
+*  each channel's stream.  New connections are handed to a worker through its
+*  handoff list, or, with SO_REUSEPORT, accepted by the worker itself on
+*  its own listening socket.
+*/
+#define MAXCHANNELS     8
+
+typedef struct worker_struct {
+    int id;
+    pthread_t thread;
+    struct connectionmgr_struct * cmgr;
+    int wakefd[2];
+    volatile int sleeping;
+    int reprioritize;              /* a connection has changed class */
+    int backlogs;                  /* snapshots and replays not waiting
+                                      for a client */
+    long now;                      /* CLOCK_MONOTONIC seconds, per pass */
+    int listenfd;                  /* own SO_REUSEPORT socket, or -1 */
+    int cpu;                       /* CPU to be pinned to, or -1 */
+    unsigned long cursor[MAXCHANNELS];  /* next record, by channel */
+    unsigned long dropped;         /* queue overflows, all connections */
+    latency_t dispatch;            /* publish to fan-out */
+    latency_t delivery[NPRIORITIES];  /* first byte read to socket write */
+    sem_t semhandoff;
+    connection_t * handoff;
+    int nconn;
+    int nhigh;                     /* conn[0..nhigh) are high priority */
+    connection_t ** conn;          /* maxconn entries */
+    struct pollfd * pfd;           /* maxconn + 2 entries */
+    uring_t * uring;               /* NULL unless writing with io_uring */
+    struct iovec * iov;            /* IOVMAX per connection, with uring */
+    long * submitted;              /* bytes in flight, by connection */
+    int * result;                  /* their outcome, by connection */
+} worker_t;
+
+
+
 /* Connection manager structure definitions.
 *
 *  The connection manager provides synchronized access to the set of
-*  active connection structures.  This synchronized access allows
-*  connection structures to be added and removed by listener threads,
-*  and it allows the talker thread to distribute data to all of the
-*  listeners.
+*  active connection structures, and owns the connection pool, the
+*  shared sentence stream and the worker threads.
 */
 #define MAXCONNECTIONS  20
+#define CACHELINESIZE   64
+#define QUEUESHRINKDELAY 10        /* seconds without lag before shrinking */
 
 #define TOO_MANY_CONNECTIONS  -2
 #define ADDCONNECTION_ERROR   -1
 
-typedef struct {
+typedef struct connectionmgr_struct {
     connection_t * head;
     int nconn;
+    int maxconn;
     int nextqnum;
     sem_t semaccess;
+    char * pool;                   /* maxconn slots of poolstride bytes */
+    size_t poolstride;
+    int initialsize;               /* queue bytes held in each slot */
+    int buffersize[NPRIORITIES];   /* largest queue, by class */
+    long budget;                   /* limit on the queues' total size */
+    volatile long queuebytes;      /* the queues' total size */
+    void * freelist;
+    sem_t sempool;
+    stream_t * stream;
+    nmeashm_t * shm;               /* shared-memory ring, or NULL */
+    aistrack_t * track;            /* AIS targets heard, or NULL */
+    int snapshot;                  /* new clients are sent the targets */
+    int types;                     /* FRAME_ bits for new connections */
+    int index;                     /* the channel's number */
+    struct connectionmgr_struct * next;   /* next channel */
+    int nworkers;
+    int nextworker;                /* round-robin assignment */
+    worker_t * worker;
 } connectionmgr_t;
 
 
 
+/* Epoch bundling.  A GNSS receiver sends a burst of sentences for each
+*  fix; with bundling the talker holds a burst back until the next fix's
+*  time field, a silence of epochgap msec or epochhold msec have passed,
+*  and releases it to the workers in one piece. */
+#define EPOCHTIMESIZE   16
+#define EPOCHHOLD       250       /* default msec an epoch is held at most */
+
 /* Talker info structure.
 *
 *  This structure is passed to the talker thread and includes the
 *  opened serial port device as well as the connection manager
-*  structure for disseminating NMEA sentences.
+*  structure for disseminating NMEA sentences.  A channel relaying
+*  another nmead has no serial port; its talker opens the relay source,
+*  and opens it again whenever it is lost.
 */
 typedef struct {
 
-    FILE * fp;
+    int fd;                        /* -1 while a relay source is down */
+    relay_t * relay;               /* NULL unless relaying */
+    framer_t * framer;
     connectionmgr_t * cmgr;
+    aisfilter_t * ais;             /* NULL unless AIS filtering is enabled */
+    posencoder_t * pos;            /* NULL unless the position stream is on */
+    int maxlength;
+    streamentry_t rx;              /* receive times of the current sentence */
+    latency_t latency;             /* first byte read to published */
+    int epochgap;                  /* msec of silence ending an epoch, or 0 */
+    int epochhold;                 /* msec an epoch is held at most */
+    int held;                      /* records published but not released */
+    unsigned long heldbytes;
+    char epochtime[EPOCHTIMESIZE]; /* time field of the current epoch */
+    struct timespec epochfirst;    /* first byte of the epoch read */
+    struct timespec lastread;      /* last read from the port returned */
     int zip;
     int tickinterval;
 
 }  talkerinfo_t;
 
 
+
+/* Channel structure.
+*
+*  A channel is one feed: a receiver, the talker reading it, and the
+*  connection manager and listening sockets of its clients.  All channels
+*  share the worker threads.  Settings a configuration file leaves out
+*  are taken from the command line.
+*/
+#define CHANNELNAMESIZE 32
+
+typedef struct channel_struct {
+    char name[CHANNELNAMESIZE];
+    char * input;                  /* serial device */
+    long baud;
+    int port;                      /* TCP port, or 0 */
+    int highport;                  /* high-priority TCP port, or 0 */
+    int httpport;                  /* WebSocket / event-stream port, or 0 */
+    char * localpath;              /* Unix domain socket, or NULL */
+    int localtype;
+    char * shmname;                /* shared-memory ring, or NULL */
+    int types;                     /* FRAME_ bits for new connections */
+    int maxconn;
+    int buffersize[NPRIORITIES];   /* largest queue, by class */
+    long budget;
+    int snapshot;                  /* new clients are sent the AIS targets */
+    int track;                     /* the AIS targets heard are kept */
+    int history;                   /* sentences kept for clients resuming */
+    talkerinfo_t talker;
+    pthread_t thread;
+    struct channel_struct * next;
+} channel_t;
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* Connection struct creation and destruction */
-connection_t * newconnection (void);
+connection_t * newconnection (connectionmgr_t * cmgr, int priority);
 void destroyconnection (connection_t * conn);
 
 
 /* Connection manager creation, destruction, and access */
-connectionmgr_t * newconnectionmgr (void);
+connectionmgr_t * newconnectionmgr (int maxconn, int initialsize,
+                                    const int * buffersize, int history);
 void destroyconnectionmgr (connectionmgr_t * cmgr);
 int addconnection (connectionmgr_t * cmgr, connection_t * conn);
 int removeconnection (connectionmgr_t * cmgr, connection_t * conn);
-int writetoconnections (connectionmgr_t * cmgr, const char * buffer);
+int resizeconnection (connection_t * conn, int size);
+int growconnection (connection_t * conn, int needed);
+int holdforconnections (connectionmgr_t * cmgr, const char * buffer,
+                        int length, const streamentry_t * info);
+void releasetoconnections (connectionmgr_t * cmgr);
+int writetoconnections (connectionmgr_t * cmgr, const char * buffer,
+                        int length, const streamentry_t * info);
+
+
+/* Worker threads */
+int startworkers (connectionmgr_t * cmgr, int nworkers, const int * cpus,
+                  int ncpus, int shareport);
+void assignconnection (connectionmgr_t * cmgr, connection_t * conn);
+void wakeworkers (connectionmgr_t * cmgr);
+
+
+/* Scheduling, affinity and memory locking */
+void initthreadattr (pthread_attr_t * attr);
+int setrealtime (pthread_attr_t * attr, int priority);
+int pinthread (pthread_t thread, int cpu);
+int parsecpulist (const char * list, int * cpus, int max);
+int lockmemory (void);
+
+
+/* Statistics reporting */
+void * reportstats (void * arg);
+void reportmemory (channel_t * channels, int nworkers, int nthreads);
+
+
+/* Channels */
+channel_t * newchannel (const channel_t * defaults, const char * name);
+channel_t * readchannels (const char * path, const channel_t * defaults);
 
 
 void * talk (void * arg);
-void multilisten (connectionmgr_t * ti);
+void multilisten (channel_t * channels);
+int openlistener (int port, int reuseport);
+int openlocallistener (const char * path, int type, int mode);
+connection_t * admitconnection (connectionmgr_t * cmgr, int wsd,
+                                int priority);
+
+
+/* Commands from clients */
+int clientinput (connection_t * conn, const char * data, int length);
+void clientcommand (connection_t * conn, char * line);
+int clientsend (connection_t * conn, const char * msg, int length);
+
+
+/* AIS snapshots */
+int startsnapshot (connection_t * conn, const aisarea_t * area);
+void sendsnapshot (connection_t * conn);
+
+
+/* HTTP endpoint */
+int httpinput (connection_t * conn, const char * data, int length);
+int wsencode (char * out, int type, const char * msg, int length);
+int sseencode (char * out, const char * msg, int length);
 
 
 #ifdef __cplusplus
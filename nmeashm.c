@@ -0,0 +1,519 @@
+/*
+* nmeashm.c
+*
+* NMEA Server Application
+*
+* The shared-memory sentence ring.  The server publishes every sentence
+* into a named POSIX shared-memory object; any number of local programs
+* map it read-only and read records by sequence number without system
+* calls, and without the server keeping any state for them.  A reader
+* that falls more than a ring's worth behind finds its records
+* overwritten and skips ahead, as the worker threads do with the
+* in-process stream.
+*
+* This file is self-contained so that it can be built into readers as
+* libnmeashm.a.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "nmeashm.h"
+
+
+/* Full memory barrier; the target toolchain predates C11 atomics. */
+#define barrier()   __sync_synchronize ()
+
+/* Offsets within the object are kept cache-line aligned */
+#define SHMALIGN(n)   (((n) + 63) & ~63U)
+
+/* Polling interval of nmeashmwait where futexes are not available */
+#define WAITPOLLNSEC  1000000
+
+
+
+
+/*
+* mapshm
+*
+* Sets up an nmeashm_t for a mapped object.
+*
+* Parameters:
+*     base    : void * : Start of the mapping.
+*     mapsize : size_t : Length of the mapping.
+*     writer  : int    : Nonzero for the server's mapping.
+*
+* Return Value:
+*     The function returns a pointer to a new nmeashm_t object, or NULL if
+*     it cannot be allocated; the mapping is released in that case.
+*
+* Remarks:
+*
+*/
+static nmeashm_t * mapshm (void * base, size_t mapsize, int writer)
+{
+    nmeashm_t * shm = (nmeashm_t *) calloc (1, sizeof (nmeashm_t));
+
+    if (shm == NULL) {
+        munmap (base, mapsize);
+        return NULL;
+    }
+
+    shm->header = (nmeashmheader_t *) base;
+    shm->entry = (nmeashmentry_t *) ((char *) base
+                                     + shm->header->entryoffset);
+    shm->data = (char *) base + shm->header->dataoffset;
+    shm->mapsize = mapsize;
+    shm->writer = writer;
+
+    return shm;
+}
+
+
+
+
+/*
+* nmeashmcreate
+*
+* Creates the shared-memory ring.
+*
+* Parameters:
+*     name     : const char *  : Name of the object, such as "/nmead".
+*     size     : unsigned int  : Bytes of sentence data retained.
+*     nentries : unsigned int  : Number of records retained.
+*     mode     : int           : Permissions of the object.
+*
+* Return Value:
+*     The function returns a pointer to a new nmeashm_t object, or NULL in
+*     the event of an error.
+*
+* Remarks:
+*     An object of the same name left by an earlier run is replaced;
+*     readers still mapping it see no further records and should reopen
+*     when writerpid changes.  The header's magic number is written last,
+*     so that a reader never accepts a half-initialized ring.
+*
+*/
+nmeashm_t * nmeashmcreate (const char * name, unsigned int size,
+                           unsigned int nentries, int mode)
+{
+    nmeashmheader_t * header;
+    nmeashmentry_t * entry;
+    unsigned int entryoffset, dataoffset, i;
+    size_t mapsize;
+    void * base;
+    int fd;
+
+    entryoffset = SHMALIGN (sizeof (nmeashmheader_t));
+    dataoffset = SHMALIGN (entryoffset + nentries * sizeof (nmeashmentry_t));
+    mapsize = dataoffset + size;
+
+    shm_unlink (name);
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd == -1)
+        return NULL;
+    fchmod (fd, mode);                /* not subject to the umask */
+
+    if (ftruncate (fd, mapsize) == -1) {
+        close (fd);
+        shm_unlink (name);
+        return NULL;
+    }
+    base = mmap (NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED) {
+        shm_unlink (name);
+        return NULL;
+    }
+
+    header = (nmeashmheader_t *) base;
+    header->version = NMEASHMVERSION;
+    header->size = size;
+    header->nentries = nentries;
+    header->entryoffset = entryoffset;
+    header->dataoffset = dataoffset;
+    header->writerpid = (unsigned int) getpid ();
+    header->headseq = 0;
+    header->headpos = 0;
+    header->reservepos = 0;
+
+    /* No entry may look valid for a sequence not yet published */
+    entry = (nmeashmentry_t *) ((char *) base + entryoffset);
+    for (i = 0; i < nentries; i++)
+        entry[i].seq = i + 1;
+
+    barrier ();
+    header->magic = NMEASHMMAGIC;
+
+    return mapshm (base, mapsize, 1);
+}
+
+
+
+
+/*
+* nmeashmpublish
+*
+* Appends a record to the shared-memory ring and wakes waiting readers.
+*
+* Parameters:
+*     shm          : nmeashm_t *             : The server's mapping.
+*     msg          : const char *            : The record's bytes.
+*     length       : int                     : Number of bytes.
+*     type         : int                     : Frame type of the record.
+*     received     : const struct timespec * : Receive time, CLOCK_REALTIME.
+*     receivedmono : const struct timespec * : The same, CLOCK_MONOTONIC.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Must only be called by the single writer of the ring.  A record
+*     longer than the ring is not published.  The wake-up costs one
+*     system call per record however many readers there are, since
+*     read-only readers cannot announce that they are waiting.
+*
+*/
+void nmeashmpublish (nmeashm_t * shm, const char * msg, int length,
+                     int type, const struct timespec * received,
+                     const struct timespec * receivedmono)
+{
+    nmeashmheader_t * h = shm->header;
+    unsigned int seq = h->headseq;
+    unsigned int pos = h->headpos;
+    unsigned int offset = pos % h->size;
+    unsigned int first = h->size - offset;
+    nmeashmentry_t * e = &shm->entry[seq % h->nentries];
+
+    if (length < 0 || (unsigned int) length > h->size)
+        return;
+
+    h->reservepos = pos + length;
+    e->seq = seq - 1;                   /* invalid while being rewritten */
+    barrier ();
+
+    if ((unsigned int) length <= first)
+        memcpy (shm->data + offset, msg, length);
+    else {
+        memcpy (shm->data + offset, msg, first);
+        memcpy (shm->data, msg + first, length - first);
+    }
+
+    e->pos = pos;
+    e->length = length;
+    e->type = (unsigned int) type;
+    e->rxsec = (unsigned int) received->tv_sec;
+    e->rxnsec = (unsigned int) received->tv_nsec;
+    e->monosec = (unsigned int) receivedmono->tv_sec;
+    e->mononsec = (unsigned int) receivedmono->tv_nsec;
+    barrier ();
+
+    e->seq = seq;
+    h->headpos = pos + length;
+    barrier ();
+    h->headseq = seq + 1;
+
+#ifdef __linux__
+    syscall (SYS_futex, &h->headseq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+
+    return;
+}
+
+
+
+
+/*
+* nmeashmopen
+*
+* Maps the shared-memory ring of a running server for reading.
+*
+* Parameters:
+*     name : const char * : Name of the object, as given to the server.
+*
+* Return Value:
+*     The function returns a pointer to a new nmeashm_t object, or NULL in
+*     the event of an error (errno is EINVAL if the object is not a
+*     sentence ring of this version, or is still being set up).
+*
+* Remarks:
+*     Readers typically start from nmeashmhead and read each sequence
+*     number in turn.
+*
+*/
+nmeashm_t * nmeashmopen (const char * name)
+{
+    nmeashmheader_t * h;
+    struct stat st;
+    void * base;
+    int fd;
+
+    fd = shm_open (name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat (fd, &st) == -1
+            || (size_t) st.st_size < sizeof (nmeashmheader_t)) {
+        close (fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    h = (nmeashmheader_t *) base;
+    if (h->magic != NMEASHMMAGIC || h->version != NMEASHMVERSION
+            || h->size == 0 || h->nentries == 0
+            || h->entryoffset + (size_t) h->nentries * sizeof (nmeashmentry_t)
+               > h->dataoffset
+            || (size_t) h->dataoffset + h->size > (size_t) st.st_size) {
+        munmap (base, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return mapshm (base, st.st_size, 0);
+}
+
+
+
+
+/*
+* nmeashmhead
+*
+* Returns the sequence number the next published record will receive.
+*
+* Parameters:
+*     shm : nmeashm_t * : The mapping.
+*
+* Return Value:
+*     The function returns the head sequence number.
+*
+* Remarks:
+*
+*/
+unsigned int nmeashmhead (nmeashm_t * shm)
+{
+    return shm->header->headseq;
+}
+
+
+
+
+/*
+* nmeashmread
+*
+* Copies a record out of the ring.
+*
+* Parameters:
+*     shm    : nmeashm_t *     : The mapping.
+*     seq    : unsigned int    : Sequence number of the record.
+*     buf    : char *          : Destination of the copy.
+*     length : int             : Number of bytes available at buf.
+*     info   : nmeashminfo_t * : Receives the record's type and receive
+*                                times, or NULL.
+*
+* Return Value:
+*     The function returns the length of the record if successful,
+*     NMEASHM_EMPTY if the record has not been published yet, NMEASHM_LOST
+*     if it has already been overwritten, or NMEASHM_TOOLONG if it does
+*     not fit in buf.
+*
+* Remarks:
+*     Makes no system calls and writes nothing to the shared object.
+*
+*/
+int nmeashmread (nmeashm_t * shm, unsigned int seq, char * buf, int length,
+                 nmeashminfo_t * info)
+{
+    nmeashmheader_t * h = shm->header;
+    nmeashmentry_t * e = &shm->entry[seq % h->nentries];
+    nmeashmentry_t copy;
+    unsigned int offset, first, n;
+
+    if ((int) (seq - h->headseq) >= 0)
+        return NMEASHM_EMPTY;
+    barrier ();
+
+    if (e->seq != seq)
+        return NMEASHM_LOST;
+    barrier ();
+    copy = *e;
+    barrier ();
+    n = copy.length;
+    if (e->seq != seq || n > h->size)
+        return NMEASHM_LOST;
+    if (length < 0 || n > (unsigned int) length)
+        return NMEASHM_TOOLONG;
+
+    offset = copy.pos % h->size;
+    first = h->size - offset;
+    if (n <= first)
+        memcpy (buf, shm->data + offset, n);
+    else {
+        memcpy (buf, shm->data + offset, first);
+        memcpy (buf + first, shm->data, n - first);
+    }
+    barrier ();
+
+    /* The copy is good only if the server has not since reserved the
+       space the record occupied. */
+    if (h->reservepos - copy.pos > h->size)
+        return NMEASHM_LOST;
+
+    if (info != NULL) {
+        info->type = (int) copy.type;
+        info->received.tv_sec = copy.rxsec;
+        info->received.tv_nsec = copy.rxnsec;
+        info->receivedmono.tv_sec = copy.monosec;
+        info->receivedmono.tv_nsec = copy.mononsec;
+    }
+
+    return (int) n;
+}
+
+
+
+
+/*
+* nmeashmwait
+*
+* Waits for the record with the given sequence number to be published.
+*
+* Parameters:
+*     shm     : nmeashm_t *  : The mapping.
+*     seq     : unsigned int : Sequence number of the record awaited.
+*     timeout : int          : Longest wait in milliseconds, or -1 to
+*                              wait indefinitely.
+*
+* Return Value:
+*     The function returns 1 if the record has been published, or 0 if
+*     the wait timed out.
+*
+* Remarks:
+*     Sleeps on a futex on Linux; elsewhere the head is polled every
+*     millisecond.  Readers that prefer to spin simply call nmeashmread
+*     until it stops returning NMEASHM_EMPTY.
+*
+*/
+int nmeashmwait (nmeashm_t * shm, unsigned int seq, int timeout)
+{
+    volatile unsigned int * head = &shm->header->headseq;
+    struct timespec now, deadline, remaining;
+    unsigned int h;
+
+    clock_gettime (CLOCK_MONOTONIC, &deadline);
+    if (timeout >= 0) {
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    while ((int) (seq - (h = *head)) >= 0) {
+        if (timeout >= 0) {
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000;
+            }
+            if (remaining.tv_sec < 0)
+                return 0;
+        }
+#ifdef __linux__
+        syscall (SYS_futex, head, FUTEX_WAIT, h,
+                 timeout >= 0 ? &remaining : NULL, NULL, 0);
+#else
+        remaining.tv_sec = 0;
+        remaining.tv_nsec = WAITPOLLNSEC;
+        nanosleep (&remaining, NULL);
+#endif
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+* nmeashmclose
+*
+* Unmaps the ring.
+*
+* Parameters:
+*     shm : nmeashm_t * : The mapping, which is destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The object itself persists until the server replaces it.
+*
+*/
+void nmeashmclose (nmeashm_t * shm)
+{
+    munmap (shm->header, shm->mapsize);
+    free (shm);
+
+    return;
+}
@@ -0,0 +1,159 @@
+/*
+* nmeashm.h
+*
+* NMEA Server Application
+*
+* Layout of the shared-memory sentence ring and the functions with which
+* the server publishes into it and local programs read from it.  Readers
+* need only this header and nmeashm.c (or libnmeashm.a).
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef NMEASHM_H
+#define NMEASHM_H
+
+#include <time.h>
+
+
+#define NMEASHMMAGIC      0x4e4d4541   /* "NMEA" */
+#define NMEASHMVERSION    1
+
+#ifdef NMEAD_SMALL
+#define NMEASHMSIZE       16384   /* default bytes of sentence data */
+#define NMEASHMENTRIES    256     /* default sentences indexed */
+#else
+#define NMEASHMSIZE       65536   /* default bytes of sentence data */
+#define NMEASHMENTRIES    1024    /* default sentences indexed */
+#endif
+
+#define NMEASHM_EMPTY     -1      /* the record has not been published */
+#define NMEASHM_LOST      -2      /* the record has been overwritten */
+#define NMEASHM_TOOLONG   -3      /* the record does not fit the buffer */
+
+
+/* The shared object starts with this header, followed by the entry index
+   and the data ring.  Only the server writes to it; readers map it
+   read-only.  All counters are 32 bits wide, so that 32- and 64-bit
+   readers agree on the layout, and compare modulo 2^32.
+
+   Each entry works as a sequence lock: the server sets its seq to an
+   invalid value while rewriting it and to the record's sequence number
+   once it is complete.  A reader that sees the same seq before and after
+   copying an entry, and finds afterwards that reservepos has not moved
+   a ring's length past the record, holds a consistent copy.
+
+   headseq is also the futex word on which readers wait; the server
+   wakes it after each record. */
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int size;                   /* data bytes */
+    unsigned int nentries;
+    unsigned int entryoffset;            /* from the start of the object */
+    unsigned int dataoffset;
+    unsigned int writerpid;
+    volatile unsigned int headseq;       /* sequence of next record */
+    volatile unsigned int headpos;
+    volatile unsigned int reservepos;
+} nmeashmheader_t;
+
+typedef struct {
+    volatile unsigned int seq;
+    unsigned int pos;
+    unsigned int length;
+    unsigned int rxsec;                  /* first byte read, CLOCK_REALTIME */
+    unsigned int rxnsec;
+    unsigned int monosec;                /* the same, CLOCK_MONOTONIC */
+    unsigned int mononsec;
+    unsigned int type;                   /* 1 NMEA, 2 UBX, 4 RTCM3 */
+} nmeashmentry_t;
+
+
+/* A mapping of the ring, by the server or by a reader. */
+typedef struct {
+    nmeashmheader_t * header;
+    nmeashmentry_t * entry;
+    char * data;
+    size_t mapsize;
+    int writer;
+} nmeashm_t;
+
+
+/* Receive times of a record, as returned to readers. */
+typedef struct {
+    int type;                            /* as in nmeashmentry_t */
+    struct timespec received;            /* CLOCK_REALTIME */
+    struct timespec receivedmono;        /* CLOCK_MONOTONIC */
+} nmeashminfo_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Server side */
+nmeashm_t * nmeashmcreate (const char * name, unsigned int size,
+                           unsigned int nentries, int mode);
+void nmeashmpublish (nmeashm_t * shm, const char * msg, int length,
+                     int type, const struct timespec * received,
+                     const struct timespec * receivedmono);
+
+/* Reader side */
+nmeashm_t * nmeashmopen (const char * name);
+unsigned int nmeashmhead (nmeashm_t * shm);
+int nmeashmread (nmeashm_t * shm, unsigned int seq, char * buf, int length,
+                 nmeashminfo_t * info);
+int nmeashmwait (nmeashm_t * shm, unsigned int seq, int timeout);
+
+void nmeashmclose (nmeashm_t * shm);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* NMEASHM_H */
@@ -0,0 +1,441 @@
+/*
+* position.c
+*
+* NMEA Server Application
+*
+* The position encoder.  From the GGA and RMC sentences of each fix it
+* builds one small binary record: the fix in fixed point, sent as the
+* change since the previous record, with a full keyframe every few
+* records.  At one fix a second a delta record is around 15 bytes,
+* against 150 or so for the two sentences it replaces.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nmead.h"
+#include "position.h"
+
+
+#define POS_GGA      0x01
+#define POS_RMC      0x02
+
+#define FIELDSIZE    24
+
+#define CMPERKNOT    51.4444
+
+
+extern int verbose;
+
+
+
+
+/*
+* newposencoder
+*
+* Allocates a position encoder.
+*
+* Parameters:
+*     keyinterval : int : Records from one keyframe to the next.
+*
+* Return Value:
+*     The function returns a pointer to the new object, or NULL if it
+*     cannot be allocated.
+*
+* Remarks:
+*
+*/
+posencoder_t * newposencoder (int keyinterval)
+{
+    posencoder_t * pe = (posencoder_t *) calloc (1, sizeof (posencoder_t));
+
+    if (pe == NULL)
+        return NULL;
+
+    pe->fix.time = -1;
+    pe->keyinterval = (keyinterval > 0) ? keyinterval : POSKEYINTERVAL;
+
+    return pe;
+}
+
+
+
+
+/*
+* destroyposencoder
+*
+* Destroys a position encoder.
+*
+* Parameters:
+*     pe : posencoder_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroyposencoder (posencoder_t * pe)
+{
+    free (pe);
+
+    return;
+}
+
+
+
+
+/*
+* sentencefield
+*
+* Copies one comma-separated field of a sentence.
+*
+* Parameters:
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*     n      : int          : The field; the address field is 0.
+*     field  : char *       : Receives the zero-terminated field; at least
+*                             FIELDSIZE bytes.
+*
+* Return Value:
+*     The function returns the length of the field, zero if it is empty
+*     or missing.
+*
+* Remarks:
+*     Overlong fields are truncated.
+*
+*/
+static int sentencefield (const char * msg, int length, int n, char * field)
+{
+    int i, k;
+
+    for (i = 0; i < length && n > 0; i++)
+        if (msg[i] == ',')
+            n--;
+
+    for (k = 0; i < length && k < FIELDSIZE - 1; i++, k++) {
+        if (msg[i] == ',' || msg[i] == '*' || msg[i] == '\r'
+          || msg[i] == '\n')
+            break;
+        field[k] = msg[i];
+    }
+    field[k] = '\0';
+
+    return k;
+}
+
+
+
+
+/*
+* parsetime
+*
+* Converts an hhmmss.sss time field to milliseconds since midnight.
+*
+* Parameters:
+*     field : const char * : The field.
+*
+* Return Value:
+*     The function returns the time, or -1 if the field is not a time.
+*
+* Remarks:
+*
+*/
+static long parsetime (const char * field)
+{
+    double seconds;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        if (field[i] < '0' || field[i] > '9')
+            return -1;
+
+    seconds = atof (field + 4);
+
+    return ((field[0] - '0') * 10 + (field[1] - '0')) * 3600000L
+         + ((field[2] - '0') * 10 + (field[3] - '0')) * 60000L
+         + (long) (seconds * 1000.0 + 0.5);
+}
+
+
+
+
+/*
+* parsecoord
+*
+* Converts a latitude or longitude field to 1e-7 degree.
+*
+* Parameters:
+*     field      : const char * : The field, ddmm.mmmm or dddmm.mmmm.
+*     hemisphere : const char * : The following N, S, E or W field.
+*     degdigits  : int          : 2 for latitude, 3 for longitude.
+*     value      : long *       : Receives the coordinate.
+*
+* Return Value:
+*     The function returns zero, or -1 if the fields are empty or
+*     malformed; value is then left alone.
+*
+* Remarks:
+*
+*/
+static int parsecoord (const char * field, const char * hemisphere,
+                       int degdigits, long * value)
+{
+    double minutes;
+    long degrees = 0;
+    int i;
+
+    if ((int) strlen (field) < degdigits + 2)
+        return -1;
+    for (i = 0; i < degdigits; i++) {
+        if (field[i] < '0' || field[i] > '9')
+            return -1;
+        degrees = degrees * 10 + (field[i] - '0');
+    }
+    minutes = atof (field + degdigits);
+
+    *value = degrees * 10000000L + (long) (minutes * 1e7 / 60.0 + 0.5);
+    if (hemisphere[0] == 'S' || hemisphere[0] == 'W')
+        *value = -*value;
+
+    return 0;
+}
+
+
+
+
+/*
+* putvarint
+*
+* Appends the zigzag varint encoding of a change.
+*
+* Parameters:
+*     out  : unsigned char * : Where the encoding goes.
+*     from : long            : The previous value.
+*     to   : long            : The new value.
+*
+* Return Value:
+*     The function returns the number of bytes written, at most 5.
+*
+* Remarks:
+*     The change is taken modulo 2^32, so it always fits.
+*
+*/
+static int putvarint (unsigned char * out, long from, long to)
+{
+    unsigned int d = (unsigned int) to - (unsigned int) from;
+    unsigned int z = (d << 1) ^ (0u - (d >> 31));
+    int n = 0;
+
+    while (z >= 0x80) {
+        out[n++] = (unsigned char) (z | 0x80);
+        z >>= 7;
+    }
+    out[n++] = (unsigned char) z;
+
+    return n;
+}
+
+
+
+
+/*
+* emitfix
+*
+* Encodes the fix being assembled as a record.
+*
+* Parameters:
+*     pe  : posencoder_t * : The encoder.
+*     out : char *         : Receives the record; at least POSMAXLENGTH
+*                            bytes.
+*
+* Return Value:
+*     The function returns the length of the record.
+*
+* Remarks:
+*
+*/
+static int emitfix (posencoder_t * pe, char * out)
+{
+    static const posfix_t zero;
+    unsigned char * b = (unsigned char * ) out;
+    const posfix_t * from;
+    unsigned char cka = 0, ckb = 0;
+    int n, i;
+
+    if (pe->sincekey == 0) {
+        b[0] = POSKEYSYNC;
+        from = &zero;
+    } else {
+        b[0] = POSDELTASYNC;
+        from = &pe->last;
+    }
+    b[1] = (unsigned char) pe->sequence;
+
+    n = POSHEADER;
+    n += putvarint (b + n, from->time, pe->fix.time);
+    n += putvarint (b + n, from->lat, pe->fix.lat);
+    n += putvarint (b + n, from->lon, pe->fix.lon);
+    n += putvarint (b + n, from->alt, pe->fix.alt);
+    n += putvarint (b + n, from->speed, pe->fix.speed);
+    n += putvarint (b + n, from->course, pe->fix.course);
+    n += putvarint (b + n, from->quality, pe->fix.quality);
+    n += putvarint (b + n, from->sats, pe->fix.sats);
+    b[2] = (unsigned char) (n - POSHEADER);
+
+    for (i = 1; i < n; i++) {
+        cka += b[i];
+        ckb += cka;
+    }
+    b[n++] = cka;
+    b[n++] = ckb;
+
+    pe->last = pe->fix;
+    pe->sequence = (pe->sequence + 1) & 0xff;
+    if (++pe->sincekey >= pe->keyinterval)
+        pe->sincekey = 0;
+    pe->pending = FALSE;
+
+    return n;
+}
+
+
+
+
+/*
+* posencode
+*
+* Takes in one NMEA sentence, and encodes a fix once it is complete.
+*
+* Parameters:
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*     out    : char *       : Receives a record; at least POSMAXLENGTH
+*                             bytes.
+*
+* Return Value:
+*     The function returns the length of the record in out, or zero if
+*     there is none yet.
+*
+* Remarks:
+*     Sentences other than GGA and RMC are ignored.  A fix is sent when
+*     both have been seen for its time, or, from a receiver that sends
+*     only one of them, when the next fix's time arrives.  Fields a
+*     sentence leaves empty keep their previous values.  TAG blocks in
+*     front of a sentence are skipped.
+*
+*/
+int posencode (posencoder_t * pe, const char * msg, int length, char * out)
+{
+    char field[FIELDSIZE], hemisphere[FIELDSIZE];
+    int kind, skip, n = 0;
+    long time;
+
+    skip = skiptags (msg, length);
+    msg += skip;
+    length -= skip;
+    if (length < 7 || msg[0] != '$')
+        return 0;
+    if (memcmp (msg + 3, "GGA", 3) == 0)
+        kind = POS_GGA;
+    else if (memcmp (msg + 3, "RMC", 3) == 0)
+        kind = POS_RMC;
+    else
+        return 0;
+
+    sentencefield (msg, length, 1, field);
+    time = parsetime (field);
+    if (time < 0)
+        return 0;
+
+    if (time != pe->fix.time) {
+        if (pe->pending)
+            n = emitfix (pe, out);
+        pe->fix.time = time;
+        pe->have = 0;
+    }
+    else if (pe->have & kind)
+        return 0;                       /* repeated sentence */
+
+    if (kind == POS_GGA) {
+        sentencefield (msg, length, 3, hemisphere);
+        if (sentencefield (msg, length, 2, field) > 0)
+            parsecoord (field, hemisphere, 2, &pe->fix.lat);
+        sentencefield (msg, length, 5, hemisphere);
+        if (sentencefield (msg, length, 4, field) > 0)
+            parsecoord (field, hemisphere, 3, &pe->fix.lon);
+        if (sentencefield (msg, length, 6, field) > 0)
+            pe->fix.quality = atol (field);
+        if (sentencefield (msg, length, 7, field) > 0)
+            pe->fix.sats = atol (field);
+        if (sentencefield (msg, length, 9, field) > 0)
+            pe->fix.alt = (long) (atof (field) * 100.0
+                                  + (field[0] == '-' ? -0.5 : 0.5));
+    } else {
+        sentencefield (msg, length, 4, hemisphere);
+        if (sentencefield (msg, length, 3, field) > 0)
+            parsecoord (field, hemisphere, 2, &pe->fix.lat);
+        sentencefield (msg, length, 6, hemisphere);
+        if (sentencefield (msg, length, 5, field) > 0)
+            parsecoord (field, hemisphere, 3, &pe->fix.lon);
+        if (sentencefield (msg, length, 7, field) > 0)
+            pe->fix.speed = (long) (atof (field) * CMPERKNOT + 0.5);
+        if (sentencefield (msg, length, 8, field) > 0)
+            pe->fix.course = (long) (atof (field) * 100.0 + 0.5);
+    }
+
+    pe->have |= kind;
+    pe->pending = TRUE;
+
+    if (n == 0 && pe->have == (POS_GGA | POS_RMC))
+        n = emitfix (pe, out);
+
+    if (verbose >= 200 && n > 0)
+        LOG (out[0] == (char) POSKEYSYNC
+               ? "position: key record of %ld bytes\n"
+               : "position: delta record of %ld bytes\n", n);
+
+    return n;
+}
@@ -0,0 +1,119 @@
+/*
+* position.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the position encoder, which
+* condenses the receiver's GGA and RMC sentences into a compact binary
+* stream for listeners on slow links.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef POSITION_H
+#define POSITION_H
+
+
+/* Record layout.  Every record is
+
+       sync  sequence  length  payload...  ck_a  ck_b
+
+   sync is POSKEYSYNC for a keyframe or POSDELTASYNC for a delta;
+   sequence counts records modulo 256; length is the number of payload
+   bytes; the checksum is the UBX one, over sequence, length and payload.
+   The payload holds the POSFIELDS fields of posfix_t in order, each as
+   a zigzag-encoded base-128 varint (least significant group first).  A
+   keyframe carries the values themselves, a delta their change since the
+   previous record.  A listener that joins, or misses a sequence number,
+   waits for the next keyframe. */
+#define POSKEYSYNC      0xa5
+#define POSDELTASYNC    0xa6
+#define POSHEADER       3
+#define POSOVERHEAD     5         /* header and checksum */
+#define POSFIELDS       8
+#define POSMAXLENGTH    (POSOVERHEAD + POSFIELDS * 5)
+
+#define POSKEYINTERVAL  10        /* default records per keyframe */
+
+
+/* One fix, in fixed point */
+typedef struct {
+    long time;                     /* msec since midnight, UTC */
+    long lat;                      /* 1e-7 degree, north positive */
+    long lon;                      /* 1e-7 degree, east positive */
+    long alt;                      /* cm above mean sea level */
+    long speed;                    /* cm/s over ground */
+    long course;                   /* 0.01 degree, true */
+    long quality;                  /* GGA fix quality, 0 without a fix */
+    long sats;                     /* satellites used */
+} posfix_t;
+
+
+typedef struct {
+    posfix_t fix;                  /* the fix being assembled */
+    int have;                      /* sentences seen for fix.time */
+    int pending;                   /* fix holds something not yet sent */
+    posfix_t last;                 /* the fix last sent */
+    int sequence;
+    int keyinterval;
+    int sincekey;                  /* records since the last keyframe */
+} posencoder_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+posencoder_t * newposencoder (int keyinterval);
+void destroyposencoder (posencoder_t * pe);
+int posencode (posencoder_t * pe, const char * msg, int length, char * out);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* POSITION_H */
@@ -0,0 +1,93 @@
+/*
+* probes.h
+*
+* NMEA Server Application
+*
+* Static tracepoints.  Built with HAVE_SYS_SDT_H (make SDT=1) each probe
+* is a USDT probe of provider nmead, a single no-op instruction until a
+* tracer such as bpftrace or perf attaches to it; otherwise the probes
+* compile to nothing.
+*
+*     frame      (type, length, stamp)        talker framed a record
+*     enqueue    (queue, length, stamp)       putmsg stored a message
+*     full       (queue, length, stamp)       putmsg found the queue full
+*     drop       (fd, length, stamp)          a connection lost a record
+*     dequeue    (queue, length, stamp)       getmsg or consumemsgs
+*                                             removed a message
+*     send       (fd, bytes, stamp)           a write to a client
+*                                             completed; stamp is that of
+*                                             the first message finished
+*     connect    (fd, priority, nconn)        addconnection
+*     disconnect (fd, dropped, nconn)         removeconnection
+*
+* queue is the address of the connection's msgbuffer; stamp is the
+* receive stamp of the record (msgstamp: CLOCK_MONOTONIC microseconds,
+* modulo 2^32), so that latency can be computed from any pair of probes.
+* For example:
+*
+*     bpftrace -e 'usdt:./nmead:nmead:send { @bytes = hist(arg1); }'
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROBE3(name, a, b, c) \
+    DTRACE_PROBE3 (nmead, name, a, b, c)
+
+#else
+
+#define PROBE3(name, a, b, c) \
+    do { } while (0)
+
+#endif
+
+
+#endif  /* PROBES_H */
@@ -0,0 +1,465 @@
+/*
+* relay.c
+*
+* NMEA Server Application
+*
+* Relay sources.  To spread clients over several sites, an nmead can take
+* its sentences from another nmead rather than from a receiver, and serve
+* them again to clients of its own.  Over TCP the relay asks the upstream
+* for sequence numbers, and after a lost connection reconnects, backing
+* off, and resumes where it stopped, so its clients see no gap as long as
+* the upstream still holds what was missed.  A UDP source, multicast or
+* not, is simply read; nothing missed can be asked for again.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "nmead.h"
+#include "relay.h"
+
+
+extern int verbose;
+
+
+
+
+/*
+* isrelay
+*
+* Tells whether a channel input names a relay source.
+*
+* Parameters:
+*     input : const char * : The input, as given with -i or in a
+*                            configuration file.
+*
+* Return Value:
+*     The function returns TRUE if input starts with tcp: or udp:.
+*
+* Remarks:
+*
+*/
+int isrelay (const char * input)
+{
+    return strncmp (input, "tcp:", 4) == 0 || strncmp (input, "udp:", 4) == 0;
+}
+
+
+
+
+/*
+* newrelay
+*
+* Allocates and initializes a relay source.
+*
+* Parameters:
+*     input : const char * : tcp:host:port or udp:address:port.  An IPv6
+*                            host is written in brackets.
+*
+* Return Value:
+*     The function returns a pointer to a new relay_t object, or NULL if
+*     input cannot be parsed or memory is short.
+*
+* Remarks:
+*     Nothing is opened until relayopen.
+*
+*/
+relay_t * newrelay (const char * input)
+{
+    relay_t * r;
+    const char * host, * colon;
+    int hostlength;
+
+    if (!isrelay (input))
+        return NULL;
+
+    host = input + 4;
+    colon = strrchr (host, ':');
+    if (colon == NULL || colon == host || strlen (colon + 1) == 0
+      || strlen (colon + 1) >= sizeof (r->port))
+        return NULL;
+    hostlength = colon - host;
+    if (host[0] == '[' && host[hostlength - 1] == ']') {
+        host++;
+        hostlength -= 2;
+    }
+    if (hostlength <= 0 || hostlength >= RELAYHOSTSIZE)
+        return NULL;
+
+    r = (relay_t *) calloc (1, sizeof (relay_t));
+    if (r == NULL)
+        return NULL;
+
+    r->kind = (strncmp (input, "tcp:", 4) == 0) ? RELAY_TCP : RELAY_UDP;
+    r->input = input;
+    memcpy (r->host, host, hostlength);
+    strcpy (r->port, colon + 1);
+    r->backoff = RELAYBACKOFFMIN;
+
+    return r;
+}
+
+
+
+
+/*
+* destroyrelay
+*
+* Destroys a relay source.
+*
+* Parameters:
+*     r : relay_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroyrelay (relay_t * r)
+{
+    free (r);
+
+    return;
+}
+
+
+
+
+/*
+* dialupstream
+*
+* Connects to an upstream nmead and asks it for numbered sentences.
+*
+* Parameters:
+*     r : relay_t * : The relay.
+*
+* Return Value:
+*     The function returns the connected socket, or -1 if it cannot
+*     connect.
+*
+* Remarks:
+*     Every kind of frame from the receiver is asked for.  Once the
+*     upstream's numbering is known the relay asks to resume after the
+*     last sentence it had.  Keepalive probes notice an upstream that has
+*     gone away without closing the connection.
+*
+*/
+static int dialupstream (relay_t * r)
+{
+    struct addrinfo hints, * res, * ai;
+    char hello[64];
+    int fd = -1;
+    int on = 1;
+    int e, n;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    e = getaddrinfo (r->host, r->port, &hints, &res);
+    if (e != 0) {
+        if (verbose >= 1)
+            fprintf (stderr, "relay %s: %s\n", r->input, gai_strerror (e));
+        return -1;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (res);
+    if (fd < 0) {
+        if (verbose >= 1)
+            fprintf (stderr, "relay %s: %s\n", r->input, strerror (errno));
+        return -1;
+    }
+
+    setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, (char *) &on, sizeof (on));
+#ifdef TCP_KEEPIDLE
+    n = RELAYKEEPIDLE;
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE, (char *) &n, sizeof (n));
+    n = RELAYKEEPINTERVAL;
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, (char *) &n, sizeof (n));
+    n = RELAYKEEPCOUNT;
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, (char *) &n, sizeof (n));
+#endif
+
+    if (r->haveseq)
+        n = sprintf (hello, "TYPES all\r\nRESUME %lu\r\n", r->nextseq);
+    else
+        n = sprintf (hello, "TYPES all\r\nSEQ on\r\n");
+    r->resuming = r->haveseq;
+    if (write (fd, hello, n) != n) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+
+
+/*
+* joingroup
+*
+* Opens a UDP socket for a relay source, joining its multicast group if
+* the address is one.
+*
+* Parameters:
+*     r : relay_t * : The relay.
+*
+* Return Value:
+*     The function returns the socket, or -1 if it cannot be opened.
+*
+* Remarks:
+*     The address must be an IPv4 address.  A unicast address is the
+*     local address bound to, 0.0.0.0 for any.
+*
+*/
+static int joingroup (relay_t * r)
+{
+    struct sockaddr_in sa;
+    struct ip_mreq mreq;
+    struct in_addr addr;
+    int on = 1;
+    int fd;
+
+    if (inet_aton (r->host, &addr) == 0) {
+        fprintf (stderr, "relay %s: not an IPv4 address\n", r->input);
+        return -1;
+    }
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror ("socket");
+        return -1;
+    }
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof (on));
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons (atoi (r->port));
+    sa.sin_addr.s_addr = IN_MULTICAST (ntohl (addr.s_addr))
+                       ? htonl (INADDR_ANY) : addr.s_addr;
+    if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0) {
+        if (verbose >= 1)
+            fprintf (stderr, "relay %s: %s\n", r->input, strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    if (IN_MULTICAST (ntohl (addr.s_addr))) {
+        mreq.imr_multiaddr = addr;
+        mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+        if (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *) &mreq,
+                        sizeof (mreq)) != 0) {
+            if (verbose >= 1)
+                fprintf (stderr, "relay %s: %s\n", r->input,
+                    strerror (errno));
+            close (fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+
+
+
+/*
+* relayopen
+*
+* Opens a relay source, trying until it succeeds.
+*
+* Parameters:
+*     r : relay_t * : The relay.
+*
+* Return Value:
+*     The function returns the open socket.
+*
+* Remarks:
+*     Called from the talker thread, which has nothing else to do while
+*     its source is down.  Every attempt but the very first waits
+*     r->backoff seconds, which doubles after each one up to
+*     RELAYBACKOFFMAX, and is reset once sentences arrive again.
+*
+*/
+int relayopen (relay_t * r)
+{
+    int fd;
+
+    do {
+        if (r->opened) {
+            if (verbose >= 1)
+                printf ("relay %s: reopening in %d s\n", r->input,
+                    r->backoff);
+            sleep (r->backoff);
+            r->backoff *= 2;
+            if (r->backoff > RELAYBACKOFFMAX)
+                r->backoff = RELAYBACKOFFMAX;
+        }
+        r->opened = TRUE;
+
+        fd = (r->kind == RELAY_TCP) ? dialupstream (r) : joingroup (r);
+    } while (fd < 0);
+
+    if (verbose >= 1)
+        printf ("relay %s: open\n", r->input);
+
+    return fd;
+}
+
+
+
+
+/*
+* relayclose
+*
+* Closes a relay source whose connection has been lost.
+*
+* Parameters:
+*     r  : relay_t * : The relay.
+*     fd : int       : Its socket.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void relayclose (relay_t * r, int fd)
+{
+    close (fd);
+    r->reconnects++;
+
+    if (verbose >= 1)
+        printf ("relay %s: lost, next sentence %lu\n", r->input,
+            r->nextseq);
+
+    return;
+}
+
+
+
+
+/*
+* relaysentence
+*
+* Notes a sentence received from a relay source.
+*
+* Parameters:
+*     r      : relay_t *     : The relay.
+*     msg    : const char *  : The sentence.
+*     length : int           : Length of the sentence.
+*     tagged : int           : The sentence came with a sequence number.
+*     seq    : unsigned long : The sequence number.
+*
+* Return Value:
+*     The function returns TRUE if the sentence is the upstream's answer
+*     to the relay, not to be passed on.
+*
+* Remarks:
+*     Records without a TAG block, binary frames and positions, are
+*     followed by a $PNMEAD,SEQ sentence with their number, which moves
+*     r->nextseq as a TAG block does.  The answer to RESUME tells how
+*     many sentences the upstream no longer held; those are counted in
+*     r->lost.  A number lower than asked for means the upstream has
+*     started counting again.
+*
+*/
+int relaysentence (relay_t * r, const char * msg, int length, int tagged,
+                   unsigned long seq)
+{
+    unsigned long from;
+
+    r->backoff = RELAYBACKOFFMIN;
+
+    if (tagged) {
+        r->nextseq = seq + 1;
+        r->haveseq = TRUE;
+        return FALSE;
+    }
+
+    if (length < 8 || strncmp (msg, "$PNMEAD,", 8) != 0)
+        return FALSE;
+
+    /* The number of the binary frame or position just passed on */
+    if (sscanf (msg + 8, "SEQ,%lu", &seq) == 1) {
+        r->nextseq = seq + 1;
+        r->haveseq = TRUE;
+        return TRUE;
+    }
+
+    if (r->resuming && sscanf (msg + 8, "RESUME,%lu", &from) == 1) {
+        r->resuming = FALSE;
+        if ((long) (from - r->nextseq) > 0) {
+            r->lost += from - r->nextseq;
+            if (verbose >= 1)
+                printf ("relay %s: %lu sentences lost upstream\n", r->input,
+                    from - r->nextseq);
+        }
+        else if (from != r->nextseq && verbose >= 1)
+            printf ("relay %s: upstream numbering restarted at %lu\n",
+                r->input, from);
+        r->nextseq = from;
+    }
+
+    return TRUE;
+}
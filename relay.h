@@ -0,0 +1,106 @@
+/*
+* relay.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for relay sources, through which one
+* nmead takes its sentences from another instead of from a receiver.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef RELAY_H
+#define RELAY_H
+
+
+#define RELAY_TCP          0      /* an upstream nmead, resumed */
+#define RELAY_UDP          1      /* datagrams, multicast or not */
+
+#define RELAYHOSTSIZE      128
+#define RELAYBACKOFFMIN    1      /* seconds before reopening */
+#define RELAYBACKOFFMAX    60
+#define RELAYKEEPIDLE      10     /* seconds of silence before probing */
+#define RELAYKEEPINTERVAL  5
+#define RELAYKEEPCOUNT     3
+
+
+/* A relay source is named like a serial device, as tcp:host:port or
+   udp:address:port.  nextseq is the upstream's number of the next
+   record expected, known once a numbered record has arrived; on
+   reconnecting the relay asks for the sentences from there on. */
+typedef struct {
+    int kind;                      /* RELAY_ */
+    const char * input;            /* as given, for messages */
+    char host[RELAYHOSTSIZE];
+    char port[8];
+    int opened;                    /* has been open before */
+    int backoff;                   /* seconds before the next attempt */
+    int haveseq;
+    unsigned long nextseq;
+    int resuming;                  /* a RESUME has not been answered */
+    unsigned long reconnects;
+    unsigned long lost;            /* sentences the upstream no longer had */
+} relay_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+int isrelay (const char * input);
+relay_t * newrelay (const char * input);
+void destroyrelay (relay_t * r);
+int relayopen (relay_t * r);
+void relayclose (relay_t * r, int fd);
+int relaysentence (relay_t * r, const char * msg, int length, int tagged,
+                   unsigned long seq);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* RELAY_H */
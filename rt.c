@@ -0,0 +1,258 @@
+/*
+* rt.c
+*
+* NMEA Server Application
+*
+* Real-time scheduling, CPU affinity and memory locking for the talker and
+* worker threads.  Each facility is optional; where the system does not
+* provide it the request is reported and ignored.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "nmead.h"
+
+
+extern int verbose;
+
+
+/* Set once the process memory is locked */
+static int memorylocked = FALSE;
+
+
+
+
+/*
+* initthreadattr
+*
+* Initializes the attributes for one of the server's threads.
+*
+* Parameters:
+*     attr : pthread_attr_t * : The attributes to be initialized.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Once memory is locked every page of a thread's stack is resident, so
+*     threads then get a small explicit stack instead of the default
+*     (commonly 8 MB).  The small profile always does so.
+*
+*/
+void initthreadattr (pthread_attr_t * attr)
+{
+    pthread_attr_init (attr);
+
+#ifdef NMEAD_SMALL
+    pthread_attr_setstacksize (attr, SMALLSTACKSIZE);
+#else
+    if (memorylocked)
+        pthread_attr_setstacksize (attr, LOCKEDSTACKSIZE);
+#endif
+
+    return;
+}
+
+
+
+
+/*
+* setrealtime
+*
+* Requests SCHED_FIFO scheduling in a set of thread attributes.
+*
+* Parameters:
+*     attr     : pthread_attr_t * : The attributes.
+*     priority : int              : The SCHED_FIFO priority.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if not.
+*
+* Remarks:
+*     Whether the process may use the priority is only known when the
+*     thread is created.
+*
+*/
+int setrealtime (pthread_attr_t * attr, int priority)
+{
+    struct sched_param param;
+
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = priority;
+
+    if (pthread_attr_setinheritsched (attr, PTHREAD_EXPLICIT_SCHED) != 0
+      || pthread_attr_setschedpolicy (attr, SCHED_FIFO) != 0
+      || pthread_attr_setschedparam (attr, &param) != 0)
+        return -1;
+
+    return 0;
+}
+
+
+
+
+/*
+* pinthread
+*
+* Restricts a thread to a single CPU.
+*
+* Parameters:
+*     thread : pthread_t : The thread.
+*     cpu    : int       : The CPU number.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if not.
+*
+* Remarks:
+*
+*/
+int pinthread (pthread_t thread, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+
+    CPU_ZERO (&cpus);
+    CPU_SET (cpu, &cpus);
+    if (pthread_setaffinity_np (thread, sizeof (cpus), &cpus) == 0)
+        return 0;
+#endif
+
+    if (verbose >= 1)
+        fprintf (stderr, "Cannot pin thread to CPU %d\n", cpu);
+    return -1;
+}
+
+
+
+
+/*
+* parsecpulist
+*
+* Parses a CPU list such as "2,3" or "0-1,4".
+*
+* Parameters:
+*     list : const char * : The list.
+*     cpus : int *        : Receives the CPU numbers.
+*     max  : int          : Number of elements available at cpus.
+*
+* Return Value:
+*     The function returns the number of CPUs in the list, or -1 if the
+*     list is malformed.
+*
+* Remarks:
+*
+*/
+int parsecpulist (const char * list, int * cpus, int max)
+{
+    const char * p = list;
+    char * end;
+    long first, last;
+    int n = 0;
+
+    while (*p != '\0') {
+        first = strtol (p, &end, 10);
+        if (end == p || first < 0)
+            return -1;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol (p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+        }
+        for (; first <= last; first++) {
+            if (n == max)
+                return -1;
+            cpus[n++] = (int) first;
+        }
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+
+    return n;
+}
+
+
+
+
+/*
+* lockmemory
+*
+* Locks the process's current and future memory into RAM.
+*
+* Parameters:
+*     None.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if not.
+*
+* Remarks:
+*     Prevents page faults on the ingest and distribution paths.  Must be
+*     called before the threads are created, so that their stacks are
+*     sized by initthreadattr accordingly.
+*
+*/
+int lockmemory (void)
+{
+    if (mlockall (MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror ("mlockall");
+        return -1;
+    }
+
+    memorylocked = TRUE;
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+* snapshot.c
+*
+* NMEA Server Application
+*
+* AIS snapshots.  A display client that connects would otherwise wait
+* minutes for every target to report again; a snapshot describes the
+* targets in the tracker's table at once.  The targets are chosen when the
+* snapshot is asked for, and each is described, from its latest state,
+* as the client's queue drains, so that a large snapshot neither fills the
+* queue ahead of the live feed nor delays the worker's other clients.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nmead.h"
+
+
+extern int verbose;
+
+
+/* Targets being collected for a snapshot */
+typedef struct {
+    unsigned int * mmsi;
+    int n;
+} collect_t;
+
+
+
+
+/*
+* collecttarget
+*
+* Visitor of aisquery: notes a target for the snapshot.
+*
+* Parameters:
+*     ctx    : void *              : The collect_t being filled.
+*     target : const aistarget_t * : The target.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void collecttarget (void * ctx, const aistarget_t * target)
+{
+    collect_t * c = (collect_t *) ctx;
+
+    if (c->n < AISTARGETS)
+        c->mmsi[c->n++] = target->mmsi;
+
+    return;
+}
+
+
+
+
+/*
+* startsnapshot
+*
+* Begins sending a client a snapshot of the AIS targets.
+*
+* Parameters:
+*     conn : connection_t *    : The connection.
+*     area : const aisarea_t * : The targets to include.
+*
+* Return Value:
+*     The function returns the number of targets in the snapshot, or -1
+*     if the channel keeps no targets or memory is short.
+*
+* Remarks:
+*     A snapshot in progress is abandoned.  Called only from the worker
+*     thread owning the connection.
+*
+*/
+int startsnapshot (connection_t * conn, const aisarea_t * area)
+{
+    collect_t c;
+
+    if (conn->cmgr->track == NULL)
+        return -1;
+
+    c.mmsi = (unsigned int *) malloc (AISTARGETS * sizeof (unsigned int));
+    if (c.mmsi == NULL)
+        return -1;
+    c.n = 0;
+    aisquery (conn->cmgr->track, area, collecttarget, &c);
+
+    free (conn->snapshot);
+    conn->snapshot = c.mmsi;
+    conn->nsnapshot = c.n;
+    conn->snapshotnext = 0;
+
+    if (verbose >= 10)
+        printf ("Snapshot of %d targets for client %d\n", c.n,
+            conn->socketfd);
+
+    return c.n;
+}
+
+
+
+
+/*
+* sendsnapshot
+*
+* Queues the next part of a client's snapshot.
+*
+* Parameters:
+*     conn : connection_t * : The connection.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Targets are described while the queue is less than half full, so
+*     the live feed always has room.  Targets forgotten since the
+*     snapshot began are skipped.  Connections still in their HTTP
+*     handshake wait.
+*
+*/
+void sendsnapshot (connection_t * conn)
+{
+    aistarget_t target;
+    char out[AISENCODEMAX];
+    const char * end;
+    int length, i;
+
+    if (conn->protocol == PROTO_HTTP)
+        return;
+
+    while (conn->snapshotnext < conn->nsnapshot
+      && conn->msgbuffer->used < conn->msgbuffer->size / 2) {
+        i = conn->snapshotnext++;
+        if (aislookup (conn->cmgr->track, conn->snapshot[i], &target) != 0)
+            continue;
+        length = aisencode (&target, out, i % 10);
+        for (i = 0; i < length; i = end - out + 1) {
+            end = memchr (out + i, '\n', length - i);
+            clientsend (conn, out + i, end - out + 1 - i);
+        }
+    }
+
+    if (conn->snapshotnext == conn->nsnapshot) {
+        free (conn->snapshot);
+        conn->snapshot = NULL;
+    }
+
+    return;
+}
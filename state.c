@@ -0,0 +1,481 @@
+/*
+* state.c
+*
+* NMEA Server Application
+*
+* The state file (option -s).  A restarted nmead would otherwise know no
+* AIS targets until each reported again, and would begin numbering its
+* records from zero.  The file is mapped into memory: each channel's next
+* sequence number is written into it as the talker releases records, and
+* every second, or as often as -s file,seconds asks, a checkpoint copies
+* the AIS targets into it if any has changed.  At startup
+* both are read back before the talkers start, so clients are served the
+* old picture within milliseconds.  See state.h for the layout.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "nmead.h"
+#include "state.h"
+
+
+#define barrier()   __sync_synchronize ()
+
+
+extern int verbose;
+extern int stateinterval;
+
+
+
+
+/*
+* pageround
+*
+* Rounds a size up to a whole number of pages.
+*
+* Parameters:
+*     size : unsigned long : The size in bytes.
+*
+* Return Value:
+*     The function returns the rounded size.
+*
+* Remarks:
+*
+*/
+static unsigned long pageround (unsigned long size)
+{
+    unsigned long page = (unsigned long) sysconf (_SC_PAGESIZE);
+
+    return (size + page - 1) / page * page;
+}
+
+
+
+
+/*
+* slotsum
+*
+* Computes the checksum of a slot.
+*
+* Parameters:
+*     slot : const stateslot_t * : The slot.
+*
+* Return Value:
+*     The function returns the 32-bit FNV-1a hash of the slot's contents
+*     after its checksum, targets included.
+*
+* Remarks:
+*     slot->length must already have been checked.
+*
+*/
+static unsigned int slotsum (const stateslot_t * slot)
+{
+    const unsigned char * p = (const unsigned char *) &slot->length;
+    const unsigned char * end = (const unsigned char *) (slot + 1)
+                                + slot->length;
+    unsigned int hash = 2166136261U;
+
+    while (p < end) {
+        hash ^= *p++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+
+
+/*
+* newestslot
+*
+* Finds the most recent intact checkpoint in a mapped state file.
+*
+* Parameters:
+*     header : const stateheader_t * : The file's header, already
+*                                      checked.
+*     size   : unsigned long         : Size of the mapping.
+*
+* Return Value:
+*     The function returns the slot, or NULL if neither is intact.
+*
+* Remarks:
+*
+*/
+static const stateslot_t * newestslot (const stateheader_t * header,
+                                       unsigned long size)
+{
+    const char * base = (const char *) header;
+    unsigned long first = pageround (sizeof (stateheader_t));
+    const stateslot_t * slot, * best = NULL;
+    int i;
+
+    if (first + 2 * header->slotsize > size)
+        return NULL;
+
+    for (i = 0; i < 2; i++) {
+        slot = (const stateslot_t *) (base + first + i * header->slotsize);
+        if (slot->generation == 0
+          || slot->length > header->slotsize - sizeof (stateslot_t)
+          || slotsum (slot) != slot->checksum)
+            continue;
+        if (best == NULL || slot->generation > best->generation)
+            best = slot;
+    }
+
+    return best;
+}
+
+
+
+
+/*
+* restorestate
+*
+* Takes back what a previous run left in the state file.
+*
+* Parameters:
+*     header   : const stateheader_t * : The mapped file.
+*     size     : unsigned long         : Size of the mapping.
+*     channels : channel_t *           : The channels, set up but not yet
+*                                        started.
+*
+* Return Value:
+*     The function returns the number of AIS targets restored.
+*
+* Remarks:
+*     Channels are matched by name.  A channel's records are numbered on
+*     from where its stream had got to.  The times targets were last
+*     heard are carried over as ages, since the monotonic clock may have
+*     been reset by a reboot.
+*
+*/
+static int restorestate (const stateheader_t * header, unsigned long size,
+                         channel_t * channels)
+{
+    const stateslot_t * slot = newestslot (header, size);
+    const aistarget_t * saved;
+    aistarget_t target;
+    struct timespec now, nowmono;
+    channel_t * ch;
+    long age, restored = 0;
+    int i, j, first;
+
+    clock_gettime (CLOCK_REALTIME, &now);
+    clock_gettime (CLOCK_MONOTONIC, &nowmono);
+
+    for (ch = channels; ch != NULL; ch = ch->next) {
+        for (j = 0; j < header->nchannels && j < MAXCHANNELS; j++)
+            if (strncmp (header->channel[j].name, ch->name,
+                         CHANNELNAMESIZE) == 0)
+                break;
+        if (j == header->nchannels || j == MAXCHANNELS)
+            continue;
+
+        streamstart (ch->talker.cmgr->stream, header->channel[j].seq);
+        if (slot == NULL || ch->talker.cmgr->track == NULL)
+            continue;
+
+        for (first = 0, i = 0; i < j; i++)
+            first += slot->ntargets[i];
+        if ((first + slot->ntargets[j]) * sizeof (aistarget_t) > slot->length)
+            continue;
+
+        saved = (const aistarget_t *) (slot + 1) + first;
+        for (i = 0; i < slot->ntargets[j]; i++) {
+            target = saved[i];
+            age = (slot->savedmono.tv_sec - target.heard.tv_sec) * 1000L
+                  + (slot->savedmono.tv_nsec - target.heard.tv_nsec)
+                    / 1000000L
+                  + (now.tv_sec - slot->saved.tv_sec) * 1000L
+                  + (now.tv_nsec - slot->saved.tv_nsec) / 1000000L;
+            target.heard.tv_sec = nowmono.tv_sec - age / 1000;
+            target.heard.tv_nsec = nowmono.tv_nsec - age % 1000 * 1000000L;
+            if (target.heard.tv_nsec < 0) {
+                target.heard.tv_sec--;
+                target.heard.tv_nsec += 1000000000L;
+            }
+            aisimport (ch->talker.cmgr->track, &target, 1);
+        }
+        restored += slot->ntargets[j];
+    }
+
+    return restored;
+}
+
+
+
+
+/*
+* checkpoint
+*
+* Copies the AIS targets of every channel into the state file.
+*
+* Parameters:
+*     s : state_t * : The state file.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     The older slot is overwritten, so the newer stays intact until this
+*     one is complete.  The pages are scheduled for writing but not
+*     waited for.  If no tracker has changed since the last checkpoint,
+*     the slots are left alone and only the header, with the sequence
+*     numbers, is scheduled.
+*
+*/
+static void checkpoint (state_t * s)
+{
+    stateslot_t * slot;
+    aistarget_t * targets;
+    channel_t * ch;
+    unsigned long changes[MAXCHANNELS];
+    int i, n = 0, changed = !s->saved;
+
+    /* Counted before the targets are copied: an update in between only
+       brings the next checkpoint forward */
+    for (ch = s->channels, i = 0; ch != NULL; ch = ch->next, i++) {
+        changes[i] = 0;
+        if (ch->talker.cmgr->track != NULL)
+            changes[i] = ch->talker.cmgr->track->changes;
+        if (changes[i] != s->changes[i])
+            changed = TRUE;
+    }
+    if (!changed) {
+        msync (s->header, pageround (sizeof (stateheader_t)), MS_ASYNC);
+        return;
+    }
+
+    slot = (s->slot[0]->generation <= s->slot[1]->generation) ? s->slot[0]
+                                                              : s->slot[1];
+    slot->generation = 0;
+    barrier ();
+
+    targets = (aistarget_t *) (slot + 1);
+    for (ch = s->channels, i = 0; ch != NULL; ch = ch->next, i++) {
+        slot->ntargets[i] = 0;
+        if (ch->talker.cmgr->track != NULL)
+            slot->ntargets[i] = aisexport (ch->talker.cmgr->track,
+                                           targets + n, AISTARGETS);
+        n += slot->ntargets[i];
+    }
+    slot->length = n * sizeof (aistarget_t);
+    clock_gettime (CLOCK_REALTIME, &slot->saved);
+    clock_gettime (CLOCK_MONOTONIC, &slot->savedmono);
+    slot->checksum = slotsum (slot);
+    barrier ();
+    slot->generation = ++s->generation;
+
+    for (ch = s->channels, i = 0; ch != NULL; ch = ch->next, i++)
+        s->changes[i] = changes[i];
+    s->saved = TRUE;
+
+    msync (s->header, pageround (sizeof (stateheader_t)), MS_ASYNC);
+    msync (slot, pageround (sizeof (stateslot_t) + slot->length), MS_ASYNC);
+
+    return;
+}
+
+
+
+
+/*
+* openstate
+*
+* Opens the state file, restoring what it holds into the channels.
+*
+* Parameters:
+*     path     : const char * : The file; created if it does not exist.
+*     channels : channel_t *  : The channels, set up but not yet started.
+*
+* Return Value:
+*     The function returns a pointer to a new state_t object, or NULL if
+*     the file cannot be used.
+*
+* Remarks:
+*     A file written by another build, or for other channels, is read as
+*     far as it matches and then laid out afresh; the state restored is
+*     written back at the first checkpoint.
+*
+*/
+state_t * openstate (const char * path, channel_t * channels)
+{
+    stateheader_t * header;
+    state_t * s;
+    channel_t * ch;
+    struct stat sb;
+    unsigned long headsize, slotsize, size;
+    int nchannels = 0, reuse = FALSE, restored = 0, i;
+    void * map;
+
+    for (ch = channels; ch != NULL; ch = ch->next)
+        nchannels++;
+    headsize = pageround (sizeof (stateheader_t));
+    slotsize = pageround (sizeof (stateslot_t)
+                          + nchannels * AISTARGETS * sizeof (aistarget_t));
+    size = headsize + 2 * slotsize;
+
+    s = (state_t *) calloc (1, sizeof (state_t));
+    if (s == NULL)
+        return NULL;
+    s->channels = channels;
+
+    s->fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (s->fd < 0 || fstat (s->fd, &sb) != 0) {
+        perror (path);
+        free (s);
+        return NULL;
+    }
+
+    /* Take back what the file holds, if it is ours */
+    if ((unsigned long) sb.st_size >= sizeof (stateheader_t)) {
+        map = mmap (NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    s->fd, 0);
+        if (map != MAP_FAILED) {
+            header = (stateheader_t *) map;
+            if (header->magic == STATEMAGIC
+              && header->version == STATEVERSION
+              && header->targetsize == sizeof (aistarget_t)
+              && header->maxtargets == AISTARGETS) {
+                restored = restorestate (header, sb.st_size, channels);
+                reuse = ((unsigned long) sb.st_size == size
+                         && header->slotsize == slotsize
+                         && header->nchannels == nchannels);
+                for (ch = channels, i = 0; reuse && ch != NULL;
+                     ch = ch->next, i++)
+                    if (strncmp (header->channel[i].name, ch->name,
+                                 CHANNELNAMESIZE) != 0)
+                        reuse = FALSE;
+            }
+            if (reuse)
+                s->map = (char *) map;
+            else
+                munmap (map, sb.st_size);
+        }
+    }
+
+    if (!reuse) {
+        if (ftruncate (s->fd, 0) != 0 || ftruncate (s->fd, size) != 0) {
+            perror (path);
+            close (s->fd);
+            free (s);
+            return NULL;
+        }
+        map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+        if (map == MAP_FAILED) {
+            perror (path);
+            close (s->fd);
+            free (s);
+            return NULL;
+        }
+        s->map = (char *) map;
+        header = (stateheader_t *) map;
+        header->magic = STATEMAGIC;
+        header->version = STATEVERSION;
+        header->targetsize = sizeof (aistarget_t);
+        header->maxtargets = AISTARGETS;
+        header->slotsize = slotsize;
+        header->nchannels = nchannels;
+        for (ch = channels, i = 0; ch != NULL; ch = ch->next, i++)
+            strncpy (header->channel[i].name, ch->name, CHANNELNAMESIZE);
+    }
+
+    s->size = size;
+    s->header = (stateheader_t *) s->map;
+    s->slot[0] = (stateslot_t *) (s->map + headsize);
+    s->slot[1] = (stateslot_t *) (s->map + headsize + slotsize);
+    s->generation = s->slot[0]->generation;
+    if (s->slot[1]->generation > s->generation)
+        s->generation = s->slot[1]->generation;
+
+    /* From now on the talkers keep the sequence numbers here */
+    for (ch = channels, i = 0; ch != NULL; ch = ch->next, i++) {
+        s->header->channel[i].seq = streamhead (ch->talker.cmgr->stream);
+        ch->talker.cmgr->stream->mirror = &s->header->channel[i].seq;
+    }
+
+    if (verbose >= 1)
+        printf ("State file %s: %d AIS targets restored\n", path, restored);
+
+    return s;
+}
+
+
+
+
+/*
+* keepstate
+*
+* Thread writing the checkpoints of the state file.
+*
+* Parameters:
+*     arg : pointer : The state_t structure.
+*
+* Return Value:
+*     The function does not return.
+*
+* Remarks:
+*     Runs at normal priority; a checkpoint only holds each tracker's
+*     lock while its targets are copied.
+*
+*/
+void * keepstate (void * arg)
+{
+    state_t * s = (state_t *) arg;
+
+    while (1) {
+        sleep (stateinterval);
+        checkpoint (s);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,126 @@
+/*
+* state.h
+*
+* NMEA Server Application
+*
+* Layout of the state file, which keeps what nmead has learned across a
+* restart.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef STATE_H
+#define STATE_H
+
+
+#define STATEMAGIC      0x54534d4eU   /* "NMST" */
+#define STATEVERSION    1
+#define STATEINTERVAL   1         /* default seconds between checkpoints */
+
+
+/* Layout.  The file is a header followed by two slots, each on a page
+   boundary:
+
+       header  slot 0  slot 1
+
+   The header identifies the layout and holds each channel's next
+   sequence number, which the talker updates in place as it releases
+   records.  A checkpoint writes the AIS targets of all channels into the
+   slot with the older generation: the generation is zeroed first and set
+   to one more than the other slot's only after the slot's checksum, so a
+   slot torn by a crash or power loss is recognised and the other one
+   used. */
+typedef struct {
+    char name[CHANNELNAMESIZE];
+    volatile unsigned long seq;    /* next sequence number, live */
+} statechannel_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int targetsize;       /* sizeof (aistarget_t) */
+    unsigned int maxtargets;       /* AISTARGETS */
+    unsigned long slotsize;
+    int nchannels;
+    statechannel_t channel[MAXCHANNELS];
+} stateheader_t;
+
+typedef struct {
+    volatile unsigned long generation;  /* zero while being written */
+    unsigned int checksum;         /* of what follows, FNV-1a */
+    unsigned int length;           /* bytes of targets after the slot */
+    struct timespec saved;         /* CLOCK_REALTIME of the checkpoint */
+    struct timespec savedmono;     /* the same moment, CLOCK_MONOTONIC */
+    int ntargets[MAXCHANNELS];     /* by channel, stored in turn */
+} stateslot_t;
+
+
+typedef struct {
+    int fd;
+    char * map;
+    unsigned long size;
+    stateheader_t * header;
+    stateslot_t * slot[2];
+    unsigned long generation;      /* of the newest slot */
+    unsigned long changes[MAXCHANNELS];  /* trackers' counts, as saved */
+    int saved;                     /* a checkpoint has been written */
+    channel_t * channels;
+} state_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+state_t * openstate (const char * path, channel_t * channels);
+void * keepstate (void * arg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* STATE_H */
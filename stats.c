@@ -0,0 +1,452 @@
+/*
+* stats.c
+*
+* NMEA Server Application
+*
+* Latency statistics.  The talker and each worker thread keep their own
+* histograms; a reporter thread merges and prints them periodically and
+* whenever the process receives SIGUSR1.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "nmead.h"
+#include "stats.h"
+
+
+extern int verbose;
+extern int statsinterval;
+
+
+
+
+/*
+* elapsedusec
+*
+* Computes the time between two clock readings.
+*
+* Parameters:
+*     start : const struct timespec * : The earlier reading.
+*     end   : const struct timespec * : The later reading.
+*
+* Return Value:
+*     The function returns the difference in microseconds, or zero if end
+*     precedes start.
+*
+* Remarks:
+*
+*/
+unsigned long elapsedusec (const struct timespec * start,
+                           const struct timespec * end)
+{
+    long sec = end->tv_sec - start->tv_sec;
+    long nsec = end->tv_nsec - start->tv_nsec;
+
+    if (nsec < 0) {
+        sec--;
+        nsec += 1000000000L;
+    }
+    if (sec < 0)
+        return 0;
+
+    return (unsigned long) sec * 1000000UL + nsec / 1000;
+}
+
+
+
+
+/*
+* latencyrecord
+*
+* Adds a sample to a latency histogram.
+*
+* Parameters:
+*     lat  : latency_t *   : The histogram.
+*     usec : unsigned long : The sample in microseconds.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void latencyrecord (latency_t * lat, unsigned long usec)
+{
+    int b = 0;
+
+    while (b < LATENCYBUCKETS - 1 && (usec >> b) != 0)
+        b++;
+
+    lat->bucket[b]++;
+    if (lat->count == 0 || usec < lat->min)
+        lat->min = usec;
+    if (usec > lat->max)
+        lat->max = usec;
+    lat->sum += usec;
+    lat->count++;
+
+    return;
+}
+
+
+
+
+/*
+* latencysince
+*
+* Adds the time elapsed since a CLOCK_MONOTONIC reading to a histogram.
+*
+* Parameters:
+*     lat   : latency_t *             : The histogram.
+*     start : const struct timespec * : The reading.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void latencysince (latency_t * lat, const struct timespec * start)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    latencyrecord (lat, elapsedusec (start, &now));
+
+    return;
+}
+
+
+
+
+/*
+* latencymerge
+*
+* Adds the samples of one histogram to another.
+*
+* Parameters:
+*     total : latency_t *       : The histogram receiving the samples.
+*     lat   : const latency_t * : The histogram to be added.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void latencymerge (latency_t * total, const latency_t * lat)
+{
+    int b;
+
+    if (lat->count == 0)
+        return;
+
+    if (total->count == 0 || lat->min < total->min)
+        total->min = lat->min;
+    if (lat->max > total->max)
+        total->max = lat->max;
+    total->sum += lat->sum;
+    total->count += lat->count;
+    for (b = 0; b < LATENCYBUCKETS; b++)
+        total->bucket[b] += lat->bucket[b];
+
+    return;
+}
+
+
+
+
+/*
+* percentile
+*
+* Estimates a percentile of a histogram.
+*
+* Parameters:
+*     lat : const latency_t * : The histogram.
+*     pct : int               : The percentile.
+*
+* Return Value:
+*     The function returns the upper bound, in microseconds, of the bucket
+*     containing the percentile.
+*
+* Remarks:
+*
+*/
+static unsigned long percentile (const latency_t * lat, int pct)
+{
+    unsigned long target = (lat->count * pct + 99) / 100;
+    unsigned long seen = 0;
+    int b;
+
+    for (b = 0; b < LATENCYBUCKETS; b++) {
+        seen += lat->bucket[b];
+        if (seen >= target)
+            break;
+    }
+    if (b >= LATENCYBUCKETS - 1)
+        return lat->max;
+
+    return (1UL << b) - 1 < lat->max ? (1UL << b) - 1 : lat->max;
+}
+
+
+
+
+/*
+* latencyreport
+*
+* Prints a summary of a latency histogram.
+*
+* Parameters:
+*     name : const char *      : Label for the line.
+*     lat  : const latency_t * : The histogram.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Percentiles are bucket upper bounds, so within a factor of two.
+*
+*/
+void latencyreport (const char * name, const latency_t * lat)
+{
+    if (lat->count == 0) {
+        printf ("stats: %-9s no samples\n", name);
+        return;
+    }
+
+    printf ("stats: %-9s n=%lu min=%luus mean=%.0fus p50<=%luus "
+            "p99<=%luus max=%luus\n",
+            name, lat->count, lat->min, lat->sum / lat->count,
+            percentile (lat, 50), percentile (lat, 99), lat->max);
+
+    return;
+}
+
+
+
+
+/*
+* printstats
+*
+* Prints the server's statistics.
+*
+* Parameters:
+*     channels : channel_t * : The channels, and through them the workers.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Each channel's figures are printed under its name when there is
+*     more than one; the workers' histograms cover all channels.
+*
+*/
+static void printstats (channel_t * channels)
+{
+    connectionmgr_t * cmgr = channels->talker.cmgr;
+    latency_t dispatch, delivery, priority;
+    unsigned long dropped = 0;
+    channel_t * ch;
+    int i;
+
+    memset (&dispatch, 0, sizeof (dispatch));
+    memset (&delivery, 0, sizeof (delivery));
+    memset (&priority, 0, sizeof (priority));
+    for (i = 0; i < cmgr->nworkers; i++) {
+        latencymerge (&dispatch, &cmgr->worker[i].dispatch);
+        latencymerge (&delivery, &cmgr->worker[i].delivery[PRIORITY_NORMAL]);
+        latencymerge (&priority, &cmgr->worker[i].delivery[PRIORITY_HIGH]);
+        dropped += cmgr->worker[i].dropped;
+    }
+
+    for (ch = channels; ch != NULL; ch = ch->next) {
+        cmgr = ch->talker.cmgr;
+        if (channels->next != NULL)
+            printf ("stats: channel %s:\n", ch->name);
+        printf ("stats: %lu sentences published, %d listeners, "
+                "%ld of %ld bytes in grown queues\n",
+                streamhead (cmgr->stream), cmgr->nconn,
+                cmgr->queuebytes, cmgr->budget);
+        latencyreport ("talker", &ch->talker.latency);
+        if (ch->talker.relay != NULL)
+            printf ("stats: relay %s, %lu reconnects, %lu sentences lost "
+                    "upstream\n", ch->input, ch->talker.relay->reconnects,
+                    ch->talker.relay->lost);
+    }
+    printf ("stats: %lu queue overflows\n", dropped);
+    latencyreport ("dispatch", &dispatch);
+    latencyreport ("delivery", &delivery);
+    if (priority.count > 0)
+        latencyreport ("priority", &priority);
+    fflush (stdout);
+
+    return;
+}
+
+
+
+
+/*
+* reportstats
+*
+* Thread procedure printing statistics on request and periodically.
+*
+* Parameters:
+*     arg : pointer : A pointer to the first channel_t structure.
+*
+* Return Value:
+*     The function does not return.
+*
+* Remarks:
+*     SIGUSR1 must be blocked in every thread, so that it is delivered
+*     here through sigwait.  Statistics are also printed every
+*     statsinterval seconds if that is nonzero.
+*
+*/
+void * reportstats (void * arg)
+{
+    channel_t * channels = (channel_t *) arg;
+    struct timespec interval;
+    sigset_t set;
+    int sig;
+
+    sigemptyset (&set);
+    sigaddset (&set, SIGUSR1);
+
+    interval.tv_sec = statsinterval;
+    interval.tv_nsec = 0;
+
+    while (1) {
+        if (statsinterval > 0)
+            sig = sigtimedwait (&set, NULL, &interval);
+        else
+            sigwait (&set, &sig);
+
+        if (sig == -1 && errno == EINTR)
+            continue;
+        printstats (channels);
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+* reportmemory
+*
+* Prints the memory the server has set aside, and the most it may use.
+*
+* Parameters:
+*     channels : channel_t * : The channels, set up.
+*     nworkers : int         : Number of worker threads to be started.
+*     nthreads : int         : Number of threads in all.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Connection slots, streams and AIS tables are allocated once at
+*     startup; only queues of lagging clients grow, up to their cap and
+*     within each channel's budget.  Thread stacks are reserved address
+*     space, resident only as far as they have been used.  Shared-memory
+*     rings and the state file are separate mappings and not counted.
+*
+*/
+void reportmemory (channel_t * channels, int nworkers, int nthreads)
+{
+    connectionmgr_t * cmgr;
+    pthread_attr_t attr;
+    size_t stacksize = 0;
+    unsigned long fixed, total = 0;
+    channel_t * ch;
+    int maxconn = 0;
+
+    for (ch = channels; ch != NULL; ch = ch->next) {
+        cmgr = ch->talker.cmgr;
+        fixed = sizeof (connectionmgr_t)
+              + cmgr->poolstride * cmgr->maxconn
+              + cmgr->stream->size
+              + cmgr->stream->nentries * sizeof (streamentry_t)
+              + sizeof (framer_t) + ch->talker.framer->size
+              + (ch->talker.ais != NULL ? sizeof (aisfilter_t) : 0)
+              + (cmgr->track != NULL ? sizeof (aistrack_t) : 0);
+        printf ("Memory: channel %s: %d connections of %lu bytes, queues "
+                "growing to %d (%d high priority) within %ld\n",
+                ch->name, cmgr->maxconn, (unsigned long) cmgr->poolstride,
+                cmgr->buffersize[PRIORITY_NORMAL],
+                cmgr->buffersize[PRIORITY_HIGH], cmgr->budget);
+        printf ("Memory: channel %s: %lu bytes fixed (stream %lu, AIS %lu)\n",
+                ch->name, fixed,
+                cmgr->stream->size
+                + cmgr->stream->nentries * sizeof (streamentry_t),
+                (unsigned long) (cmgr->track != NULL ? sizeof (aistrack_t)
+                                                     : 0));
+        total += fixed + cmgr->budget;
+        maxconn += cmgr->maxconn;
+    }
+
+    fixed = nworkers * (sizeof (worker_t)
+                        + maxconn * sizeof (connection_t *)
+                        + (maxconn + 2) * sizeof (struct pollfd));
+    total += fixed;
+
+    initthreadattr (&attr);
+    pthread_attr_getstacksize (&attr, &stacksize);
+    pthread_attr_destroy (&attr);
+
+    printf ("Memory: %d workers, %lu bytes\n", nworkers, fixed);
+    printf ("Memory: at most %lu bytes in all; %d threads reserve %lu bytes "
+            "of stack each\n", total, nthreads, (unsigned long) stacksize);
+    fflush (stdout);
+
+    return;
+}
@@ -0,0 +1,407 @@
+/*
+* stream.c
+*
+* NMEA Server Application
+*
+* The shared sentence stream.  The talker appends each sentence once; the
+* worker threads serving listener connections read records by sequence
+* number without taking any lock, so a slow worker never delays the
+* talker.  A worker that falls more than a ring's worth behind finds its
+* records overwritten and skips ahead.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nmead.h"
+#include "stream.h"
+
+
+extern int verbose;
+
+
+/* Full memory barrier; the target toolchain predates C11 atomics. */
+#define barrier()   __sync_synchronize ()
+
+
+
+
+/*
+* newstream
+*
+* Allocates and initializes a sentence stream.
+*
+* Parameters:
+*     size     : unsigned long : Bytes of sentence data retained.
+*     nentries : unsigned long : Number of records retained.
+*
+* Return Value:
+*     The function returns a pointer to a new stream_t object, or NULL if
+*     it cannot be allocated.
+*
+* Remarks:
+*     Whichever limit is reached first determines how much history is
+*     retained.
+*
+*/
+stream_t * newstream (unsigned long size, unsigned long nentries)
+{
+    stream_t * st = (stream_t *) calloc (1, sizeof (stream_t));
+    unsigned long i;
+
+    if (st == NULL) return NULL;
+
+    st->data = (char *) malloc (size);
+    st->entry = (streamentry_t *) calloc (nentries, sizeof (streamentry_t));
+    if (st->data == NULL || st->entry == NULL) {
+        destroystream (st);
+        return NULL;
+    }
+
+    st->size = size;
+    st->nentries = nentries;
+
+    /* No entry may look valid for a sequence not yet published */
+    for (i = 0; i < nentries; i++)
+        st->entry[i].seq = i + 1;
+
+    return st;
+}
+
+
+
+
+/*
+* destroystream
+*
+* Destroys a sentence stream.
+*
+* Parameters:
+*     st : stream_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void destroystream (stream_t * st)
+{
+    free (st->data);
+    free (st->entry);
+    free (st);
+
+    return;
+}
+
+
+
+
+/*
+* streampublish
+*
+* Appends a record to the stream.
+*
+* Parameters:
+*     st     : stream_t *   : The stream.
+*     msg    : const char * : The record's bytes.
+*     length : int          : Number of bytes.
+*     info   : const streamentry_t * : Supplies the type and receive times
+*                                      of the record, or NULL for an NMEA
+*                                      sentence received just now.
+*
+* Return Value:
+*     The function returns zero if successful, or STREAM_TOOLONG if the
+*     record is longer than the whole ring and has not been published.
+*
+* Remarks:
+*     Must only be called by the single writer of the stream.  The call
+*     never blocks.  The record is not served until streamrelease is
+*     called.  Its sequence number is st->headseq - 1 on return.
+*
+*/
+int streampublish (stream_t * st, const char * msg, int length,
+                   const streamentry_t * info)
+{
+    unsigned long seq = st->headseq;
+    unsigned long pos = st->headpos;
+    unsigned long offset = pos % st->size;
+    unsigned long first = st->size - offset;
+    streamentry_t * e = &st->entry[seq % st->nentries];
+
+    if (length < 0 || (unsigned long) length > st->size)
+        return STREAM_TOOLONG;
+
+    st->reservepos = pos + length;
+    e->seq = seq - 1;                   /* invalid while being rewritten */
+    barrier ();
+
+    if ((unsigned long) length <= first)
+        memcpy (st->data + offset, msg, length);
+    else {
+        memcpy (st->data + offset, msg, first);
+        memcpy (st->data, msg + first, length - first);
+    }
+
+    e->pos = pos;
+    e->length = length;
+    clock_gettime (CLOCK_MONOTONIC, &e->published);
+    if (info != NULL) {
+        e->type = info->type;
+        e->received = info->received;
+        e->receivedrt = info->receivedrt;
+        e->lat = info->lat;
+        e->lon = info->lon;
+    } else {
+        e->type = FRAME_NMEA;
+        e->received = e->published;
+        clock_gettime (CLOCK_REALTIME, &e->receivedrt);
+        e->lat = e->lon = AISNOPOSITION;
+    }
+    barrier ();
+
+    e->seq = seq;
+    st->headpos = pos + length;
+    barrier ();
+    st->headseq = seq + 1;
+
+    return 0;
+}
+
+
+
+
+/*
+* streamread
+*
+* Copies a record out of the stream.
+*
+* Parameters:
+*     st     : stream_t *    : The stream.
+*     seq    : unsigned long : Sequence number of the record.
+*     buf    : char *        : Destination of the copy.
+*     length : int           : Number of bytes available at buf.
+*     info   : streamentry_t * : Receives the record's index entry, or
+*                                NULL.
+*
+* Return Value:
+*     The function returns the length of the record if successful,
+*     STREAM_EMPTY if the record has not been published yet, STREAM_LOST
+*     if it has already been overwritten, or STREAM_TOOLONG if it does not
+*     fit in buf.
+*
+* Remarks:
+*     May be called by any number of threads concurrently with the writer.
+*
+*/
+int streamread (stream_t * st, unsigned long seq, char * buf, int length,
+                streamentry_t * info)
+{
+    streamentry_t * e = &st->entry[seq % st->nentries];
+    streamentry_t copy;
+    unsigned long pos, offset, first;
+    int n;
+
+    if ((long) (seq - st->headseq) >= 0)
+        return STREAM_EMPTY;
+    barrier ();
+
+    if (e->seq != seq)
+        return STREAM_LOST;
+    barrier ();
+    copy = *e;
+    barrier ();
+    pos = copy.pos;
+    n = copy.length;
+    if (e->seq != seq || n < 0 || (unsigned long) n > st->size)
+        return STREAM_LOST;
+    if (n > length)
+        return STREAM_TOOLONG;
+
+    offset = pos % st->size;
+    first = st->size - offset;
+    if ((unsigned long) n <= first)
+        memcpy (buf, st->data + offset, n);
+    else {
+        memcpy (buf, st->data + offset, first);
+        memcpy (buf + first, st->data, n - first);
+    }
+    barrier ();
+
+    /* The copy is good only if the talker has not since reserved the
+       space the record occupied. */
+    if (st->reservepos - pos > st->size)
+        return STREAM_LOST;
+
+    if (info != NULL) {
+        *info = copy;
+        info->seq = seq;
+    }
+
+    return n;
+}
+
+
+
+
+/*
+* streamheld
+*
+* Tells whether the stream still holds a record, without copying it.
+*
+* Parameters:
+*     st  : stream_t *    : The stream.
+*     seq : unsigned long : Sequence number of the record.
+*
+* Return Value:
+*     The function returns TRUE if the record has been published and
+*     neither its entry nor its bytes have been overwritten.
+*
+* Remarks:
+*     May be called by any number of threads concurrently with the
+*     writer; the answer may be out of date by the time it is used.
+*
+*/
+int streamheld (stream_t * st, unsigned long seq)
+{
+    streamentry_t * e = &st->entry[seq % st->nentries];
+    unsigned long pos;
+
+    if ((long) (seq - st->headseq) >= 0)
+        return FALSE;
+    barrier ();
+
+    if (e->seq != seq)
+        return FALSE;
+    barrier ();
+    pos = e->pos;
+    barrier ();
+    if (e->seq != seq)
+        return FALSE;
+
+    return st->reservepos - pos <= st->size;
+}
+
+
+
+
+/*
+* streamhead
+*
+* Returns the sequence number after the last record released to readers.
+*
+* Parameters:
+*     st : stream_t * : The stream.
+*
+* Return Value:
+*     The function returns the head sequence number.
+*
+* Remarks:
+*     Records published but not yet released lie beyond the head.
+*
+*/
+unsigned long streamhead (stream_t * st)
+{
+    barrier ();
+    return st->releasedseq;
+}
+
+
+
+
+/*
+* streamrelease
+*
+* Makes every record published so far visible to readers.
+*
+* Parameters:
+*     st : stream_t * : The stream.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Must only be called by the single writer of the stream.  The new
+*     head is also stored at st->mirror, which may be a state file.
+*
+*/
+void streamrelease (stream_t * st)
+{
+    barrier ();
+    st->releasedseq = st->headseq;
+    if (st->mirror != NULL)
+        *st->mirror = st->releasedseq;
+
+    return;
+}
+
+
+
+
+/*
+* streamstart
+*
+* Sets the sequence number of the first record of a new stream.
+*
+* Parameters:
+*     st  : stream_t *    : The stream.
+*     seq : unsigned long : The sequence number.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Lets sequence numbers carry on from a previous run.  Must be called
+*     before anything is published or read.
+*
+*/
+void streamstart (stream_t * st, unsigned long seq)
+{
+    st->headseq = st->releasedseq = seq;
+    if (st->mirror != NULL)
+        *st->mirror = seq;
+
+    return;
+}
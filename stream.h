@@ -0,0 +1,134 @@
+/*
+* stream.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the shared sentence stream, into
+* which the talker publishes each sentence once and from which every
+* worker thread pulls at its own pace.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <time.h>
+
+
+#ifdef NMEAD_SMALL
+#define STREAMENTRIES     256     /* default sentences indexed */
+#else
+#define STREAMENTRIES     1024    /* default sentences indexed */
+#endif
+#define STREAMRECORDSIZE  128     /* bytes of data per record indexed; an
+                                     NMEA sentence takes up to 82 */
+#define STREAMSIZE        (STREAMENTRIES * STREAMRECORDSIZE)
+
+#define STREAM_EMPTY      -1      /* the record has not been published */
+#define STREAM_LOST       -2      /* the record has been overwritten */
+#define STREAM_TOOLONG    -3      /* the record does not fit the buffer */
+
+
+/* Index entry describing one published record.  The talker marks the
+   entry invalid while rewriting it; a reader that sees the same sequence
+   number before and after copying the entry knows it is consistent. */
+typedef struct {
+    volatile unsigned long seq;
+    unsigned long pos;
+    int length;
+    int type;                      /* FRAME_ bit of the record */
+    struct timespec received;      /* first byte read, CLOCK_MONOTONIC */
+    struct timespec receivedrt;    /* the same moment, CLOCK_REALTIME */
+    struct timespec published;     /* CLOCK_MONOTONIC */
+    int lat, lon;                  /* last known position of the AIS
+                                      target an AIS sentence is about */
+} streamentry_t;
+
+
+/* The stream is written by a single thread and read without locks.  Data
+   positions and sequence numbers increase monotonically (modulo the word
+   size); a record's bytes live at pos % size and may wrap.  reservepos is
+   advanced before the talker writes into the ring, so a reader that
+   copied a record can tell afterwards whether the talker may have been
+   overwriting it at the same time.  Readers serve records only up to
+   releasedseq, which lets the talker publish a group of records that
+   become visible together. */
+typedef struct {
+    char * data;
+    unsigned long size;
+    streamentry_t * entry;
+    unsigned long nentries;
+    volatile unsigned long headseq;      /* sequence of next record */
+    volatile unsigned long releasedseq;  /* records before it are served */
+    volatile unsigned long headpos;
+    volatile unsigned long reservepos;
+    volatile unsigned long * mirror;     /* kept equal to releasedseq, or
+                                            NULL */
+} stream_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+stream_t * newstream (unsigned long size, unsigned long nentries);
+void destroystream (stream_t * st);
+int streampublish (stream_t * st, const char * msg, int length,
+                   const streamentry_t * info);
+int streamread (stream_t * st, unsigned long seq, char * buf, int length,
+                streamentry_t * info);
+int streamheld (stream_t * st, unsigned long seq);
+unsigned long streamhead (stream_t * st);
+void streamrelease (stream_t * st);
+void streamstart (stream_t * st, unsigned long seq);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* STREAM_H */
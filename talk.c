@@ -53,12 +53,305 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
 #include "nmead.h"
+#include "probes.h"
 
 
 extern int verbose;
 
 
+
+
+/*
+* sentencetime
+*
+* Finds the UTC time field of an NMEA sentence that carries one.
+*
+* Parameters:
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*     time   : char *       : Receives the zero-terminated field; at least
+*                             EPOCHTIMESIZE bytes.
+*
+* Return Value:
+*     The function returns the length of the field, or zero if the
+*     sentence has no time field or it is empty.
+*
+* Remarks:
+*     The talker ID is ignored, so GPGGA and GNGGA are treated alike, and
+*     so are TAG blocks in front of the sentence.
+*
+*/
+static int sentencetime (const char * msg, int length, char * time)
+{
+    static const struct {
+        const char * formatter;
+        int field;
+    } timed[] = {
+        { "GGA", 1 }, { "RMC", 1 }, { "GNS", 1 }, { "ZDA", 1 },
+        { "GST", 1 }, { "GBS", 1 }, { "GRS", 1 }, { "GLL", 5 },
+        { NULL, 0 }
+    };
+    int t, i, field, n;
+
+    n = skiptags (msg, length);
+    msg += n;
+    length -= n;
+    if (length < 7 || msg[0] != '$')
+        return 0;
+
+    for (t = 0; timed[t].formatter != NULL; t++)
+        if (memcmp (msg + 3, timed[t].formatter, 3) == 0)
+            break;
+    if (timed[t].formatter == NULL)
+        return 0;
+
+    /* Skip to the field, then copy up to the next delimiter */
+    for (field = 0, i = 0; i < length && field < timed[t].field; i++)
+        if (msg[i] == ',')
+            field++;
+    for (n = 0; i + n < length && n < EPOCHTIMESIZE - 1; n++) {
+        if (msg[i + n] == ',' || msg[i + n] == '*' || msg[i + n] == '\r')
+            break;
+        time[n] = msg[i + n];
+    }
+    time[n] = '\0';
+
+    return n;
+}
+
+
+
+
+/*
+* releaseepoch
+*
+* Hands the sentences held for the current epoch to the workers.
+*
+* Parameters:
+*     ti : talkerinfo_t * : The talker.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+static void releaseepoch (talkerinfo_t * ti)
+{
+    if (ti->held == 0)
+        return;
+
+    if (verbose >= 200)
+        logtext ("talker: epoch %.*s of %ld records released\n",
+            ti->epochtime, strlen (ti->epochtime), ti->held, 0);
+
+    releasetoconnections (ti->cmgr);
+    ti->held = 0;
+    ti->heldbytes = 0;
+
+    return;
+}
+
+
+
+
+/*
+* epochtimeout
+*
+* Works out how long the current epoch may still be held.
+*
+* Parameters:
+*     ti : talkerinfo_t * : The talker, holding at least one record.
+*
+* Return Value:
+*     The function returns the number of milliseconds until the epoch is
+*     due for release, or zero if it is due now.
+*
+* Remarks:
+*     An epoch is due epochgap msec after the port last returned data, and
+*     no later than epochhold msec after its first byte was read.
+*
+*/
+static int epochtimeout (talkerinfo_t * ti)
+{
+    struct timespec now;
+    long idle, age, wait;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    idle = (long) (elapsedusec (&ti->lastread, &now) / 1000);
+    age = (long) (elapsedusec (&ti->epochfirst, &now) / 1000);
+
+    wait = ti->epochgap - idle;
+    if (ti->epochhold - age < wait)
+        wait = ti->epochhold - age;
+
+    return (wait > 0) ? (int) wait : 0;
+}
+
+
+
+
+/*
+* publish
+*
+* Passes one record on to the listeners, holding it with the rest of its
+* epoch if bundling is enabled.
+*
+* Parameters:
+*     ti     : talkerinfo_t * : The talker; ti->rx describes the record.
+*     msg    : const char *   : The record.
+*     length : int            : Length of the record.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     A sentence whose time field differs from the current epoch's starts
+*     a new epoch.  An epoch is also released early rather than hold so
+*     much that the stream might overwrite it before a worker reads it.
+*
+*/
+static void publish (talkerinfo_t * ti, const char * msg, int length)
+{
+    stream_t * st = ti->cmgr->stream;
+    char time[EPOCHTIMESIZE];
+
+    if (ti->epochgap <= 0) {
+        writetoconnections (ti->cmgr, msg, length, &ti->rx);
+        return;
+    }
+
+    if (ti->rx.type == FRAME_NMEA && sentencetime (msg, length, time) > 0) {
+        if (strcmp (time, ti->epochtime) != 0) {
+            releaseepoch (ti);
+            strcpy (ti->epochtime, time);
+        }
+    }
+
+    if (ti->held > 0 && ((unsigned long) ti->held >= st->nentries / 4
+                      || ti->heldbytes + length > st->size / 4))
+        releaseepoch (ti);
+
+    if (ti->held == 0)
+        ti->epochfirst = ti->rx.received;
+    holdforconnections (ti->cmgr, msg, length, &ti->rx);
+    ti->held++;
+    ti->heldbytes += length;
+
+    return;
+}
+
+
+
+
+/*
+* distribute
+*
+* Output callback of the AIS stage: passes an AIS sentence to the
+* listeners.
+*
+* Parameters:
+*     ctx    : void *       : The talkerinfo_t structure.
+*     msg    : const char * : The sentence.
+*     length : int          : Length of the sentence.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     A reassembled message carries the receive times of its last
+*     fragment.  The sentence also updates the AIS targets, and carries
+*     the position of the target it is about, for clients watching an
+*     area.
+*
+*/
+static void distribute (void * ctx, const char * msg, int length)
+{
+    talkerinfo_t * ti = (talkerinfo_t *) ctx;
+
+    if (ti->cmgr->track != NULL)
+        aistrack (ti->cmgr->track, msg, length, &ti->rx.lat, &ti->rx.lon);
+    else
+        ti->rx.lat = ti->rx.lon = AISNOPOSITION;
+    publish (ti, msg, length);
+}
+
+
+
+
+/*
+* dispatchframe
+*
+* Output callback of the framer: passes one frame from the GPS receiver
+* on to the listeners.
+*
+* Parameters:
+*     ctx    : void *                : The talkerinfo_t structure.
+*     frame  : const char *          : The frame.
+*     length : int                   : Length of the frame.
+*     rx     : const streamentry_t * : Type and receive times of the frame.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     AIS sentences go through the AIS stage if it is enabled.  A
+*     position record completed by a sentence follows it, with the
+*     sentence's receive times.  A relaying channel keeps the upstream's
+*     answers to itself.
+*
+*/
+static void dispatchframe (void * ctx, const char * frame, int length,
+                           const streamentry_t * rx)
+{
+    talkerinfo_t * ti = (talkerinfo_t *) ctx;
+    char record[POSMAXLENGTH];
+    int n;
+
+    ti->rx = *rx;
+    PROBE3 (frame, rx->type, length, msgstamp (&rx->received));
+    if (ti->relay != NULL && rx->type == FRAME_NMEA
+      && relaysentence (ti->relay, frame, length, ti->framer->tagged,
+                        ti->framer->tagseq))
+        return;
+
+    if (rx->type == FRAME_NMEA && isaissentence (frame, length)) {
+        if (ti->ais != NULL)
+            aisfilter (ti->ais, frame, length, distribute, ti);
+        else
+            distribute (ti, frame, length);
+    }
+    else
+        publish (ti, frame, length);
+
+    if (rx->type == FRAME_NMEA && ti->pos != NULL) {
+        n = posencode (ti->pos, frame, length, record);
+        if (n > 0) {
+            ti->rx.type = FRAME_POS;
+            publish (ti, record, n);
+        }
+    }
+    latencysince (&ti->latency, &rx->received);
+
+    if (verbose >= 200) {
+        if (rx->type == FRAME_NMEA)
+            logtext ("%.*s", frame, length, 0, 0);
+        else
+            logtext ("talker: %.*s frame of %ld bytes\n",
+                rx->type == FRAME_UBX ? "UBX" : "RTCM3",
+                rx->type == FRAME_UBX ? 3 : 5, length, 0);
+    }
+
+    return;
+}
+
+
 /*
 * talk
 *
@@ -75,11 +368,28 @@ extern int verbose;
 *     This routine is expected to run continuously until the entire
 *     application is terminated.
 *
+*     The port is read directly into the framer, whatever has arrived at
+*     a time, and each read is timestamped on return; a frame carries the
+*     time of the read that returned its first byte.  NMEA sentences
+*     longer than ti->maxlength are dropped whole rather than passed on
+*     truncated.
+*
+*     While an epoch is held the port is polled, so that the epoch is
+*     released on time when the receiver falls silent.  With VMIN 0
+*     (option -t) a read of an idle port returns nothing; the port is
+*     then polled too, so the next bytes are read as they arrive.
+*
+*     A relay source is opened here, and opened again, with any epoch
+*     released first, whenever its connection is lost.
+*
 */
 void * talk (void * arg)
 {
     talkerinfo_t * ti = (talkerinfo_t *) arg;
-    char nmeabuf[BUFSZ];
+    streamentry_t rx;
+    struct pollfd pfd;
+    char * space;
+    int n, avail, timeout;
 
     if (verbose >= 10)
         printf ("talker: started\n");
@@ -89,22 +399,60 @@ void * talk (void * arg)
         exit (-2);
     }
 
-    if (ti->fp == NULL) {
-        fprintf (stderr, "talker: bad fp\n");
+    if ((ti->fd < 0 && ti->relay == NULL) || ti->framer == NULL) {
+        fprintf (stderr, "talker: bad fd\n");
         exit (-2);
     }
 
+    memset (&rx, 0, sizeof (rx));
+
+    pfd.fd = ti->fd;
+    pfd.events = POLLIN;
+
     while (1) {
-        fgets (nmeabuf, BUFSZ, ti->fp);
-        if (nmeabuf[0] != '$' && nmeabuf[0] != '!')  /* not a valid NMEA line */
-            continue;
+        if (ti->fd < 0) {
+            if (ti->held > 0)
+                releaseepoch (ti);
+            ti->fd = relayopen (ti->relay);
+            framerreset (ti->framer);
+            pfd.fd = ti->fd;
+        }
 
-        writetoconnections (ti->cmgr, nmeabuf);
-        if (verbose >= 200)
-            printf ("%s", nmeabuf);
+        if (ti->held > 0) {
+            timeout = epochtimeout (ti);
+            if (timeout == 0 || poll (&pfd, 1, timeout) == 0) {
+                releaseepoch (ti);
+                continue;
+            }
+        }
 
+        space = framerbuffer (ti->framer, &avail);
+        n = read (ti->fd, space, avail);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (ti->relay != NULL && n == 0 && ti->relay->kind == RELAY_UDP)
+                continue;                   /* empty datagram */
+            if (ti->relay != NULL) {
+                relayclose (ti->relay, ti->fd);
+                ti->fd = -1;
+                continue;
+            }
+            if (n == 0) {
+                /* Nothing yet (VMIN 0): wait for the next bytes */
+                timeout = (ti->held > 0) ? epochtimeout (ti) : -1;
+                if (poll (&pfd, 1, timeout) >= 0
+                  && !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+                    continue;
+            }
+            usleep (100000);            /* port closed or in error */
+            continue;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &rx.received);
+        clock_gettime (CLOCK_REALTIME, &rx.receivedrt);
+        ti->lastread = rx.received;
+
+        framerparse (ti->framer, n, &rx, dispatchframe, ti);
     }
 
 }
-
-
@@ -0,0 +1,476 @@
+/*
+* uring.c
+*
+* NMEA Server Application
+*
+* Optional io_uring engine.  A worker prepares one writev request for
+* every connection with queued sentences and submits them all with a
+* single io_uring_enter; the acceptor keeps a multishot accept armed on
+* every listening socket.  The rings are set up with the raw system
+* calls, so no library is needed.
+*
+* Built only with make URING=1 on Linux; elsewhere, or when the kernel
+* refuses the ring, newuring fails and the callers keep to poll, writev
+* and accept.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "nmead.h"
+#include "uring.h"
+
+#if defined(__linux__) && defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter)
+#undef HAVE_IO_URING
+#endif
+#else
+#undef HAVE_IO_URING
+#endif
+
+
+extern int verbose;
+
+
+
+
+
+
+
+/*
+* newuring
+*
+* Sets up a ring and maps its submission and completion queues.
+*
+* Parameters:
+*     entries : unsigned int : The number of requests that may be
+*                              prepared before they are submitted.
+*
+* Return Value:
+*     The function returns a pointer to the new ring, or NULL if io_uring
+*     is not built in or the kernel refuses it.
+*
+* Remarks:
+*     The completion queue is twice the size of the submission queue,
+*     which leaves room for the completions of a multishot accept.
+*
+*/
+uring_t * newuring (unsigned int entries)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_params p;
+    uring_t * u;
+    char * sq;
+    char * cq;
+
+    u = (uring_t *) calloc (1, sizeof (uring_t));
+    if (u == NULL)
+        return NULL;
+
+    memset (&p, 0, sizeof (p));
+    u->fd = (int) syscall (__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) {
+        if (verbose >= 10)
+            perror ("io_uring_setup");
+        free (u);
+        return NULL;
+    }
+
+    u->sqmapsize = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+    u->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqmapsize > u->sqmapsize)
+            u->sqmapsize = u->cqmapsize;
+        u->cqmapsize = 0;
+    }
+
+    u->sqmap = mmap (NULL, u->sqmapsize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sqmap == MAP_FAILED)
+        goto fail;
+
+    if (u->cqmapsize == 0)
+        u->cqmap = u->sqmap;
+    else {
+        u->cqmap = mmap (NULL, u->cqmapsize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cqmap == MAP_FAILED)
+            goto fail;
+    }
+
+    u->sqesize = p.sq_entries * sizeof (struct io_uring_sqe);
+    u->sqes = mmap (NULL, u->sqesize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = (char *) u->sqmap;
+    cq = (char *) u->cqmap;
+    u->entries = p.sq_entries;
+    u->sqhead = (volatile unsigned int *) (sq + p.sq_off.head);
+    u->sqtail = (volatile unsigned int *) (sq + p.sq_off.tail);
+    u->sqmask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    u->sqarray = (unsigned int *) (sq + p.sq_off.array);
+    u->sqlocal = *u->sqtail;
+    u->cqhead = (volatile unsigned int *) (cq + p.cq_off.head);
+    u->cqtail = (volatile unsigned int *) (cq + p.cq_off.tail);
+    u->cqmask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    u->cqes = cq + p.cq_off.cqes;
+
+    return u;
+
+fail:
+    if (verbose >= 10)
+        perror ("io_uring mmap");
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap (u->sqes, u->sqesize);
+    if (u->cqmapsize != 0 && u->cqmap != NULL && u->cqmap != MAP_FAILED)
+        munmap (u->cqmap, u->cqmapsize);
+    if (u->sqmap != NULL && u->sqmap != MAP_FAILED)
+        munmap (u->sqmap, u->sqmapsize);
+    close (u->fd);
+    free (u);
+    return NULL;
+#else
+    (void) entries;
+    return NULL;
+#endif
+}
+
+
+
+
+
+
+
+/*
+* destroyuring
+*
+* Unmaps and closes a ring.
+*
+* Parameters:
+*     u : uring_t * : The ring to destroy.  May be NULL.
+*
+* Return Value:
+*     None
+*
+* Remarks:
+*     Closing the ring cancels any request still armed on it, such as a
+*     multishot accept.
+*
+*/
+void destroyuring (uring_t * u)
+{
+#ifdef HAVE_IO_URING
+    if (u == NULL)
+        return;
+
+    munmap (u->sqes, u->sqesize);
+    if (u->cqmapsize != 0)
+        munmap (u->cqmap, u->cqmapsize);
+    munmap (u->sqmap, u->sqmapsize);
+    close (u->fd);
+    free (u);
+#else
+    (void) u;
+#endif
+}
+
+
+
+
+
+
+
+#ifdef HAVE_IO_URING
+/*
+* getsqe
+*
+* Takes the next free entry of the submission queue.
+*
+* Parameters:
+*     u : uring_t * : The ring.
+*
+* Return Value:
+*     The function returns a cleared entry, or NULL if the queue is full.
+*
+* Remarks:
+*     The entry is published by uringsubmit, which moves the tail.
+*
+*/
+static struct io_uring_sqe * getsqe (uring_t * u)
+{
+    struct io_uring_sqe * sqe;
+    unsigned int tail, index;
+
+    tail = u->sqlocal;
+    if (tail - *u->sqhead >= u->entries)
+        return NULL;
+
+    index = tail & *u->sqmask;
+    sqe = (struct io_uring_sqe *) u->sqes + index;
+    memset (sqe, 0, sizeof (*sqe));
+    u->sqarray[index] = index;
+    u->sqlocal = tail + 1;
+    u->pending++;
+
+    return sqe;
+}
+#endif
+
+
+
+
+
+
+
+/*
+* uringwritev
+*
+* Prepares a writev of a connection's queued sentences.
+*
+* Parameters:
+*     u    : uring_t *              : The ring.
+*     fd   : int                    : The socket to write to.
+*     iov  : const struct iovec *   : The sentences, as peekmsgs gave them.
+*     niov : int                    : The number of entries in iov.
+*     tag  : unsigned long          : Returned with the result.
+*
+* Return Value:
+*     The function returns zero if the request was prepared, or -1 if the
+*     submission queue is full.
+*
+* Remarks:
+*     iov must stay untouched until the result has been reaped.  On a
+*     non-blocking socket the write never waits; a full socket buffer
+*     completes with -EAGAIN, as writev would fail.
+*
+*/
+int uringwritev (uring_t * u, int fd, const struct iovec * iov, int niov,
+                 unsigned long tag)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe * sqe;
+
+    sqe = getsqe (u);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) iov;
+    sqe->len = (unsigned int) niov;
+    sqe->user_data = tag;
+
+    return 0;
+#else
+    (void) u; (void) fd; (void) iov; (void) niov; (void) tag;
+    return -1;
+#endif
+}
+
+
+
+
+
+
+
+/*
+* uringaccept
+*
+* Arms a multishot accept on a listening socket.
+*
+* Parameters:
+*     u   : uring_t *     : The ring.
+*     fd  : int           : The listening socket.
+*     tag : unsigned long : Returned with every accepted socket.
+*
+* Return Value:
+*     The function returns zero if the request was prepared, or -1 if the
+*     submission queue is full.
+*
+* Remarks:
+*     One request keeps completing, once per connection, for as long as
+*     uringreap reports more.  Kernels before 5.19 complete it at once
+*     with -EINVAL.
+*
+*/
+int uringaccept (uring_t * u, int fd, unsigned long tag)
+{
+#if defined(HAVE_IO_URING) && defined(IORING_ACCEPT_MULTISHOT)
+    struct io_uring_sqe * sqe;
+
+    sqe = getsqe (u);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = tag;
+
+    return 0;
+#else
+    (void) u; (void) fd; (void) tag;
+    return -1;
+#endif
+}
+
+
+
+
+
+
+
+/*
+* uringsubmit
+*
+* Hands the prepared requests to the kernel, and waits for results.
+*
+* Parameters:
+*     u    : uring_t *    : The ring.
+*     wait : unsigned int : The number of results to wait for.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 with errno set.
+*
+* Remarks:
+*     Interrupted calls are restarted.  Writes to non-blocking sockets
+*     complete while the call runs, so waiting for all of them costs no
+*     more than the writes themselves.
+*
+*/
+int uringsubmit (uring_t * u, unsigned int wait)
+{
+#ifdef HAVE_IO_URING
+    int n;
+
+    __sync_synchronize ();
+    *u->sqtail = u->sqlocal;
+    __sync_synchronize ();
+
+    for (;;) {
+        n = (int) syscall (__NR_io_uring_enter, u->fd, u->pending, wait,
+                           wait != 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0) {
+            u->pending -= (unsigned int) n;
+            if (u->pending == 0)
+                return 0;
+            continue;
+        }
+        if (errno != EINTR)
+            return -1;
+    }
+#else
+    (void) u; (void) wait;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+
+
+
+
+
+/*
+* uringreap
+*
+* Takes the next result from the completion queue.
+*
+* Parameters:
+*     u      : uring_t *       : The ring.
+*     tag    : unsigned long * : Receives the tag of the request.
+*     result : int *           : Receives the result: a byte count or a
+*                                socket, or a negated errno.
+*     more   : int *           : If not NULL, receives TRUE if the request
+*                                stays armed.
+*
+* Return Value:
+*     The function returns TRUE if a result was taken, or FALSE if the
+*     queue is empty.
+*
+* Remarks:
+*     None
+*
+*/
+int uringreap (uring_t * u, unsigned long * tag, int * result, int * more)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_cqe * cqe;
+    unsigned int head;
+
+    head = *u->cqhead;
+    if (head == *u->cqtail)
+        return FALSE;
+    __sync_synchronize ();
+
+    cqe = (struct io_uring_cqe *) u->cqes + (head & *u->cqmask);
+    *tag = (unsigned long) cqe->user_data;
+    *result = cqe->res;
+    if (more != NULL)
+#ifdef IORING_CQE_F_MORE
+        *more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+#else
+        *more = FALSE;
+#endif
+
+    __sync_synchronize ();
+    *u->cqhead = head + 1;
+
+    return TRUE;
+#else
+    (void) u; (void) tag; (void) result; (void) more;
+    return FALSE;
+#endif
+}
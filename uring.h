@@ -0,0 +1,106 @@
+/*
+* uring.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the optional io_uring engine,
+* through which worker threads write to all their connections, and the
+* acceptor accepts, with one system call per batch.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/uio.h>
+
+
+/* The rings are shared with the kernel.  Requests are prepared in the
+   submission ring and handed over together by uringsubmit; their results
+   are taken from the completion ring by uringreap, each with the tag it
+   was submitted with.  Built only with make URING=1; elsewhere newuring
+   always fails and callers keep to poll, writev and accept. */
+typedef struct {
+    int fd;
+    unsigned int entries;          /* submission ring size */
+    unsigned int pending;          /* requests prepared, not submitted */
+    unsigned int sqlocal;          /* tail, counting prepared requests */
+    volatile unsigned int * sqhead;
+    volatile unsigned int * sqtail;
+    unsigned int * sqmask;
+    unsigned int * sqarray;
+    void * sqes;
+    volatile unsigned int * cqhead;
+    volatile unsigned int * cqtail;
+    unsigned int * cqmask;
+    void * cqes;
+    void * sqmap;
+    size_t sqmapsize;
+    void * cqmap;
+    size_t cqmapsize;
+    size_t sqesize;
+} uring_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+uring_t * newuring (unsigned int entries);
+void destroyuring (uring_t * u);
+int uringwritev (uring_t * u, int fd, const struct iovec * iov, int niov,
+                 unsigned long tag);
+int uringaccept (uring_t * u, int fd, unsigned long tag);
+int uringsubmit (uring_t * u, unsigned int wait);
+int uringreap (uring_t * u, unsigned long * tag, int * result, int * more);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* URING_H */
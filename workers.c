@@ -0,0 +1,1245 @@
+/*
+* workers.c
+*
+* NMEA Server Application
+*
+* Worker threads serving listener connections.  Connections are sharded
+* across a fixed number of workers, normally one per CPU; each worker runs
+* a poll() loop over its own connections, pulls newly published sentences
+* from the shared stream into their queues, and writes the queues to the
+* sockets without blocking.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "nmead.h"
+#include "probes.h"
+
+
+/* Vector elements handed to a single writev */
+#define IOVMAX   64
+
+/* Largest io_uring submission ring; more connections take more rounds */
+#define URINGMAX 4096
+
+
+extern int verbose;
+extern int zerocopy;
+
+
+/* Full memory barrier; the target toolchain predates C11 atomics. */
+#define barrier()   __sync_synchronize ()
+
+
+
+
+/*
+* dropconnection
+*
+* Closes a connection and returns its structure to the pool.
+*
+* Parameters:
+*     w : worker_t * : The worker owning the connection.
+*     i : int        : Index of the connection in the worker's table.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Connections from later in the table take the place of the one
+*     dropped, keeping high-priority connections at the front, so callers
+*     walking the table must walk it backwards.
+*
+*/
+static void dropconnection (worker_t * w, int i)
+{
+    connection_t * conn = w->conn[i];
+
+    if (verbose >= 10)
+        printf ("worker %d: shutting down connection (%lu dropped)\n",
+            w->id, conn->dropped);
+
+    if (i < w->nhigh) {
+        w->conn[i] = w->conn[--w->nhigh];
+        i = w->nhigh;
+    }
+    w->conn[i] = w->conn[--w->nconn];
+
+    removeconnection (conn->cmgr, conn);
+    destroyzcsender (conn->zc);
+    close (conn->socketfd);
+    destroyconnection (conn);
+
+    return;
+}
+
+
+
+
+/*
+* adoptconnection
+*
+* Adds a connection to a worker's table.
+*
+* Parameters:
+*     w    : worker_t *     : The worker.
+*     conn : connection_t * : The connection.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Called only from the worker's own thread.  High-priority
+*     connections are kept at the front of the table.
+*
+*/
+static void adoptconnection (worker_t * w, connection_t * conn)
+{
+    conn->worker = w;
+    conn->waitevents = 0;
+
+    if (zerocopy && !conn->local) {
+        conn->zc = newzcsender (conn->socketfd);
+        if (conn->zc == NULL && verbose >= 10)
+            printf ("worker %d: zerocopy unavailable, using writev()\n",
+                w->id);
+    }
+
+    if (conn->cmgr->snapshot)
+        startsnapshot (conn, &conn->area);
+
+    w->conn[w->nconn++] = conn;
+    if (conn->priority == PRIORITY_HIGH) {
+        w->conn[w->nconn - 1] = w->conn[w->nhigh];
+        w->conn[w->nhigh++] = conn;
+    }
+
+    return;
+}
+
+
+
+
+/*
+* reprioritize
+*
+* Rearranges a worker's table after connections have changed class.
+*
+* Parameters:
+*     w : worker_t * : The worker.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Called only from the worker's own thread, between passes over the
+*     table.
+*
+*/
+static void reprioritize (worker_t * w)
+{
+    connection_t * conn;
+    int i;
+
+    w->reprioritize = FALSE;
+    w->nhigh = 0;
+    for (i = 0; i < w->nconn; i++) {
+        conn = w->conn[i];
+        if (conn->priority == PRIORITY_HIGH) {
+            w->conn[i] = w->conn[w->nhigh];
+            w->conn[w->nhigh++] = conn;
+        }
+    }
+
+    return;
+}
+
+
+
+
+/*
+* recorddelivery
+*
+* Records the time since a message was received in the owning worker's
+* delivery histogram for the connection's class.
+*
+* Parameters:
+*     conn  : connection_t * : The connection written to.
+*     stamp : unsigned int   : Receive stamp of the message (see msgstamp).
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     One sample is taken per write, for its oldest message.
+*
+*/
+static void recorddelivery (connection_t * conn, unsigned int stamp)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    latencyrecord (&conn->worker->delivery[conn->priority],
+                   msgstamp (&now) - stamp);
+
+    return;
+}
+
+
+
+
+/*
+* flushconnection
+*
+* Writes as much of a connection's queue as its socket will take.
+*
+* Parameters:
+*     conn : connection_t * : The connection.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 if the connection
+*     is closed.
+*
+* Remarks:
+*     If the socket cannot take everything, conn->waitevents records what
+*     the remainder is waiting for: POLLOUT for socket buffer space, or
+*     POLLERR for zerocopy completions that release a send chunk.
+*
+*     A SOCK_SEQPACKET connection is sent one sentence per writev, so
+*     that each record the client reads holds exactly one sentence.
+*
+*/
+static int flushconnection (connection_t * conn)
+{
+    struct iovec iov[IOVMAX];
+    char * buff;
+    size_t avail, length;
+    ssize_t total, n;
+    unsigned int stamp, first = 0;
+    int niov, i, r;
+
+    conn->waitevents = 0;
+
+    if (conn->zc != NULL) {
+        do {
+            r = zcflush (conn->zc);
+            if (r < 0)
+                return -1;
+            if (r == ZC_AGAIN) {
+                conn->waitevents = POLLOUT;
+                conn->lagged = conn->worker->now;
+                return 0;
+            }
+
+            buff = zcbuffer (conn->zc, &avail);
+            if (buff == NULL) {
+                conn->waitevents = POLLERR;
+                return 0;
+            }
+
+            length = 0;
+            while ((n = getmsg (conn->msgbuffer, buff + length,
+                                avail - length, &stamp)) >= 0) {
+                if (length == 0)
+                    first = stamp;
+                length += n;
+            }
+            if (length == 0)
+                return 0;
+
+            r = zcsend (conn->zc, length);
+            if (r < 0)
+                return -1;
+            PROBE3 (send, conn->socketfd, length, first);
+            recorddelivery (conn, first);
+            if (r == ZC_AGAIN) {
+                conn->waitevents = POLLOUT;
+                conn->lagged = conn->worker->now;
+                return 0;
+            }
+        } while (1);
+    }
+
+    do {
+        niov = peekmsgs (conn->msgbuffer, iov, conn->packet ? 2 : IOVMAX);
+        if (niov == 0)
+            return 0;
+
+        for (total = 0, i = 0; i < niov; i++)
+            total += iov[i].iov_len;
+
+        n = writev (conn->socketfd, iov, niov);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->waitevents = POLLOUT;
+                conn->lagged = conn->worker->now;
+                return 0;
+            }
+            return -1;
+        }
+
+        if (consumemsgs (conn->msgbuffer, (int) n, &stamp) > 0) {
+            PROBE3 (send, conn->socketfd, n, stamp);
+            recorddelivery (conn, stamp);
+        }
+        if (n < total) {
+            conn->waitevents = POLLOUT;
+            conn->lagged = conn->worker->now;
+            return 0;
+        }
+    } while (1);
+}
+
+
+
+
+/*
+* flushconnections
+*
+* Writes out the queues of a range of a worker's connections.
+*
+* Parameters:
+*     w     : worker_t * : The worker.
+*     first : int        : Index of the first connection.
+*     last  : int        : Index past the last connection.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Connections that are waiting for their socket are skipped, and
+*     those that fail are dropped.  With io_uring, one writev per
+*     connection is submitted in a single system call, and again for as
+*     long as some connection took everything it was given and has more
+*     queued, or did not fit in the ring; the results are handled as
+*     flushconnection handles those of writev.  Zerocopy and
+*     SOCK_SEQPACKET connections are always written by flushconnection.
+*     If the ring fails, the worker falls back to writev for good.
+*
+*/
+static void flushconnections (worker_t * w, int first, int last)
+{
+    connection_t * conn;
+    struct iovec * iov;
+    unsigned long tag;
+    unsigned int stamp;
+    int i, j, niov, res, nsub, full;
+
+    for (i = last - 1; i >= first; i--) {
+        conn = w->conn[i];
+        if (conn->waitevents == 0
+          && (w->uring == NULL || conn->zc != NULL || conn->packet)
+          && flushconnection (conn) != 0) {
+            dropconnection (w, i);
+            last--;
+        }
+    }
+    if (w->uring == NULL)
+        return;
+
+    do {
+        for (i = first; i < last; i++)
+            w->submitted[i] = -1;
+
+        nsub = 0;
+        full = FALSE;
+        for (i = first; i < last && !full; i++) {
+            conn = w->conn[i];
+            if (conn->waitevents != 0 || conn->zc != NULL || conn->packet)
+                continue;
+
+            iov = w->iov + i * IOVMAX;
+            niov = peekmsgs (conn->msgbuffer, iov, IOVMAX);
+            if (niov == 0)
+                continue;
+
+            /* A full ring takes the rest in the next round */
+            if (uringwritev (w->uring, conn->socketfd, iov, niov,
+                             (unsigned long) i) != 0) {
+                full = TRUE;
+                continue;
+            }
+            for (w->submitted[i] = 0, j = 0; j < niov; j++)
+                w->submitted[i] += iov[j].iov_len;
+            nsub++;
+        }
+        if (nsub == 0)
+            return;
+
+        if (uringsubmit (w->uring, nsub) != 0) {
+            perror ("io_uring_enter");
+            destroyuring (w->uring);
+            w->uring = NULL;
+            flushconnections (w, first, last);
+            return;
+        }
+        while (uringreap (w->uring, &tag, &res, NULL))
+            w->result[tag] = res;
+
+        /* Walk backwards: dropping moves the last connection into place */
+        nsub = 0;
+        for (i = last - 1; i >= first; i--) {
+            if (w->submitted[i] < 0)
+                continue;
+            conn = w->conn[i];
+            res = w->result[i];
+
+            if (res == -EINTR) {
+                nsub++;
+                continue;
+            }
+            if (res == -EAGAIN || res == -EWOULDBLOCK) {
+                conn->waitevents = POLLOUT;
+                conn->lagged = w->now;
+                continue;
+            }
+            if (res < 0) {
+                dropconnection (w, i);
+                last--;
+                continue;
+            }
+
+            if (consumemsgs (conn->msgbuffer, res, &stamp) > 0) {
+                PROBE3 (send, conn->socketfd, res, stamp);
+                recorddelivery (conn, stamp);
+            }
+            if (res < w->submitted[i]) {
+                conn->waitevents = POLLOUT;
+                conn->lagged = w->now;
+            }
+            else if (conn->msgbuffer->used > 0)
+                nsub++;
+        }
+    } while (nsub > 0 || full);
+}
+
+
+
+
+/*
+* wanted
+*
+* Tells whether a connection is to be sent a record.
+*
+* Parameters:
+*     conn : connection_t *        : The connection.
+*     info : const streamentry_t * : Index entry of the record.
+*     ais  : int                   : The record is an AIS sentence.
+*
+* Return Value:
+*     The function returns TRUE if the connection takes the record.
+*
+* Remarks:
+*     A connection is given only the frame types it asked for.  A
+*     connection watching an area is sent only the AIS sentences about
+*     targets last known to be in it; the position comes with the record,
+*     so the test costs no lookup.
+*
+*/
+static int wanted (connection_t * conn, const streamentry_t * info, int ais)
+{
+    if (!(conn->types & info->type))
+        return FALSE;
+    if (ais && conn->area.kind != AISAREA_NONE
+      && !inaisarea (&conn->area, info->lat, info->lon))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+
+
+/*
+* tagrecord
+*
+* Puts a TAG block with its sequence number in front of a sentence.
+*
+* Parameters:
+*     out    : char *        : Receives the tagged sentence; length +
+*                              TAGHEADERMAX bytes.
+*     seq    : unsigned long : Sequence number of the record.
+*     msg    : const char *  : The sentence.
+*     length : int           : Length of the sentence.
+*
+* Return Value:
+*     The function returns the length of the tagged sentence.
+*
+* Remarks:
+*     The block is the NMEA 4.10 line-count parameter, as in
+*     "\n:1234*5A\$GPGGA,...", which readers that do not know TAG blocks
+*     can strip at the second backslash.
+*
+*/
+static int tagrecord (char * out, unsigned long seq, const char * msg,
+                      int length)
+{
+    unsigned char sum = 0;
+    int n, i;
+
+    n = sprintf (out, "\\n:%lu", seq);
+    for (i = 1; i < n; i++)
+        sum ^= (unsigned char) out[i];
+    n += sprintf (out + n, "*%02X\\", sum);
+    memcpy (out + n, msg, length);
+
+    return n + length;
+}
+
+
+
+
+/*
+* markrecord
+*
+* Puts a sentence with its sequence number after a record that cannot
+* carry a TAG block.
+*
+* Parameters:
+*     out    : char *        : Receives the record and the sentence;
+*                              length + TAGHEADERMAX bytes.
+*     seq    : unsigned long : Sequence number of the record.
+*     msg    : const char *  : The record, a binary frame or a position.
+*     length : int           : Length of the record.
+*
+* Return Value:
+*     The function returns the length of the record with the sentence.
+*
+* Remarks:
+*     The sentence, "$PNMEAD,SEQ,1234*hh", follows the record in the same
+*     queue entry, so a client that has read it has the whole record.  A
+*     connection lost in between makes a resuming client get the record
+*     again rather than miss it.
+*
+*/
+static int markrecord (char * out, unsigned long seq, const char * msg,
+                       int length)
+{
+    unsigned char sum = 0;
+    int n, i;
+
+    memcpy (out, msg, length);
+    n = sprintf (out + length, "$PNMEAD,SEQ,%lu", seq);
+    for (i = 1; i < n; i++)
+        sum ^= (unsigned char) out[length + i];
+    n += sprintf (out + length + n, "*%02X\r\n", sum);
+
+    return length + n;
+}
+
+
+
+
+/*
+* replay
+*
+* Queues the next part of the records a connection has asked to be sent
+* again.
+*
+* Parameters:
+*     conn : connection_t * : The connection.
+*     head : unsigned long  : Sequence number at which the live feed takes
+*                             over.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Records are queued while the queue is less than half full; the
+*     connection is left out of the live feed until the replay reaches
+*     head.  A record that does not fit waits for the queue to drain,
+*     unless the queue is empty and cannot grow.  Records the stream no
+*     longer holds, and records too long for the queue, are counted as
+*     dropped.
+*     Replayed records are stamped with the time they are queued, so they
+*     do not distort the delivery statistics.
+*
+*/
+static void replay (connection_t * conn, unsigned long head)
+{
+    char msg[MSGLENGTHLIMIT];
+    char tagmsg[MSGLENGTHLIMIT + TAGHEADERMAX];
+    streamentry_t info;
+    struct timespec now;
+    unsigned long seq;
+    unsigned int stamp;
+    const char * out;
+    int length, ais;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    stamp = msgstamp (&now);
+
+    while (conn->replayseq != head
+      && conn->msgbuffer->used < conn->msgbuffer->size / 2) {
+        seq = conn->replayseq++;
+        length = streamread (conn->cmgr->stream, seq, msg, sizeof (msg),
+                             &info);
+        if (length < 0) {
+            conn->dropped++;
+            continue;
+        }
+
+        ais = (info.type == FRAME_NMEA && isaissentence (msg, length));
+        if (!wanted (conn, &info, ais))
+            continue;
+
+        out = msg;
+        if (conn->tagged) {
+            if (info.type == FRAME_NMEA)
+                length = tagrecord (tagmsg, seq, msg, length);
+            else
+                length = markrecord (tagmsg, seq, msg, length);
+            out = tagmsg;
+        }
+        if (putmsg (conn->msgbuffer, out, length, stamp) != 0
+          && (growconnection (conn, length) != 0
+            || putmsg (conn->msgbuffer, out, length, stamp) != 0)) {
+            if (conn->msgbuffer->used > 0) {
+                conn->replayseq--;          /* again once drained */
+                break;
+            }
+            conn->dropped++;
+        }
+    }
+
+    if (conn->replayseq == head) {
+        conn->replaying = FALSE;
+        if (verbose >= 10)
+            LOG ("client %ld: replay done at %lu, %lu dropped\n",
+                conn->socketfd, head, conn->dropped);
+    }
+
+    return;
+}
+
+
+
+
+/*
+* fanout
+*
+* Queues the records a channel has published since the worker last
+* looked for that channel's connections in a range.
+*
+* Parameters:
+*     w     : worker_t *        : The worker.
+*     cmgr  : connectionmgr_t * : The channel.
+*     head  : unsigned long     : Sequence number after the last record to
+*                                 be queued.
+*     first : int           : Index of the first connection in the range.
+*     last  : int           : Index after the last connection.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Each connection is given the records it wants (see wanted).  A
+*     full queue is grown if its cap and the budget allow; otherwise the
+*     connection loses the record, and the others are unaffected.  The
+*     caller advances the worker's cursor in the channel to head once
+*     every range has been served.
+*
+*     WebSocket and event-stream connections are sent the record in their
+*     own framing, built at most once per record however many of them
+*     there are, and so are records to connections that asked for
+*     sequence numbers.  Connections still in their HTTP handshake or
+*     replaying records are skipped.
+*
+*/
+static void fanout (worker_t * w, connectionmgr_t * cmgr, unsigned long head,
+                    int first, int last)
+{
+    char msg[MSGLENGTHLIMIT];
+    char wsmsg[MSGLENGTHLIMIT + WSHEADERMAX];
+    char ssemsg[MSGLENGTHLIMIT + SSEHEADERMAX];
+    char tagmsg[MSGLENGTHLIMIT + TAGHEADERMAX];
+    streamentry_t info;
+    stream_t * st = cmgr->stream;
+    connection_t * conn;
+    unsigned long seq;
+    unsigned long lost = 0;
+    unsigned int stamp;
+    int length, wslength, sselength, taglength, ais, i;
+    const char * out;
+    int outlength;
+
+    for (seq = w->cursor[cmgr->index]; seq != head; seq++) {
+        length = streamread (st, seq, msg, sizeof (msg), &info);
+        if (length == STREAM_EMPTY)
+            break;
+        if (length < 0) {
+            lost++;
+            continue;
+        }
+
+        if (first == 0)
+            latencysince (&w->dispatch, &info.published);
+        stamp = msgstamp (&info.received);
+        wslength = sselength = taglength = 0;
+        ais = (info.type == FRAME_NMEA && isaissentence (msg, length));
+
+        for (i = first; i < last; i++) {
+            conn = w->conn[i];
+            if (conn->cmgr != cmgr || conn->replaying
+              || !wanted (conn, &info, ais))
+                continue;
+
+            switch (conn->protocol) {
+            case PROTO_RAW:
+                if (conn->tagged) {
+                    if (taglength == 0 && info.type == FRAME_NMEA)
+                        taglength = tagrecord (tagmsg, seq, msg, length);
+                    else if (taglength == 0)
+                        taglength = markrecord (tagmsg, seq, msg, length);
+                    out = tagmsg;
+                    outlength = taglength;
+                    break;
+                }
+                out = msg;
+                outlength = length;
+                break;
+            case PROTO_WEBSOCKET:
+                if (wslength == 0)
+                    wslength = wsencode (wsmsg, info.type, msg, length);
+                out = wsmsg;
+                outlength = wslength;
+                break;
+            case PROTO_SSE:
+                if (sselength == 0)
+                    sselength = sseencode (ssemsg, msg, length);
+                out = ssemsg;
+                outlength = sselength;
+                break;
+            default:
+                continue;
+            }
+
+            if (putmsg (conn->msgbuffer, out, outlength, stamp) != 0
+              && (growconnection (conn, outlength) != 0
+                || putmsg (conn->msgbuffer, out, outlength, stamp) != 0)) {
+                conn->dropped++;
+                w->dropped++;
+                PROBE3 (drop, conn->socketfd, length, stamp);
+                if (verbose >= 100)
+                    LOG ("worker %ld: dropped message to buffer 0x%lx\n",
+                        w->id, conn->msgbuffer);
+            }
+        }
+    }
+
+    if (lost > 0 && first == 0 && verbose >= 10)
+        LOG ("worker %ld: fell behind, %lu sentences lost\n", w->id, lost);
+
+    return;
+}
+
+
+
+
+/*
+* serve
+*
+* Queues new records for all of a worker's connections and writes them
+* out, high-priority connections first.
+*
+* Parameters:
+*     w : worker_t * : The worker.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     High-priority connections are queued and flushed before any other
+*     connection is touched, so their latency does not depend on how many
+*     other clients the worker serves.  Both passes stop at the same
+*     head, so a connection that changes class neither misses nor
+*     repeats a record.  Queues that were grown are shrunk back once
+*     they are empty and the client has not lagged for QUEUESHRINKDELAY
+*     seconds.  AIS snapshots are queued behind the live records, and
+*     replays up to the same head; w->backlogs counts those that can go
+*     on without waiting for the client to read.
+*
+*/
+static void serve (worker_t * w)
+{
+    unsigned long head[MAXCHANNELS];
+    connectionmgr_t * c;
+    struct timespec now;
+    int i;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    w->now = now.tv_sec;
+
+    if (w->reprioritize)
+        reprioritize (w);
+
+    for (c = w->cmgr; c != NULL; c = c->next)
+        head[c->index] = streamhead (c->stream);
+
+    for (c = w->cmgr; c != NULL && w->nhigh > 0; c = c->next)
+        if (w->cursor[c->index] != head[c->index])
+            fanout (w, c, head[c->index], 0, w->nhigh);
+    for (i = w->nhigh - 1; i >= 0; i--) {
+        if (w->conn[i]->replaying)
+            replay (w->conn[i], head[w->conn[i]->cmgr->index]);
+        if (w->conn[i]->snapshot != NULL)
+            sendsnapshot (w->conn[i]);
+    }
+    flushconnections (w, 0, w->nhigh);
+
+    for (c = w->cmgr; c != NULL; c = c->next) {
+        if (w->nconn > w->nhigh && w->cursor[c->index] != head[c->index])
+            fanout (w, c, head[c->index], w->nhigh, w->nconn);
+        w->cursor[c->index] = head[c->index];
+    }
+
+    for (i = w->nconn - 1; i >= w->nhigh; i--) {
+        if (w->conn[i]->replaying)
+            replay (w->conn[i], head[w->conn[i]->cmgr->index]);
+        if (w->conn[i]->snapshot != NULL)
+            sendsnapshot (w->conn[i]);
+    }
+    flushconnections (w, w->nhigh, w->nconn);
+
+    /* Return the grown queues of clients that have kept up */
+    w->backlogs = 0;
+    for (i = 0; i < w->nconn; i++) {
+        if (w->conn[i]->heapdata != NULL && w->conn[i]->msgbuffer->used == 0
+          && w->now - w->conn[i]->lagged >= QUEUESHRINKDELAY)
+            resizeconnection (w->conn[i], w->conn[i]->cmgr->initialsize);
+        if ((w->conn[i]->snapshot != NULL || w->conn[i]->replaying)
+          && w->conn[i]->waitevents == 0
+          && w->conn[i]->protocol != PROTO_HTTP)
+            w->backlogs++;
+    }
+
+    return;
+}
+
+
+
+
+/*
+* published
+*
+* Tells whether any channel has released records the worker has not yet
+* queued.
+*
+* Parameters:
+*     w : worker_t * : The worker.
+*
+* Return Value:
+*     The function returns TRUE if there are new records.
+*
+* Remarks:
+*
+*/
+static int published (worker_t * w)
+{
+    connectionmgr_t * c;
+
+    for (c = w->cmgr; c != NULL; c = c->next)
+        if (streamhead (c->stream) != w->cursor[c->index])
+            return TRUE;
+
+    return FALSE;
+}
+
+
+
+
+/*
+* acceptconnections
+*
+* Accepts pending connections on the worker's own listening socket.
+*
+* Parameters:
+*     w : worker_t * : The worker.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Used with SO_REUSEPORT, where the kernel spreads incoming
+*     connections over the workers' listening sockets.  Only the first
+*     channel's port is shared this way.
+*
+*/
+static void acceptconnections (worker_t * w)
+{
+    connection_t * conn;
+    int wsd;
+
+    do {
+        wsd = accept (w->listenfd, NULL, NULL);
+        if (wsd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+              && errno != ECONNABORTED && verbose >= 10)
+                perror ("accept");
+            return;
+        }
+
+        conn = admitconnection (w->cmgr, wsd, PRIORITY_NORMAL);
+        if (conn != NULL)
+            adoptconnection (w, conn);
+    } while (1);
+}
+
+
+
+
+/*
+* workerproc
+*
+* Event loop of a worker thread.
+*
+* Parameters:
+*     arg : pointer : A pointer to the worker_t structure of the thread.
+*
+* Return Value:
+*     The function does not return.
+*
+* Remarks:
+*
+*/
+static void * workerproc (void * arg)
+{
+    worker_t * w = (worker_t * ) arg;
+    connection_t * conn;
+    char scratch[BUFSZ];
+    int npfd, base, i;
+    short revents;
+
+    if (w->cpu >= 0)
+        pinthread (pthread_self (), w->cpu);
+
+    if (verbose >= 10)
+        printf ("worker %d: started\n", w->id);
+
+    while (1) {
+        /* Adopt connections handed over by the acceptor */
+        if (w->handoff != NULL) {
+            sem_wait (&w->semhandoff);
+            conn = w->handoff;
+            w->handoff = NULL;
+            sem_post (&w->semhandoff);
+
+            while (conn != NULL) {
+                connection_t * next = conn->handoff;
+                adoptconnection (w, conn);
+                conn = next;
+            }
+        }
+
+        serve (w);
+
+        npfd = 0;
+        w->pfd[npfd].fd = w->wakefd[0];
+        w->pfd[npfd++].events = POLLIN;
+        if (w->listenfd >= 0) {
+            w->pfd[npfd].fd = w->listenfd;
+            w->pfd[npfd++].events = POLLIN;
+        }
+        base = npfd;
+        for (i = 0; i < w->nconn; i++) {
+            w->pfd[npfd].fd = w->conn[i]->socketfd;
+            w->pfd[npfd++].events = POLLIN | (w->conn[i]->waitevents & POLLOUT);
+        }
+
+        /* Announce that we are about to sleep, then look once more, so
+           that a sentence published in between is not slept through. */
+        w->sleeping = TRUE;
+        barrier ();
+        if (published (w) || w->handoff != NULL || w->backlogs > 0) {
+            w->sleeping = FALSE;
+            continue;
+        }
+
+        if (poll (w->pfd, npfd, -1) < 0) {
+            w->sleeping = FALSE;
+            if (errno != EINTR)
+                perror ("poll");
+            continue;
+        }
+        w->sleeping = FALSE;
+
+        if (w->pfd[0].revents & POLLIN)
+            while (read (w->wakefd[0], scratch, sizeof (scratch)) > 0)
+                ;
+
+        if (w->listenfd >= 0 && (w->pfd[1].revents & POLLIN))
+            acceptconnections (w);
+
+        /* Walk backwards: dropping moves the last connection into place */
+        for (i = w->nconn - 1; i >= 0; i--) {
+            conn = w->conn[i];
+            revents = w->pfd[base + i].revents;
+            if (revents == 0)
+                continue;
+
+            if ((revents & POLLERR) && conn->zc != NULL) {
+                if (zcreap (conn->zc) != 0) {
+                    dropconnection (w, i);
+                    continue;
+                }
+                if (conn->waitevents == POLLERR)
+                    conn->waitevents = 0;
+                revents &= ~POLLERR;
+            }
+
+            if (revents & POLLIN) {
+                /* Commands from the client; a read also notices that
+                   the connection has been closed. */
+                int n = read (conn->socketfd, scratch, sizeof (scratch));
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                    dropconnection (w, i);
+                    continue;
+                }
+                if (n > 0 && clientinput (conn, scratch, n) != 0) {
+                    dropconnection (w, i);
+                    continue;
+                }
+            }
+
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                dropconnection (w, i);
+                continue;
+            }
+
+            if (revents & POLLOUT) {
+                if (flushconnection (conn) != 0)
+                    dropconnection (w, i);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+* startworkers
+*
+* Creates the worker threads shared by all channels.
+*
+* Parameters:
+*     cmgr      : connectionmgr_t * : The first channel's connection
+*                                     manager; the others follow through
+*                                     cmgr->next.
+*     nworkers  : int               : Number of worker threads.
+*     cpus      : const int *       : CPUs to pin the workers to, in turn.
+*     ncpus     : int               : Number of CPUs at cpus; zero leaves
+*                                     the workers unpinned.
+*     shareport : int               : Port on which to give each worker
+*                                     its own SO_REUSEPORT socket, or 0.
+*
+* Return Value:
+*     The function returns zero if successful, nonzero if not.
+*
+* Remarks:
+*     Each worker's table is sized for every channel's connections.
+*     Where io_uring is built in and allowed, each worker also gets a
+*     ring to write through; without one it writes with writev.
+*
+*/
+int startworkers (connectionmgr_t * cmgr, int nworkers, const int * cpus,
+                  int ncpus, int shareport)
+{
+    worker_t * workers, * w;
+    connectionmgr_t * c;
+    pthread_attr_t attr;
+    int maxconn = 0;
+    int i;
+
+    workers = (worker_t *) calloc (nworkers, sizeof (worker_t));
+    if (workers == NULL)
+        return -1;
+    for (c = cmgr; c != NULL; c = c->next) {
+        c->worker = workers;
+        c->nworkers = nworkers;
+        maxconn += c->maxconn;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        w = &workers[i];
+        w->id = i;
+        w->cmgr = cmgr;
+        w->cpu = (ncpus > 0) ? cpus[i % ncpus] : -1;
+        for (c = cmgr; c != NULL; c = c->next)
+            w->cursor[c->index] = streamhead (c->stream);
+        w->conn = (connection_t **) calloc (maxconn, sizeof (connection_t *));
+        w->pfd = (struct pollfd *) calloc (maxconn + 2,
+                                           sizeof (struct pollfd));
+        if (w->conn == NULL || w->pfd == NULL)
+            return -1;
+
+        w->uring = newuring (maxconn < URINGMAX ? maxconn : URINGMAX);
+        if (w->uring != NULL) {
+            w->iov = (struct iovec *) calloc ((size_t) maxconn * IOVMAX,
+                                              sizeof (struct iovec));
+            w->submitted = (long *) calloc (maxconn, sizeof (long));
+            w->result = (int *) calloc (maxconn, sizeof (int));
+            if (w->iov == NULL || w->submitted == NULL || w->result == NULL)
+                return -1;
+            if (verbose >= 10)
+                printf ("worker %d: writing through io_uring\n", i);
+        }
+
+        if (pipe (w->wakefd) != 0) {
+            perror ("pipe");
+            return -1;
+        }
+        fcntl (w->wakefd[0], F_SETFL, O_NONBLOCK);
+        fcntl (w->wakefd[1], F_SETFL, O_NONBLOCK);
+        sem_init (&w->semhandoff, 0, 1);
+
+        w->listenfd = -1;
+        if (shareport > 0) {
+            w->listenfd = openlistener (shareport, TRUE);
+            if (w->listenfd == -1)
+                return -1;
+            fcntl (w->listenfd, F_SETFL, O_NONBLOCK);
+        }
+
+        initthreadattr (&attr);
+        if (pthread_create (&w->thread, &attr, workerproc, (void *) w) != 0) {
+            perror ("pthread_create");
+            return -1;
+        }
+        pthread_attr_destroy (&attr);
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+* assignconnection
+*
+* Hands a newly accepted connection to a worker, round-robin.
+*
+* Parameters:
+*     cmgr : connectionmgr_t * : The connection manager.
+*     conn : connection_t *    : The connection.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*
+*/
+void assignconnection (connectionmgr_t * cmgr, connection_t * conn)
+{
+    worker_t * w;
+
+    sem_wait (&cmgr->semaccess);
+    w = &cmgr->worker[cmgr->nextworker];
+    cmgr->nextworker = (cmgr->nextworker + 1) % cmgr->nworkers;
+    sem_post (&cmgr->semaccess);
+
+    sem_wait (&w->semhandoff);
+    conn->handoff = w->handoff;
+    w->handoff = conn;
+    sem_post (&w->semhandoff);
+
+    write (w->wakefd[1], "", 1);
+
+    return;
+}
+
+
+
+
+/*
+* wakeworkers
+*
+* Wakes the workers that are waiting for new sentences.
+*
+* Parameters:
+*     cmgr : connectionmgr_t * : The connection manager.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Called by the talker after each publish.  Busy workers are not
+*     signalled; they pick the new record up before they next sleep.
+*     Workers serving high-priority connections are woken first.
+*
+*/
+void wakeworkers (connectionmgr_t * cmgr)
+{
+    worker_t * w;
+    int pass, i;
+
+    barrier ();
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < cmgr->nworkers; i++) {
+            w = &cmgr->worker[i];
+            if ((w->nhigh > 0) == (pass == 0) && w->sleeping) {
+                w->sleeping = FALSE;
+                write (w->wakefd[1], "", 1);
+            }
+        }
+    }
+
+    return;
+}
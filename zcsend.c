@@ -0,0 +1,364 @@
+/*
+* zcsend.c
+*
+* NMEA Server Application
+*
+* Optional MSG_ZEROCOPY send path for listener connections.  Batches of
+* sentences are assembled in a page-backed ring owned by the connection
+* and transmitted without copying them into the socket buffer; completion
+* notifications are reaped from the socket error queue before a chunk of
+* the ring is reused.
+*
+* On systems without MSG_ZEROCOPY, newzcsender always fails and the
+* connection is written with writev() from its queue instead.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include "nmead.h"
+#include "zcsend.h"
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+
+extern int verbose;
+
+
+
+
+
+
+
+/*
+* zcreap
+*
+* Collects completion notifications from the socket error queue and
+* releases the chunks they cover.
+*
+* Parameters:
+*     zc : zcsender_t * : The sender whose socket is to be reaped.
+*
+* Return Value:
+*     The function returns zero if successful, or -1 if the connection
+*     has failed.
+*
+* Remarks:
+*     Called when poll reports POLLERR on the socket, and before a busy
+*     chunk is reused.  If the kernel reports that it had to copy the
+*     data anyway (as it does on loopback), zerocopy is switched off for
+*     the connection; it only costs page pinning in that case.
+*
+*/
+int zcreap (zcsender_t * zc)
+{
+#ifdef HAVE_ZEROCOPY
+    struct msghdr msg;
+    struct cmsghdr * cm;
+    struct sock_extended_err * serr;
+    char control[128];
+    unsigned int lo, hi;
+    int i;
+
+    do {
+        memset (&msg, 0, sizeof (msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof (control);
+
+        if (recvmsg (zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return 0;
+            return -1;
+        }
+
+        for (cm = CMSG_FIRSTHDR (&msg); cm != NULL;
+             cm = CMSG_NXTHDR (&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+               || (cm->cmsg_level == SOL_IPV6
+                   && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *) CMSG_DATA (cm);
+            if (serr->ee_errno != 0
+              || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+            for (i = 0; i < ZCCHUNKS; i++) {
+                if (zc->busy[i]
+                  && (int) (zc->chunkid[i] - lo) >= 0
+                  && (int) (hi - zc->chunkid[i]) >= 0)
+                    zc->busy[i] = FALSE;
+            }
+
+            if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zc->enabled) {
+                if (verbose >= 10)
+                    printf ("zcsend: kernel copied data for fd %d; "
+                            "using write()\n", zc->fd);
+                zc->enabled = FALSE;
+            }
+        }
+    } while (1);
+#else
+    return 0;
+#endif
+}
+
+
+
+
+/*
+* newzcsender
+*
+* Enables MSG_ZEROCOPY on a connected socket and allocates its send ring.
+*
+* Parameters:
+*     fd : int : The connected socket.
+*
+* Return Value:
+*     The function returns a pointer to a new zcsender_t object, or NULL if
+*     zerocopy is not available for the socket.
+*
+* Remarks:
+*
+*/
+zcsender_t * newzcsender (int fd)
+{
+#ifdef HAVE_ZEROCOPY
+    zcsender_t * zc;
+    int one = 1;
+
+    if (setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) != 0) {
+        if (verbose >= 10)
+            perror ("setsockopt SO_ZEROCOPY");
+        return NULL;
+    }
+
+    zc = (zcsender_t *) calloc (1, sizeof (zcsender_t));
+    if (zc == NULL) return NULL;
+
+    zc->base = mmap (NULL, ZCCHUNKS * ZCCHUNKSIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (zc->base == MAP_FAILED) {
+        free (zc);
+        return NULL;
+    }
+
+    zc->fd = fd;
+    zc->enabled = TRUE;
+
+    return zc;
+#else
+    return NULL;
+#endif
+}
+
+
+
+
+/*
+* destroyzcsender
+*
+* Releases the send ring of a connection.
+*
+* Parameters:
+*     zc : zcsender_t * : The object to be destroyed.
+*
+* Return Value:
+*     The function does not return a value.
+*
+* Remarks:
+*     Pages still referenced by unsent data are pinned by the kernel, so
+*     the ring may be unmapped without waiting for outstanding
+*     notifications.
+*
+*/
+void destroyzcsender (zcsender_t * zc)
+{
+    if (zc == NULL) return;
+
+    munmap (zc->base, ZCCHUNKS * ZCCHUNKSIZE);
+    free (zc);
+
+    return;
+}
+
+
+
+
+/*
+* zcbuffer
+*
+* Returns the chunk in which the next batch is to be assembled.
+*
+* Parameters:
+*     zc    : zcsender_t * : The sender.
+*     avail : size_t *     : Receives the number of bytes available.
+*
+* Return Value:
+*     The function returns a pointer to the chunk, or NULL if no chunk can
+*     be filled yet: either part of the previous batch is unsent, or the
+*     kernel still references the next chunk.
+*
+* Remarks:
+*     In the second case the caller waits for POLLERR and calls zcreap.
+*
+*/
+char * zcbuffer (zcsender_t * zc, size_t * avail)
+{
+    if (zc->length > 0)
+        return NULL;
+
+    if (zc->busy[zc->next] && zcreap (zc) != 0)
+        return NULL;
+    if (zc->busy[zc->next])
+        return NULL;
+
+    *avail = ZCCHUNKSIZE;
+    return zc->base + zc->next * ZCCHUNKSIZE;
+}
+
+
+
+
+/*
+* zcsend
+*
+* Starts transmitting the batch assembled in the current chunk.
+*
+* Parameters:
+*     zc     : zcsender_t * : The sender.
+*     length : size_t       : Number of bytes assembled in the chunk.
+*
+* Return Value:
+*     The function returns ZC_DONE if the whole batch was sent, ZC_AGAIN
+*     if the socket could not take all of it, or -1 if the connection is
+*     closed.
+*
+* Remarks:
+*
+*/
+int zcsend (zcsender_t * zc, size_t length)
+{
+    zc->length = (int) length;
+    zc->sent = 0;
+
+    return zcflush (zc);
+}
+
+
+
+
+/*
+* zcflush
+*
+* Continues transmitting the current batch.
+*
+* Parameters:
+*     zc : zcsender_t * : The sender.
+*
+* Return Value:
+*     The function returns ZC_DONE if nothing remains to be sent, ZC_AGAIN
+*     if the socket buffer is full, or -1 if the connection is closed.
+*
+* Remarks:
+*
+*/
+int zcflush (zcsender_t * zc)
+{
+    char * chunk = zc->base + zc->next * ZCCHUNKSIZE;
+    ssize_t n;
+
+    while (zc->sent < zc->length) {
+#ifdef HAVE_ZEROCOPY
+        if (zc->enabled) {
+            n = send (zc->fd, chunk + zc->sent, zc->length - zc->sent,
+                      MSG_ZEROCOPY | MSG_DONTWAIT);
+            if (n >= 0) {
+                zc->chunkid[zc->next] = zc->sendid++;
+                zc->busy[zc->next] = TRUE;
+                zc->sent += n;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno != ENOBUFS) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return ZC_AGAIN;
+                return -1;
+            }
+            /* Out of optmem for notifications; copy this one. */
+        }
+#endif
+        n = send (zc->fd, chunk + zc->sent, zc->length - zc->sent,
+                  MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return ZC_AGAIN;
+            return -1;
+        }
+        zc->sent += n;
+    }
+
+    if (zc->length > 0) {
+        zc->next = (zc->next + 1) % ZCCHUNKS;
+        zc->length = 0;
+        zc->sent = 0;
+    }
+
+    return ZC_DONE;
+}
@@ -0,0 +1,106 @@
+/*
+* zcsend.h
+*
+* NMEA Server Application
+*
+* Structure and function prototypes for the optional MSG_ZEROCOPY send
+* path used by listener connections.
+*
+*/
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *          		    NO WARRANTY
+ *
+ *    BECAUSE THE PROGRAM IS LICENSED FREE OF CHARGE, THERE IS NO
+ *  WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY APPLICABLE
+ *  LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+ *  HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING, BUT
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ *  FITNESS FOR A PARTICULAR PURPOSE.  THE ENTIRE RISK AS TO THE
+ *  QUALITY AND PERFORMANCE OF THE PROGRAM IS WITH YOU.  SHOULD THE
+ *  PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF ALL NECESSARY
+ *  SERVICING, REPAIR OR CORRECTION.
+ *
+ *    IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN
+ *  WRITING WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MAY
+ *  MODIFY AND/OR REDISTRIBUTE THE PROGRAM AS PERMITTED ABOVE, BE
+ *  LIABLE TO YOU FOR DAMAGES, INCLUDING ANY GENERAL, SPECIAL,
+ *  INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+ *  INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+ *  DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU
+ *  OR THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY
+ *  OTHER PROGRAMS), EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN
+ *  ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+*/
+
+
+#ifndef ZCSEND_H
+#define ZCSEND_H
+
+#include <stddef.h>
+
+
+/* The send area of each connection is a page-backed ring of chunks.  A
+   batch of sentences is assembled in the current chunk and handed to the
+   kernel, which transmits it straight from these pages.  A chunk may not
+   be refilled until the kernel has reported, on the socket error queue,
+   that it no longer references the pages.
+
+   Sockets are non-blocking: a batch the socket cannot take at once
+   stays in its chunk and is completed by later zcflush calls. */
+#define ZCCHUNKS       16
+#define ZCCHUNKSIZE    8192      /* at least one MSGLENGTHLIMIT message */
+
+#define ZC_DONE        0
+#define ZC_AGAIN       1         /* socket buffer full; wait for POLLOUT */
+
+
+typedef struct {
+    int fd;
+    int enabled;                   /* FALSE once the kernel falls back to
+                                      copying; plain write() is used then */
+    char * base;                   /* ZCCHUNKS * ZCCHUNKSIZE mmap'd bytes */
+    int next;                      /* chunk being filled or sent */
+    int length;                    /* bytes of the batch in that chunk */
+    int sent;                      /* bytes of the batch already sent */
+    unsigned int sendid;           /* kernel's id for the next send */
+    unsigned int chunkid[ZCCHUNKS];
+    int busy[ZCCHUNKS];
+} zcsender_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+zcsender_t * newzcsender (int fd);
+void destroyzcsender (zcsender_t * zc);
+char * zcbuffer (zcsender_t * zc, size_t * avail);
+int zcsend (zcsender_t * zc, size_t length);
+int zcflush (zcsender_t * zc);
+int zcreap (zcsender_t * zc);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /* ZCSEND_H */